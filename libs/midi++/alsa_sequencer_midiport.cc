@@ -133,11 +133,7 @@ int ALSA_SequencerMidiPort::read (byte *buf, size_t max)
 		bytes_read += err;
 
 		if (input_parser) {
-			input_parser->raw_preparse (*input_parser, buf, err, get_current_host_time());
-			for (int i = 0; i < err; i++) {
-				input_parser->scanner (buf[i]);
-			}	
-			input_parser->raw_postparse (*input_parser, buf, err);
+			input_parser->feed (buf, err, get_current_host_time());
 		}
 	}
 	return -ENOENT == err ? 0 : err;
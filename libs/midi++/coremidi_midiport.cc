@@ -132,11 +132,7 @@ void CoreMidi_MidiPort::read_proc (const MIDIPacketList *pktlist, void *refCon,
         driver->bytes_read += packet->length;
 
 	    if (driver->input_parser) {
-		    driver->input_parser->raw_preparse (*driver->input_parser, packet->data, packet->length, host_time_to_secs(packet->timeStamp));
-			for (int j = 0; j < packet->length; ++j) {
-				driver->input_parser->scanner (packet->data[j]);
-			}	
-			driver->input_parser->raw_postparse (*driver->input_parser, packet->data, packet->length);
+		    driver->input_parser->feed (packet->data, packet->length, host_time_to_secs(packet->timeStamp));
 		}
                  
         packet = MIDIPacketNext(packet);
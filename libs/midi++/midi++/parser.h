@@ -38,6 +38,19 @@ typedef sigc::signal2<void, Parser &, pitchbend_t>          PitchBendSignal;
 typedef sigc::signal3<void, Parser &, byte *, size_t> Signal;
 typedef sigc::signal4<void, Parser &, byte *, size_t, timestamp_t> TimestampedSignal;
 
+/* one decoded message from parse(), data bytes a message
+   doesn't have are 0.
+*/
+
+struct ParsedEvent {
+	timestamp_t timestamp;
+	byte        status;
+	byte        data1;
+	byte        data2;
+};
+
+typedef sigc::signal3<void, Parser &, ParsedEvent *, size_t> BulkSignal;
+
 class Parser : public sigc::trackable {
  public:
 	Parser (Port &p);
@@ -85,12 +98,38 @@ class Parser : public sigc::trackable {
 	sigc::signal1<void, Parser &>          reset;
 	sigc::signal1<void, Parser &>          eox;
 
+	/* in bulk mode, emitted once per chunk of a read
+	   instead of all of the above except raw_preparse
+	   and raw_postparse.
+	*/
+
+	BulkSignal            bulk;
+
 	/* This should really be protected, but then derivatives of Port
 	   can't access it.
 	*/
 
 	void scanner (byte c);
 
+	/* what a Port hands each read to, it goes to scanner()
+	   or, in bulk mode, parse() and the bulk signal.
+	*/
+
+	void feed (byte *buf, size_t len, timestamp_t ts);
+
+	/* Decode len bytes in one pass into at most max events,
+	   keeping running status across calls.  Sysex is skipped
+	   and active sense dropped, as scanner() does.  Returns
+	   the number of events, consumed is set to the bytes used,
+	   which is less than len only if events filled up.
+	*/
+
+	size_t parse (const byte *buf, size_t len, timestamp_t ts,
+		      ParsedEvent *events, size_t max, size_t &consumed);
+
+	void set_bulk (bool yn) { _bulk = yn; }
+	bool bulk_mode () const { return _bulk; }
+
 	size_t *message_counts() { return message_counter; }
 	const char *midi_event_type_name (MIDI::eventType);
 	void trace (bool onoff, std::ostream *o, const std::string &prefix = "");
@@ -171,6 +210,16 @@ class Parser : public sigc::trackable {
 
 	void handle_preparse(Parser &, byte *, size_t, timestamp_t);
 	timestamp_t _timestamp;
+
+	/* bulk parsing */
+
+	bool _bulk;
+	byte _bulk_status;     /* 0 when there is no running status */
+	byte _bulk_data[2];
+	int  _bulk_need;
+	int  _bulk_have;
+	bool _bulk_sysex;
+	ParsedEvent _parsed[64];
 };
 
 }; /* namespace MIDI */
@@ -119,6 +119,12 @@ Parser::Parser (Port &p)
 	_mmc_forward = false;
 	reset_mtc_state ();
 
+	_bulk = false;
+	_bulk_status = 0;
+	_bulk_need = 0;
+	_bulk_have = 0;
+	_bulk_sysex = false;
+
 	raw_preparse.connect(mem_fun(*this, &Parser::handle_preparse));
 
 	/* this hack deals with the possibility of our first MIDI
@@ -330,6 +336,137 @@ Parser::trace (bool onoff, ostream *o, const string &prefix)
 	}
 }
 
+void
+Parser::feed (byte *buf, size_t len, timestamp_t ts)
+{
+	raw_preparse (*this, buf, len, ts);
+
+	if (_bulk) {
+		byte *p = buf;
+		size_t left = len;
+
+		while (left > 0) {
+			size_t used;
+			size_t n = parse (p, left, ts, _parsed, sizeof (_parsed) / sizeof (_parsed[0]), used);
+
+			if (n > 0) {
+				bulk (*this, _parsed, n);
+			}
+			p += used;
+			left -= used;
+		}
+	} else {
+		for (size_t i = 0; i < len; i++) {
+			scanner (buf[i]);
+		}
+	}
+
+	raw_postparse (*this, buf, len);
+}
+
+size_t
+Parser::parse (const byte *buf, size_t len, timestamp_t ts,
+	       ParsedEvent *events, size_t max, size_t &consumed)
+{
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i < len && n < max; i++) {
+		byte inbyte = buf[i];
+
+		if (inbyte >= 0xf8) {
+			/* real time, anywhere, running status left alone */
+
+			message_counter[inbyte]++;
+
+			if (inbyte != 0xfe) {
+				events[n].timestamp = ts;
+				events[n].status = inbyte;
+				events[n].data1 = 0;
+				events[n].data2 = 0;
+				n++;
+			}
+			continue;
+		}
+
+		if (inbyte & 0x80) {
+			_bulk_have = 0;
+			_bulk_sysex = (inbyte == MIDI::sysex);
+
+			if (inbyte < 0xf0) {
+				_bulk_status = inbyte;
+				switch (inbyte & 0xF0) {
+				case 0xc0:
+				case 0xd0:
+					_bulk_need = 1;
+					break;
+				default:
+					_bulk_need = 2;
+					break;
+				}
+				continue;
+			}
+
+			/* system messages cancel running status */
+
+			_bulk_status = 0;
+
+			switch (inbyte) {
+			case 0xf1:
+			case 0xf3:
+				_bulk_status = inbyte;
+				_bulk_need = 1;
+				break;
+			case 0xf2:
+				_bulk_status = inbyte;
+				_bulk_need = 2;
+				break;
+			case 0xf6:
+				message_counter[inbyte]++;
+				events[n].timestamp = ts;
+				events[n].status = inbyte;
+				events[n].data1 = 0;
+				events[n].data2 = 0;
+				n++;
+				break;
+			default:
+				/* sysex start or end */
+				break;
+			}
+			continue;
+		}
+
+		/* a data byte, dropped inside sysex or with no status */
+
+		if (_bulk_sysex || _bulk_status == 0) {
+			continue;
+		}
+
+		_bulk_data[_bulk_have++] = inbyte;
+
+		if (_bulk_have < _bulk_need) {
+			continue;
+		}
+
+		message_counter[_bulk_status & 0xF0]++;
+
+		events[n].timestamp = ts;
+		events[n].status = _bulk_status;
+		events[n].data1 = _bulk_data[0];
+		events[n].data2 = (_bulk_need > 1) ? _bulk_data[1] : 0;
+		n++;
+
+		_bulk_have = 0;
+
+		if (_bulk_status >= 0xf0) {
+			_bulk_status = 0;
+		}
+	}
+
+	consumed = i;
+	return n;
+}
+
 void
 Parser::scanner (unsigned char inbyte)
 {
@@ -86,6 +86,17 @@ class AudioDriver
 
 	virtual nframes_t get_input_port_latency (port_id_t portid) = 0;
 	virtual nframes_t get_output_port_latency (port_id_t portid) = 0;
+
+	// optional midi ports that carry midi along with the audio.  the event
+	// calls are only valid inside the process callback, with offsets in frames
+	// from the start of the cycle
+	virtual bool create_midi_ports (std::string inname, std::string outname) { return false; }
+	virtual bool has_midi_ports () { return false; }
+
+	// the index'th midi input event of this cycle, false when there are no more
+	virtual bool get_midi_input_event (unsigned int index, nframes_t & offset, const unsigned char *& data, size_t & size) { return false; }
+	// output events must be written in frame order
+	virtual bool write_midi_output_event (nframes_t offset, const unsigned char * data, size_t size) { return false; }
 	
 	virtual std::string get_name() { return _client_name; }
 
@@ -100,6 +111,10 @@ class AudioDriver
 
 	virtual void reposition_transport(nframes_t framepos) {}
 	
+	// from the process callback, how far the driver's clock says this
+	// cycle is past its start.  0 if it can't tell
+	virtual nframes_t get_frames_since_cycle_start() { return 0; }
+
 	virtual nframes_t get_samplerate() { return _samplerate; }
 	virtual nframes_t get_buffersize() { return _buffersize; }
 
@@ -0,0 +1,226 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+/*
+ * Microbenchmark of the registered update fan-out, to 10 and 100 udp
+ * subscribers on loopback.
+ *
+ * "per message" does what send_registered_updates used to do for every
+ * subscriber of every update: parse the return port for the echo check,
+ * get the control's name as a string, serialise a fresh message and send
+ * it on its own through an unconnected socket.
+ *
+ * "template" does what it does now: compare the cached port, copy the
+ * (control, path) template into the subscriber's bundle with
+ * OscUpdateTemplate::append_to and send the bundle through a connected
+ * socket once the batch of updates is done.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../osc_update_template.hpp"
+
+using namespace SooperLooper;
+using namespace std;
+
+static const size_t MaxBundleSize = 1400;  // OSC_MAX_BUNDLE_SIZE in control_osc.cpp
+static const int    Updates = 20000;
+
+struct Receiver
+{
+	int                fd;
+	struct sockaddr_in addr;
+	string             port;
+};
+
+struct Sender
+{
+	int          fd;      // connected to its receiver
+	int          port;    // cached for the echo check
+	vector<char> bundle;
+};
+
+static double
+now ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+add_padded (vector<char> & buf, const char * str)
+{
+	size_t len = strlen (str) + 1;
+	buf.insert (buf.end(), str, str + len);
+	buf.resize ((buf.size() + 3) & ~3, 0);
+}
+
+static void
+add_word (vector<char> & buf, uint32_t word)
+{
+	word = htonl (word);
+	buf.insert (buf.end(), (const char *) &word, (const char *) &word + 4);
+}
+
+// what lo_message_serialise makes of an "isf" message
+static char *
+serialise (const char * path, int instance, const string & ctrl, float val, size_t & len)
+{
+	vector<char> buf;
+	uint32_t word;
+
+	add_padded (buf, path);
+	add_padded (buf, ",isf");
+	add_word (buf, (uint32_t) instance);
+	add_padded (buf, ctrl.c_str());
+	memcpy (&word, &val, 4);
+	add_word (buf, word);
+
+	len = buf.size();
+	char * data = (char *) malloc (len);
+	memcpy (data, &buf[0], len);
+	return data;
+}
+
+static void
+drain (vector<Receiver> & receivers)
+{
+	char buf[2048];
+
+	for (size_t n = 0; n < receivers.size(); ++n) {
+		while (recv (receivers[n].fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+		}
+	}
+}
+
+static void
+run (size_t subscribers, int per_pass)
+{
+	const char * path = "/ctrl";
+	map<int, string> control_names;
+	vector<Receiver> receivers (subscribers);
+	vector<Sender> senders (subscribers);
+	int plain = socket (AF_INET, SOCK_DGRAM, 0);
+
+	control_names[0] = "feedback";
+
+	for (size_t n = 0; n < subscribers; ++n) {
+		Receiver & rcv = receivers[n];
+		socklen_t addrlen = sizeof(rcv.addr);
+		char portstr[16];
+
+		rcv.fd = socket (AF_INET, SOCK_DGRAM, 0);
+		memset (&rcv.addr, 0, sizeof(rcv.addr));
+		rcv.addr.sin_family = AF_INET;
+		rcv.addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+		bind (rcv.fd, (struct sockaddr *) &rcv.addr, sizeof(rcv.addr));
+		getsockname (rcv.fd, (struct sockaddr *) &rcv.addr, &addrlen);
+		snprintf (portstr, sizeof(portstr), "%d", ntohs (rcv.addr.sin_port));
+		rcv.port = portstr;
+
+		Sender & snd = senders[n];
+		snd.fd = socket (AF_INET, SOCK_DGRAM, 0);
+		connect (snd.fd, (struct sockaddr *) &rcv.addr, sizeof(rcv.addr));
+		snd.port = ntohs (rcv.addr.sin_port);
+		snd.bundle.reserve (MaxBundleSize);
+	}
+
+	size_t len;
+	char * msg = serialise (path, 0, control_names[0], 0.0f, len);
+	OscUpdateTemplate tmpl;
+	tmpl.set (msg, len, strlen (path));
+	free (msg);
+
+	// the set came from somewhere else, so nobody is skipped
+	int source = 1;
+	double start, old_secs = 0.0, new_secs = 0.0;
+
+	for (int update = 0; update < Updates; update += per_pass) {
+		start = now();
+		for (int k = 0; k < per_pass; ++k) {
+			float val = (float) (update + k);
+
+			for (size_t n = 0; n < subscribers; ++n) {
+				if (atoi (receivers[n].port.c_str()) == source) {
+					continue;
+				}
+				string ctrl = control_names[0];
+				msg = serialise (path, 0, ctrl, val, len);
+				sendto (plain, msg, len, 0, (struct sockaddr *) &receivers[n].addr, sizeof(receivers[n].addr));
+				free (msg);
+			}
+		}
+		old_secs += now() - start;
+		drain (receivers);
+
+		start = now();
+		for (int k = 0; k < per_pass; ++k) {
+			float val = (float) (update + k);
+
+			for (size_t n = 0; n < subscribers; ++n) {
+				Sender & snd = senders[n];
+				if (snd.port == source) {
+					continue;
+				}
+				if (!snd.bundle.empty() && snd.bundle.size() + tmpl.element_size() > MaxBundleSize) {
+					send (snd.fd, &snd.bundle[0], snd.bundle.size(), 0);
+					snd.bundle.clear();
+				}
+				tmpl.append_to (snd.bundle, 0, val);
+			}
+		}
+		for (size_t n = 0; n < subscribers; ++n) {
+			send (senders[n].fd, &senders[n].bundle[0], senders[n].bundle.size(), 0);
+			senders[n].bundle.clear();
+		}
+		new_secs += now() - start;
+		drain (receivers);
+	}
+
+	printf ("%3lu subscribers, %d updates per pass:  per message %8.0f ns  template %8.0f ns  per update\n",
+		(unsigned long) subscribers, per_pass, old_secs * 1e9 / Updates, new_secs * 1e9 / Updates);
+
+	for (size_t n = 0; n < subscribers; ++n) {
+		close (receivers[n].fd);
+		close (senders[n].fd);
+	}
+	close (plain);
+}
+
+int
+main (int argc, char ** argv)
+{
+	run (10, 1);
+	run (10, 8);
+	run (100, 1);
+	run (100, 8);
+	return 0;
+}
@@ -17,6 +17,8 @@
 **
 */
 
+#include <cstring>
+
 #include "command_map.hpp"
 
 
@@ -181,6 +183,13 @@ CommandMap::CommandMap()
 		_ctrl_str_map[(*iter).second] = (*iter).first;
 	}
 
+	// the maps are sorted, so these are too
+	for (StringCommandMap::iterator iter = _str_cmd_map.begin(); iter != _str_cmd_map.end(); ++iter) {
+		_cmd_lookup.push_back (CommandLookup::value_type ((*iter).first.c_str(), (*iter).second));
+	}
+	for (StringControlMap::iterator iter = _str_ctrl_map.begin(); iter != _str_ctrl_map.end(); ++iter) {
+		_ctrl_lookup.push_back (ControlLookup::value_type ((*iter).first.c_str(), (*iter).second));
+	}
 
 }
 
@@ -198,6 +207,13 @@ void CommandMap::get_controls (list<std::string> & ctrllist)
 	}
 }
 
+void CommandMap::get_input_controls (list<std::string> & ctrllist)
+{
+	for (StringControlMap::iterator iter = _input_controls.begin(); iter != _input_controls.end(); ++iter) {
+		ctrllist.push_back ((*iter).first);
+	}
+}
+
 void CommandMap::get_global_controls (list<std::string> & ctrllist)
 {
 	for (StringControlMap::iterator iter = _global_controls.begin(); iter != _global_controls.end(); ++iter) {
@@ -235,3 +251,44 @@ void CommandMap::add_global_control(const std::string & name, Event::control_t c
 	_global_controls[name] = ctrl;
 	_ctrl_info_map[name] = ControlInfo(name, ctrl, unit, minVal, maxVal, defaultVal);
 }
+
+template <class T>
+static const std::pair<const char *, T> *
+find_name (const std::vector<std::pair<const char *, T> > & table, const char * name)
+{
+	size_t lo = 0;
+	size_t hi = table.size();
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		int cmp = strcmp (table[mid].first, name);
+
+		if (cmp == 0) {
+			return &table[mid];
+		}
+		else if (cmp < 0) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return 0;
+}
+
+Event::command_t
+CommandMap::find_command (const char * cmd) const
+{
+	const CommandLookup::value_type * result = find_name (_cmd_lookup, cmd);
+
+	return result ? result->second : Event::UNKNOWN;
+}
+
+Event::control_t
+CommandMap::find_control (const char * ctrl) const
+{
+	const ControlLookup::value_type * result = find_name (_ctrl_lookup, ctrl);
+
+	return result ? result->second : Event::Unknown;
+}
@@ -23,6 +23,8 @@
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
+#include <utility>
 #include "event.hpp"
 
 namespace SooperLooper {
@@ -90,8 +92,13 @@ public:
 	inline Event::type_t  to_type_t (std::string cmd);
 	inline std::string       to_type_str (Event::type_t cmd);
 
+	// same as to_command_t and to_control_t, without building a string
+	Event::command_t  find_command (const char * cmd) const;
+	Event::control_t  find_control (const char * ctrl) const;
+
 	void get_commands (std::list<std::string> & cmdlist);
 	void get_controls (std::list<std::string> & ctrllist);
+	void get_input_controls (std::list<std::string> & ctrllist);
 	void get_global_controls (std::list<std::string> & ctrllist);
 
 	bool get_control_info(const std::string & ctrl, ControlInfo & info);
@@ -143,6 +150,12 @@ protected:
 	StringControlMap _output_controls;
 	StringControlMap _event_controls;
 	StringControlMap _global_controls;
+
+	// the keys of _str_cmd_map and _str_ctrl_map, in the same order
+	typedef std::vector<std::pair<const char *, Event::command_t> > CommandLookup;
+	typedef std::vector<std::pair<const char *, Event::control_t> > ControlLookup;
+	CommandLookup _cmd_lookup;
+	ControlLookup _ctrl_lookup;
 };
 
 
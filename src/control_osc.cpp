@@ -21,11 +21,17 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cerrno>
+#include <cstdarg>
 #include <algorithm>
 
 #include <sys/poll.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <cstring>
 
 #include "control_osc.hpp"
 #include "event_nonrt.hpp"
@@ -33,6 +39,7 @@
 #include "ringbuffer.hpp"
 #include "midi_bind.hpp"
 #include "command_map.hpp"
+#include "osc_tcp_link.hpp"
 #include "version.h"
 
 #include <lo/lo.h>
@@ -44,6 +51,33 @@ using namespace std;
 
 //#define DEBUG 1
 
+// keep bundles inside a single ethernet sized udp datagram
+#define OSC_MAX_BUNDLE_SIZE 1400
+
+// seconds between the OSC (NTP) and unix epochs
+#define OSC_UNIX_EPOCH_OFFSET 2208988800.0
+
+// the wall clock time the bundle carrying this message is due, or 0 if
+// it should happen right away
+static EventGenerator::time_stamp_t
+bundle_time (void * data)
+{
+	lo_timetag tt = lo_message_get_timestamp ((lo_message) data);
+	lo_timetag now;
+
+	if (tt.sec == 0 && tt.frac <= 1) {
+		// immediate, or not in a bundle at all
+		return 0;
+	}
+
+	lo_timetag_now (&now);
+	if (lo_timetag_diff (tt, now) <= 0.0) {
+		return 0;
+	}
+
+	return ((double) tt.sec - OSC_UNIX_EPOCH_OFFSET) + ((double) tt.frac / 4294967296.0);
+}
+
 static void error_callback(int num, const char *m, const char *path)
 {
 #ifdef DEBUG
@@ -53,7 +87,7 @@ static void error_callback(int num, const char *m, const char *path)
 
 
 
-ControlOSC::ControlOSC(Engine * eng, unsigned int port)
+ControlOSC::ControlOSC(Engine * eng, unsigned int port, bool use_tcp)
 	: _engine(eng), _port(port)
 {
 	char tmpstr[255];
@@ -62,8 +96,36 @@ ControlOSC::ControlOSC(Engine * eng, unsigned int port)
 	_shutdown = false;
 	_osc_server = 0;
 	_osc_unix_server = 0;
+	_osc_tcp_server = 0;
 	_osc_thread = 0;
-	_max_instance = 0;
+	_cmd_map = &CommandMap::instance();
+
+	_recv_bufs = new char[RecvBatch * RecvBufSize];
+	_recv_changes.reserve (RecvBatch * RecvMaxBatches);
+	_recv_changes_src = 0;
+	_recv_source_port = -1;
+	_recv_packets = 0;
+	_recv_dropped = 0;
+	_recv_max_batch = 0;
+	_recv_max_queue_depth = 0;
+	_held_updates = false;
+
+	// what a /register_diff client gets sent
+	_config_serial = 0;
+	list<string> names;
+	_cmd_map->get_input_controls (names);
+	for (list<string>::iterator name = names.begin(); name != names.end(); ++name) {
+		_loop_config_ctrls.push_back (_cmd_map->to_control_t (*name));
+	}
+	names.clear();
+	_cmd_map->get_global_controls (names);
+	for (list<string>::iterator name = names.begin(); name != names.end(); ++name) {
+		CommandMap::ControlInfo info;
+		// skip the ones that are only triggers
+		if (_cmd_map->get_control_info (*name, info) && info.unit != CommandMap::UnitGeneric) {
+			_global_config_ctrls.push_back (info.ctrl);
+		}
+	}
 	
 	for (int j=0; j < 20; ++j) {
 		snprintf(tmpstr, sizeof(tmpstr), "%d", _port);
@@ -78,6 +140,15 @@ ControlOSC::ControlOSC(Engine * eng, unsigned int port)
 		continue;
 	}
 
+	if (use_tcp) {
+		// same port number as the udp server
+		snprintf(tmpstr, sizeof(tmpstr), "%d", _port);
+
+		if (!(_osc_tcp_server = lo_server_new_with_proto (tmpstr, LO_TCP, error_callback))) {
+			cerr << "sooperlooper: can't get osc tcp server at port: " << _port << endl;
+		}
+	}
+
 	/*** APPEARS sluggish for now
 	     
 	// attempt to create unix socket server too
@@ -98,19 +169,11 @@ ControlOSC::ControlOSC(Engine * eng, unsigned int port)
 	_engine->LoopAdded.connect(mem_fun (*this, &ControlOSC::on_loop_added));
 	_engine->LoopRemoved.connect(mem_fun (*this, &ControlOSC::on_loop_removed));
 
+	build_loop_methods();
 	register_callbacks();
-
-	// for all loops
-	on_loop_added(-1);
-
-	// for selected loop
-	on_loop_added(-3);
 	
 	// lo_server_thread_add_method(_sthread, NULL, NULL, ControlOSC::_dummy_handler, this);
 
-	_cmd_map = &CommandMap::instance();
-
-
 	if (!init_osc_thread()) {
 		return;
 	}
@@ -128,21 +191,38 @@ ControlOSC::~ControlOSC()
 
 	// stop server thread
 	terminate_osc_thread();
+
+	delete [] _recv_bufs;
+
+	for (TcpLinkMap::iterator link = _tcp_links.begin(); link != _tcp_links.end(); ++link) {
+		delete (*link).second;
+	}
+	_tcp_links.clear();
+
+	for (UdpSocketMap::iterator sock = _udp_sockets.begin(); sock != _udp_sockets.end(); ++sock) {
+		close ((*sock).second);
+	}
+	_udp_sockets.clear();
 }
 
 void
 ControlOSC::register_callbacks()
 {
-	lo_server srvs[2];
+	lo_server srvs[3];
 	lo_server serv;
 
 	srvs[0] = _osc_server;
 	srvs[1] = _osc_unix_server;
+	srvs[2] = _osc_tcp_server;
 	
-	for (size_t i=0; i < 2; ++i) {
+	for (size_t i=0; i < 3; ++i) {
 		if (!srvs[i]) continue;
 		serv = srvs[i];
 
+		// bundles are dispatched as soon as they arrive, the handlers that
+		// care hand the timetag on to the engine, which holds the events
+		// until that exact frame
+		lo_server_enable_queue (serv, 0, 1);
 
 		/* add method that will match the path /quit with no args */
 		lo_server_add_method(serv, "/quit", "", ControlOSC::_quit_handler, this);
@@ -168,20 +248,21 @@ ControlOSC::register_callbacks()
 		// un/register config handler:  s:returl  s:retpath
 		lo_server_add_method(serv, "/register", "ss", ControlOSC::_register_config_handler, this);
 		lo_server_add_method(serv, "/unregister", "ss", ControlOSC::_unregister_config_handler, this);
+		lo_server_add_method(serv, "/register_diff", "ss", ControlOSC::_register_diff_handler, this);
+		lo_server_add_method(serv, "/unregister_diff", "ss", ControlOSC::_unregister_diff_handler, this);
+		lo_server_add_method(serv, "/resync", "ss", ControlOSC::_resync_handler, this);
 
 		lo_server_add_method(serv, "/set", "sf", ControlOSC::_global_set_handler, this);
 		lo_server_add_method(serv, "/get", "sss", ControlOSC::_global_get_handler, this);
 
 		// un/register_update args= s:ctrl s:returl s:retpath
 		lo_server_add_method(serv, "/register_update", "sss", ControlOSC::_global_register_update_handler, this);
+		lo_server_add_method(serv, "/set_update_rate", "ssi", ControlOSC::_set_update_rate_handler, this);
 		lo_server_add_method(serv, "/unregister_update", "sss", ControlOSC::_global_unregister_update_handler, this);
 		lo_server_add_method(serv, "/register_auto_update", "siss", ControlOSC::_global_register_auto_update_handler, this);
 		lo_server_add_method(serv, "/unregister_auto_update", "sss", ControlOSC::_global_unregister_auto_update_handler, this);
 
 
-		// certain RT global ctrls
-		lo_server_add_method(serv, "/sl/-2/set", "sf", ControlOSC::_set_handler, new CommandInfo(this, -2, Event::type_global_control_change));
-
 		// get all midi bindings:  s:returl s:retpath
 		lo_server_add_method(serv, "/get_all_midi_bindings", "ss", ControlOSC::_midi_binding_handler,
 				     new MidiBindCommand(this, MidiBindCommand::GetAllBinding));
@@ -223,12 +304,149 @@ ControlOSC::register_callbacks()
 				     new MidiBindCommand(this, MidiBindCommand::CancelGetNext));
 		
 		
+		// batch set:  (i:instance s:ctrl f:val)*  all applied in the same process cycle
+		lo_server_add_method(serv, "/sl/set_many", NULL, ControlOSC::_set_many_handler, this);
+
+		// batch get:  s:returl s:retpath (i:instance s:ctrl)*
+		lo_server_add_method(serv, "/sl/get_many", NULL, ControlOSC::_get_many_handler, this);
+
+		// midi input latency histograms:  s:returl s:retpath
+		lo_server_add_method(serv, "/get_midi_latency", "ss", ControlOSC::_get_midi_latency_handler, this);
+
 		// MIDI clock
 		lo_server_add_method(serv, "/sl/midi_start", NULL, ControlOSC::_midi_start_handler, this);
 		lo_server_add_method(serv, "/sl/midi_stop", NULL, ControlOSC::_midi_stop_handler, this);
 		lo_server_add_method(serv, "/sl/midi_tick", NULL, ControlOSC::_midi_tick_handler, this);
-	
+
+		// everything under /sl/<instance>/, including -1 (all loops), -3 (selected)
+		// and -2 (rt global controls).  it must be added last, liblo tries the
+		// methods in order and this one matches any path.
+		lo_server_add_method(serv, NULL, NULL, ControlOSC::_loop_method_handler, this);
+	}
+}
+
+static inline uint32_t
+hash_verb (const char * verb, uint32_t seed)
+{
+	// FNV-1a, with the seed folded into the offset basis
+	uint32_t hash = 2166136261u ^ seed;
+
+	for ( ; *verb; ++verb) {
+		hash ^= (unsigned char) *verb;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+void
+ControlOSC::build_loop_methods()
+{
+	static const struct {
+		const char * verb;
+		const char * types;
+		const char * typestr; // CommandMap name of the event type, if any
+		LoopHandler  handler;
+	} methods[] = {
+		{ "down",    "s",  "down",    &ControlOSC::updown_handler },
+		{ "up",      "s",  "up",      &ControlOSC::updown_handler },
+		{ "hit",     "s",  "hit",     &ControlOSC::updown_handler },
+		{ "upforce", "s",  "upforce", &ControlOSC::updown_handler },
+		{ "set",     "sf", "set",     &ControlOSC::set_handler },
+		{ "get",     "sss", "get",    &ControlOSC::get_handler },
+		// get_peaks:  f:start  f:length  i:points  s:returl  s:retpath
+		{ "get_peaks", "ffiss", 0,    &ControlOSC::get_peaks_handler },
+		// load loop:  s:filename  s:returl  s:retpath
+		{ "load_loop", "sss", 0,      &ControlOSC::loadloop_handler },
+		// save loop:  s:filename  s:format s:endian s:returl  s:retpath
+		{ "save_loop", "sssss", 0,    &ControlOSC::saveloop_handler },
+		// un/register_update args= s:ctrl s:returl s:retpath
+		{ "register_update",   "sss", 0, &ControlOSC::register_update_handler },
+		{ "unregister_update", "sss", 0, &ControlOSC::unregister_update_handler },
+		// register_auto_update args= s:ctrl i:millisec s:returl s:retpath
+		{ "register_auto_update",   "siss", 0, &ControlOSC::register_auto_update_handler },
+		// unregister_auto_update args= s:ctrl s:returl s:retpath
+		{ "unregister_auto_update", "sss",  0, &ControlOSC::unregister_auto_update_handler }
+	};
+	const size_t count = sizeof(methods) / sizeof(methods[0]);
+
+	_loop_methods.clear();
+	for (size_t n = 0; n < count; ++n) {
+		LoopMethod meth;
+		meth.verb = methods[n].verb;
+		meth.types = methods[n].types;
+		meth.type = methods[n].typestr ? _cmd_map->to_type_t (methods[n].typestr) : Event::type_control_request;
+		meth.handler = methods[n].handler;
+		_loop_methods.push_back (meth);
+	}
+
+	// find a seed that puts every verb in its own slot, growing the table if none will
+	size_t size = 16;
+	while (size < count * 2) size <<= 1;
+
+	for (;;) {
+		for (uint32_t seed = 0; seed < 4096; ++seed) {
+			_loop_method_table.assign (size, -1);
+
+			size_t n;
+			for (n = 0; n < _loop_methods.size(); ++n) {
+				int & slot = _loop_method_table[hash_verb (_loop_methods[n].verb, seed) & (size - 1)];
+				if (slot >= 0) break;
+				slot = (int) n;
+			}
+
+			if (n == _loop_methods.size()) {
+				_loop_method_seed = seed;
+				return;
+			}
+		}
+		size <<= 1;
+	}
+}
+
+// the most arguments any /sl/<instance>/ method takes
+#define MAX_LOOP_METHOD_ARGS 8
+
+// liblo converts numeric arguments to the typespec a method is
+// registered with, a catch-all method has to do that itself.
+// returns arg, or store holding it converted, or 0 if it can't be
+static lo_arg *
+coerce_arg (char want, char type, lo_arg * arg, lo_arg * store)
+{
+	if (type == want) {
+		return arg;
+	}
+	if (lo_is_numerical_type ((lo_type) type) && lo_is_numerical_type ((lo_type) want)) {
+		lo_coerce ((lo_type) want, store, (lo_type) type, arg);
+		return store;
+	}
+	return 0;
+}
+
+static bool
+coerce_loop_args (const char * want, const char * types, lo_arg ** argv, int argc, lo_arg * store, lo_arg ** coerced)
+{
+	if (argc > MAX_LOOP_METHOD_ARGS || (int) strlen (want) != argc || (int) strlen (types) != argc) {
+		return false;
+	}
+
+	for (int i = 0; i < argc; ++i) {
+		if ((coerced[i] = coerce_arg (want[i], types[i], argv[i], &store[i])) == 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+const ControlOSC::LoopMethod *
+ControlOSC::find_loop_method (const char * verb) const
+{
+	int index = _loop_method_table[hash_verb (verb, _loop_method_seed) & (_loop_method_table.size() - 1)];
+
+	if (index >= 0 && strcmp (_loop_methods[index].verb, verb) == 0) {
+		return &_loop_methods[index];
 	}
+	return 0;
 }
 
 bool
@@ -286,75 +504,16 @@ void
 ControlOSC::on_loop_added (int instance, bool sendupdate)
 {
 	// will be called from main event loop
-
-	char tmpstr[255];
 #ifdef DEBUG
 	cerr << "loop added: " << instance << endl;
 #endif
-	lo_server srvs[2];
-	lo_server serv;
-
-	if (instance >= 0 && instance < _max_instance) {
-		// already added this method
-		if (sendupdate) {
-			send_all_config();
-		}
-		return;
-	}
-	
-	srvs[0] = _osc_server;
-	srvs[1] = _osc_unix_server;
-	
-	for (size_t i=0; i < 2; ++i) {
-		if (!srvs[i]) continue;
-		serv = srvs[i];
-		
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/down", instance);
-		lo_server_add_method(serv, tmpstr, "s", ControlOSC::_updown_handler, new CommandInfo(this, instance, Event::type_cmd_down));
-	
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/up", instance);
-		lo_server_add_method(serv, tmpstr, "s", ControlOSC::_updown_handler, new CommandInfo(this, instance, Event::type_cmd_up));
-
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/hit", instance);
-		lo_server_add_method(serv, tmpstr, "s", ControlOSC::_updown_handler, new CommandInfo(this, instance, Event::type_cmd_hit));
-		
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/upforce", instance);
-		lo_server_add_method(serv, tmpstr, "s", ControlOSC::_updown_handler, new CommandInfo(this, instance, Event::type_cmd_upforce));
-		
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/set", instance);
-		lo_server_add_method(serv, tmpstr, "sf", ControlOSC::_set_handler, new CommandInfo(this, instance, Event::type_control_change));
-	
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/get", instance);
-		lo_server_add_method(serv, tmpstr, "sss", ControlOSC::_get_handler, new CommandInfo(this, instance, Event::type_control_request));
-
-		// load loop:  s:filename  s:returl  s:retpath
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/load_loop", instance);
-		lo_server_add_method(serv, tmpstr, "sss", ControlOSC::_loadloop_handler, new CommandInfo(this, instance, Event::type_control_request));
-
-		// save loop:  s:filename  s:format s:endian s:returl  s:retpath
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/save_loop", instance);
-		lo_server_add_method(serv, tmpstr, "sssss", ControlOSC::_saveloop_handler, new CommandInfo(this, instance, Event::type_control_request));
-	
-		// register_update args= s:ctrl s:returl s:retpath
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/register_update", instance);
-		lo_server_add_method(serv, tmpstr, "sss", ControlOSC::_register_update_handler, new CommandInfo(this, instance, Event::type_control_request));
-
-		// unregister_update args= s:ctrl s:returl s:retpath
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/unregister_update", instance);
-		lo_server_add_method(serv, tmpstr, "sss", ControlOSC::_unregister_update_handler, new CommandInfo(this, instance, Event::type_control_request));
-
-		// register_audo_update args= s:ctrl i:millisec s:returl s:retpath
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/register_auto_update", instance);
-		lo_server_add_method(serv, tmpstr, "siss", ControlOSC::_register_auto_update_handler, new CommandInfo(this, instance, Event::type_control_request));
-
-		// unregister_auto_update args= s:ctrl s:returl s:retpath
-		snprintf(tmpstr, sizeof(tmpstr), "/sl/%d/unregister_auto_update", instance);
-		lo_server_add_method(serv, tmpstr, "sss", ControlOSC::_unregister_auto_update_handler, new CommandInfo(this, instance, Event::type_control_request));
 
+	// the /sl/<instance>/ paths are all handled by loop_method_handler,
+	// nothing to register
+	if (!_config_clients.empty()) {
+		bump_config_version (instance);
 	}
 
-	_max_instance = instance + 1;
-	
 	if (sendupdate) {
 		send_all_config();
 	}
@@ -364,6 +523,11 @@ void
 ControlOSC::on_loop_removed ()
 {
 	// will be called from main event loop
+	if (!_config_clients.empty()) {
+		// the ones after it have moved down
+		bump_config_version (-1);
+	}
+
 	send_all_config();
 }
 
@@ -398,6 +562,21 @@ ControlOSC::get_unix_server_url()
 	return url;
 }
 
+std::string
+ControlOSC::get_tcp_server_url()
+{
+	string url;
+	char * urlstr;
+
+	if (_osc_tcp_server) {
+		urlstr = lo_server_get_url (_osc_tcp_server);
+		url = urlstr;
+		free (urlstr);
+	}
+	
+	return url;
+}
+
 
 /* server thread */
 
@@ -433,6 +612,33 @@ ControlOSC::osc_receiver()
 		nfds++;
 	}
 	
+	if (_osc_tcp_server) {
+		// a tcp server has a socket per connection, let liblo do the
+		// waiting for all of them.  shutdown is noticed on the timeout
+		int recvd[3];
+
+		srvs[0] = _osc_tcp_server;
+
+		while (!_shutdown) {
+			if (lo_servers_wait (srvs, recvd, nfds, 100) <= 0) {
+				continue;
+			}
+
+			for (int i=0; i < nfds && !_shutdown; ++i) {
+				if (!recvd[i]) {
+					continue;
+				}
+
+				if (srvs[i] == _osc_server) {
+					recv_udp_batch (srvs[i]);
+				}
+				else {
+					// this invokes callbacks
+					lo_server_recv_noblock (srvs[i], 0);
+				}
+			}
+		}
+	}
 	
 	while (!_shutdown) {
 
@@ -472,7 +678,12 @@ ControlOSC::osc_receiver()
 			{
 				// this invokes callbacks
 				//cerr << "invoking recv on " << pfd[i].fd << endl;
-				lo_server_recv(srvs[i]);
+				if (srvs[i] == _osc_server) {
+					recv_udp_batch (srvs[i]);
+				}
+				else {
+					lo_server_recv(srvs[i]);
+				}
 			}
 		}
 
@@ -495,6 +706,11 @@ ControlOSC::osc_receiver()
 		lo_server_free (_osc_unix_server);
 		_osc_unix_server = 0;
 	}
+
+	if (_osc_tcp_server) {
+		lo_server_free (_osc_tcp_server);
+		_osc_tcp_server = 0;
+	}
 	
 	close(_request_pipe[0]);
 	close(_request_pipe[1]);
@@ -502,6 +718,265 @@ ControlOSC::osc_receiver()
 
 
 
+void
+ControlOSC::recv_udp_batch (lo_server srv)
+{
+	int fd = lo_server_get_socket_fd (srv);
+	unsigned long total = 0;
+
+	for (int batch = 0; batch < RecvMaxBatches && !_shutdown; ++batch)
+	{
+		struct sockaddr_storage from[RecvBatch];
+		size_t lens[RecvBatch];
+		bool   truncated[RecvBatch];
+		int    count = 0;
+
+#ifdef __linux__
+		struct mmsghdr msgs[RecvBatch];
+		struct iovec   iovs[RecvBatch];
+
+		memset (msgs, 0, sizeof(msgs));
+		for (int i = 0; i < RecvBatch; ++i) {
+			iovs[i].iov_base = _recv_bufs + i * RecvBufSize;
+			iovs[i].iov_len = RecvBufSize;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &from[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		}
+
+		count = recvmmsg (fd, msgs, RecvBatch, MSG_DONTWAIT, NULL);
+
+		for (int i = 0; i < count; ++i) {
+			lens[i] = msgs[i].msg_len;
+			truncated[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC);
+		}
+#else
+		while (count < RecvBatch) {
+			socklen_t fromlen = sizeof(from[count]);
+			ssize_t ret = recvfrom (fd, _recv_bufs + count * RecvBufSize, RecvBufSize, MSG_DONTWAIT,
+						(struct sockaddr *) &from[count], &fromlen);
+			if (ret < 0) {
+				break;
+			}
+			lens[count] = ret;
+			truncated[count] = false;
+			++count;
+		}
+#endif
+		if (count <= 0) {
+			break;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			const char * data = _recv_bufs + i * RecvBufSize;
+			int srcport = 0;
+
+			if (from[i].ss_family == AF_INET) {
+				srcport = ntohs (((struct sockaddr_in *) &from[i])->sin_port);
+			}
+			else if (from[i].ss_family == AF_INET6) {
+				srcport = ntohs (((struct sockaddr_in6 *) &from[i])->sin6_port);
+			}
+
+			_recv_packets++;
+
+			if (truncated[i]) {
+				_recv_dropped++;
+				continue;
+			}
+
+			if (!dispatch_fast (data, lens[i], srcport)) {
+				// keep the order with anything already decoded
+				flush_recv_changes ();
+
+				// everything else goes through liblo as before
+				_recv_source_port = srcport;
+				lo_server_dispatch_data (srv, (void *) data, lens[i]);
+				_recv_source_port = -1;
+			}
+		}
+
+		total += count;
+
+		if (count < RecvBatch) {
+			break;
+		}
+	}
+
+	flush_recv_changes ();
+
+	if (total > _recv_max_batch) {
+		_recv_max_batch = total;
+	}
+
+	unsigned long depth = _engine->get_event_queue_depth();
+	if (depth > _recv_max_queue_depth) {
+		_recv_max_queue_depth = depth;
+	}
+}
+
+bool
+ControlOSC::dispatch_fast (const char * data, size_t len, int srcport)
+{
+	// plain /sl/<instance>/set and /sl/<instance>/<down|up|hit|upforce>
+	// messages, by far the most common ones, are decoded right out of the
+	// datagram.  returns false for anything else, which goes through liblo
+	const char * end = data + len;
+
+	if (len < 16 || (len & 3) || strncmp (data, "/sl/", 4) != 0) {
+		return false;
+	}
+
+	// the address, type tags and string argument are nul terminated and padded to 4 bytes
+	const char * pathend = (const char *) memchr (data, 0, len);
+	if (!pathend) {
+		return false;
+	}
+
+	const char * types = data + (((pathend - data) + 4) & ~3);
+	if (types >= end || types[0] != ',') {
+		return false;
+	}
+
+	const char * typesend = (const char *) memchr (types, 0, end - types);
+	if (!typesend) {
+		return false;
+	}
+
+	const char * arg = types + (((typesend - types) + 4) & ~3);
+	const char * instr = data + 4;
+	const char * verb;
+	int instance;
+
+	if (instr[0] == '*' && instr[1] == '/') {
+		instance = -1;
+		verb = instr + 2;
+	}
+	else {
+		char * endp;
+		long val = strtol (instr, &endp, 10);
+		if (endp == instr || *endp != '/' || val < -3 || val > 127) {
+			return false;
+		}
+		instance = (int) val;
+		verb = endp + 1;
+	}
+
+	const LoopMethod * meth = find_loop_method (verb);
+	if (!meth || (meth->handler != &ControlOSC::set_handler && meth->handler != &ControlOSC::updown_handler)) {
+		return false;
+	}
+
+	// set takes its value as any number, like liblo would coerce it
+	if (meth->handler == &ControlOSC::updown_handler ? strcmp (types, ",s") != 0
+	    : (types[1] != 's' || types[2] == 0 || !strchr ("ifdh", types[2]) || types[3] != 0))
+	{
+		return false;
+	}
+
+	if (instance == -2 && meth->type != Event::type_control_change) {
+		return false;
+	}
+
+	// both start with a string
+	if (arg >= end) {
+		return false;
+	}
+
+	const char * name = arg;
+	const char * nameend = (const char *) memchr (name, 0, end - name);
+	if (!nameend) {
+		return false;
+	}
+	arg = name + (((nameend - name) + 4) & ~3);
+
+	if (meth->handler == &ControlOSC::updown_handler) {
+		flush_recv_changes ();
+
+		if (!_engine->push_command_event (meth->type, _cmd_map->find_command (name), instance)) {
+			_recv_dropped++;
+		}
+		return true;
+	}
+
+	size_t argsize = (types[2] == 'd' || types[2] == 'h') ? 8 : 4;
+	if (arg + argsize > end) {
+		return false;
+	}
+
+	uint32_t word;
+	float val;
+	memcpy (&word, arg, 4);
+	word = ntohl (word);
+
+	if (argsize == 8) {
+		uint32_t low;
+		uint64_t dword;
+		memcpy (&low, arg + 4, 4);
+		dword = ((uint64_t) word << 32) | ntohl (low);
+
+		if (types[2] == 'd') {
+			double dval;
+			memcpy (&dval, &dword, 8);
+			val = (float) dval;
+		}
+		else {
+			val = (float) (int64_t) dword;
+		}
+	}
+	else if (types[2] == 'i') {
+		val = (float) (int32_t) word;
+	}
+	else {
+		memcpy (&val, &word, 4);
+	}
+
+	// consecutive sets from the same sender go to the engine together
+	if (!_recv_changes.empty() && srcport != _recv_changes_src) {
+		flush_recv_changes ();
+	}
+
+	_recv_changes.push_back (Engine::ControlChange ((int8_t) instance, _cmd_map->find_control (name), val));
+	_recv_changes_src = srcport;
+
+	return true;
+}
+
+void
+ControlOSC::flush_recv_changes ()
+{
+	if (_recv_changes.empty()) {
+		return;
+	}
+
+	if (!_engine->push_control_batch (_recv_changes, _recv_changes_src)) {
+#ifdef DEBUG
+		cerr << "event queue full, dropped " << _recv_changes.size() << " control changes" << endl;
+#endif
+		_recv_dropped += _recv_changes.size();
+	}
+
+	_recv_changes.clear();
+}
+
+int
+ControlOSC::source_port (void * data)
+{
+	// messages from recv_udp_batch come through lo_server_dispatch_data,
+	// which doesn't know where they came from
+	if (_recv_source_port >= 0) {
+		return _recv_source_port;
+	}
+
+	lo_address srcaddr = lo_message_get_source ((lo_message) data);
+	const char * sport = srcaddr ? lo_address_get_port (srcaddr) : 0;
+
+	return sport ? atoi (sport) : 0;
+}
+
+
 /* STATIC callbacks */
 
 
@@ -547,53 +1022,28 @@ int ControlOSC::_global_get_handler(const char *path, const char *types, lo_arg
 }
 
 
-int ControlOSC::_updown_handler(const char *path, const char *types, lo_arg **argv, int argc,
-			 void *data, void *user_data)
+int ControlOSC::_loop_method_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->updown_handler (path, types, argv, argc, data, cp);
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->loop_method_handler (path, types, argv, argc, data);
 }
 
-int ControlOSC::_set_handler(const char *path, const char *types, lo_arg **argv, int argc,
-			 void *data, void *user_data)
+int ControlOSC::_set_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->set_handler (path, types, argv, argc, data, cp);
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->set_many_handler (path, types, argv, argc, data);
 }
 
-int ControlOSC::_get_handler(const char *path, const char *types, lo_arg **argv, int argc,
-			 void *data, void *user_data)
+int ControlOSC::_get_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->get_handler (path, types, argv, argc, data, cp);
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->get_many_handler (path, types, argv, argc, data);
 }
 
-int ControlOSC::_register_update_handler(const char *path, const char *types, lo_arg **argv, int argc,
-			 void *data, void *user_data)
-{
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->register_update_handler (path, types, argv, argc, data, cp);
-}
-
-int ControlOSC::_unregister_update_handler(const char *path, const char *types, lo_arg **argv, int argc,
-			 void *data, void *user_data)
-{
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->unregister_update_handler (path, types, argv, argc, data, cp);
-}
-
-int ControlOSC::_register_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc,
-			 void *data, void *user_data)
-{
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->register_auto_update_handler (path, types, argv, argc, data, cp);
-}
-
-int ControlOSC::_unregister_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc,
-			 void *data, void *user_data)
+int ControlOSC::_get_midi_latency_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
 {
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->unregister_auto_update_handler (path, types, argv, argc, data, cp);
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->get_midi_latency_handler (path, types, argv, argc, data);
 }
 
 int ControlOSC::_loop_add_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
@@ -633,16 +1083,25 @@ int ControlOSC::_unregister_config_handler(const char *path, const char *types,
 	return osc->unregister_config_handler (path, types, argv, argc, data);
 }
 
-int ControlOSC::_loadloop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+int ControlOSC::_register_diff_handler(const char *path, const char *types, lo_arg **argv, int argc,
+				    void *data, void *user_data)
+{
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->config_diff_handler (RegisterConfigEvent::RegisterDiff, argv);
+}
+
+int ControlOSC::_unregister_diff_handler(const char *path, const char *types, lo_arg **argv, int argc,
+				    void *data, void *user_data)
 {
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->loadloop_handler (path, types, argv, argc, data, cp);
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->config_diff_handler (RegisterConfigEvent::UnregisterDiff, argv);
 }
 
-int ControlOSC::_saveloop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data)
+int ControlOSC::_resync_handler(const char *path, const char *types, lo_arg **argv, int argc,
+				    void *data, void *user_data)
 {
-	CommandInfo * cp = static_cast<CommandInfo*> (user_data);
-	return cp->osc->saveloop_handler (path, types, argv, argc, data, cp);
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->config_diff_handler (RegisterConfigEvent::Resync, argv);
 }
 
 int ControlOSC::_global_register_update_handler(const char *path, const char *types, lo_arg **argv, int argc,
@@ -659,6 +1118,13 @@ int ControlOSC::_global_unregister_update_handler(const char *path, const char *
 	return osc->global_unregister_update_handler (path, types, argv, argc, data);
 }
 
+int ControlOSC::_set_update_rate_handler(const char *path, const char *types, lo_arg **argv, int argc,
+			 void *data, void *user_data)
+{
+	ControlOSC * osc = static_cast<ControlOSC*> (user_data);
+	return osc->set_update_rate_handler (path, types, argv, argc, data);
+}
+
 int ControlOSC::_global_register_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc,
 			 void *data, void *user_data)
 {
@@ -753,10 +1219,7 @@ int ControlOSC::global_set_handler(const char *path, const char *types, lo_arg *
 	// s: param  f: val
 	string param(&argv[0]->s);
 	float val  = argv[1]->f;
-	lo_message msg = (lo_message) data;
-	lo_address srcaddr = lo_message_get_source (msg);
-	const char * sport = lo_address_get_port(srcaddr);
-	int srcport = atoi(sport);
+	int srcport = source_port (data);
 
 	_engine->push_nonrt_event ( new GlobalSetEvent (param, val));
 
@@ -783,6 +1246,21 @@ ControlOSC::global_register_update_handler(const char *path, const char *types,
 	return 0;
 }
 
+int
+ControlOSC::set_update_rate_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data)
+{
+	// args= s:returl s:retpath i:max_per_second
+	string returl (&argv[0]->s);
+	string retpath (&argv[1]->s);
+	int rate = argv[2]->i;
+
+	validate_returl(returl);
+
+	_engine->push_nonrt_event ( new ConfigUpdateEvent (ConfigUpdateEvent::SetUpdateRate, -2, Event::Unknown, returl, retpath, (float) (rate > 0 ? rate : 0)));
+
+	return 0;
+}
+
 int
 ControlOSC::global_unregister_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data)
 {
@@ -970,13 +1448,70 @@ ControlOSC::midi_tick_handler(const char *path, const char *types, lo_arg **argv
 }
 
 
+int ControlOSC::loop_method_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data)
+{
+	// path is /sl/<instance>/<verb>, a '*' instance means all loops
+	const char * instr;
+	const char * verb;
+	int instance;
+
+	if (strncmp (path, "/sl/", 4) != 0) {
+		return 1;
+	}
+
+	instr = path + 4;
+	if (instr[0] == '*' && instr[1] == '/') {
+		instance = -1;
+		verb = instr + 2;
+	}
+	else {
+		char * endp;
+		long val = strtol (instr, &endp, 10);
+		if (endp == instr || *endp != '/' || val < -3 || val > 127) {
+			return 1;
+		}
+		instance = (int) val;
+		verb = endp + 1;
+	}
+
+	const LoopMethod * meth = find_loop_method (verb);
+	lo_arg   store[MAX_LOOP_METHOD_ARGS];
+	lo_arg * coerced[MAX_LOOP_METHOD_ARGS];
+
+	if (meth && strcmp (types, meth->types) != 0
+	    && coerce_loop_args (meth->types, types, argv, argc, store, coerced))
+	{
+		types = meth->types;
+		argv = coerced;
+	}
+
+	if (!meth || strcmp (types, meth->types) != 0) {
+#ifdef DEBUG
+		cerr << "unhandled path: " << path << " types: " << types << endl;
+#endif
+		return 1;
+	}
+
+	Event::type_t type = meth->type;
+	if (instance == -2) {
+		// only certain RT global ctrls live here
+		if (type != Event::type_control_change) {
+			return 1;
+		}
+		type = Event::type_global_control_change;
+	}
+
+	CommandInfo info (this, instance, type);
+	return (this->*(meth->handler)) (path, types, argv, argc, data, &info);
+}
+
 int ControlOSC::updown_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, CommandInfo *info)
 {
 	// first arg is a string
 	
 	string cmd(&argv[0]->s);
 
-	_engine->push_command_event(info->type, _cmd_map->to_command_t(cmd), info->instance);
+	_engine->push_command_event(info->type, _cmd_map->to_command_t(cmd), info->instance, bundle_time (data));
 	
 	return 0;
 }
@@ -989,13 +1524,10 @@ int ControlOSC::set_handler(const char *path, const char *types, lo_arg **argv,
 
 	string ctrl(&argv[0]->s);
 	float val  = argv[1]->f;
-	lo_message msg = (lo_message) data;
-	lo_address srcaddr = lo_message_get_source (msg);
-	const char * sport = lo_address_get_port(srcaddr);
-	int srcport = atoi(sport);
+	int srcport = source_port (data);
 	//cerr << "source is " << srcport << endl;
 
-	_engine->push_control_event(info->type, _cmd_map->to_control_t(ctrl), val, info->instance, srcport);
+	_engine->push_control_event(info->type, _cmd_map->to_control_t(ctrl), val, info->instance, srcport, bundle_time (data));
 	
 	return 0;
 
@@ -1069,6 +1601,100 @@ int ControlOSC::save_session_handler(const char *path, const char *types, lo_arg
 }
 
 
+int ControlOSC::set_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data)
+{
+	// (i:instance s:ctrl f:val)*, any numbers are taken like /sl/#/set takes them
+	if (argc == 0 || (argc % 3) != 0) {
+		return 1;
+	}
+
+	std::vector<Engine::ControlChange> changes;
+	changes.reserve (argc / 3);
+
+	for (int n = 0; n < argc; n += 3) {
+		lo_arg istore, vstore;
+		lo_arg * iarg = coerce_arg ('i', types[n], argv[n], &istore);
+		lo_arg * varg = coerce_arg ('f', types[n+2], argv[n+2], &vstore);
+
+		if (!iarg || types[n+1] != 's' || !varg) {
+			// nothing is pushed unless all of it is good
+			return 1;
+		}
+
+		int instance = iarg->i;
+		Event::control_t ctrl = _cmd_map->find_control (&argv[n+1]->s);
+
+		if (ctrl == Event::Unknown || instance < -3 || instance > 127) {
+#ifdef DEBUG
+			cerr << "set_many: skipping " << instance << " " << &argv[n+1]->s << endl;
+#endif
+			continue;
+		}
+
+		changes.push_back (Engine::ControlChange ((int8_t) instance, ctrl, varg->f));
+	}
+
+	if (changes.empty()) {
+		return 0;
+	}
+
+	int srcport = source_port (data);
+
+	if (!_engine->push_control_batch (changes, srcport, bundle_time (data))) {
+		cerr << "sooperlooper: event queue full, dropped a set_many of " << changes.size() << " controls" << endl;
+	}
+
+	return 0;
+}
+
+int ControlOSC::get_midi_latency_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data)
+{
+	// s:returl s:retpath
+	string returl (&argv[0]->s);
+	string retpath (&argv[1]->s);
+
+	validate_returl(returl);
+
+	_engine->push_nonrt_event ( new GetMidiLatencyEvent (returl, retpath));
+
+	return 0;
+}
+
+int ControlOSC::get_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data)
+{
+	// s:returl s:retpath (i:instance s:ctrl)*
+	if (argc < 2 || (argc % 2) != 0 || strncmp (types, "ss", 2) != 0) {
+		return 1;
+	}
+	for (int n = 2; n < argc; n += 2) {
+		if (!lo_is_numerical_type ((lo_type) types[n]) || types[n+1] != 's') {
+			return 1;
+		}
+	}
+
+	string returl (&argv[0]->s);
+	string retpath (&argv[1]->s);
+
+	validate_returl(returl);
+
+	GetManyEvent * event = new GetManyEvent (returl, retpath);
+	event->items.reserve ((argc - 2) / 2);
+
+	for (int n = 2; n < argc; n += 2) {
+		lo_arg istore;
+		int instance = coerce_arg ('i', types[n], argv[n], &istore)->i;
+		if (instance < -3 || instance > 127) {
+			continue;
+		}
+		event->items.push_back (GetManyEvent::Item ((int8_t) instance, _cmd_map->to_control_t (&argv[n+1]->s)));
+	}
+
+	// push this onto a queue for the main event loop to process
+	_engine->push_nonrt_event (event);
+
+	return 0;
+}
+
 int ControlOSC::loadloop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, CommandInfo *info)
 {
 
@@ -1144,6 +1770,184 @@ ControlOSC::find_or_cache_addr(string returl)
 	return addr;
 }
 
+int
+ControlOSC::send_to (lo_address addr, const char * path, const char * types, ...)
+{
+	va_list ap;
+	int ret;
+	lo_message msg = lo_message_new();
+
+	va_start (ap, types);
+	ret = lo_message_add_varargs (msg, types, ap);
+	va_end (ap);
+
+	if (ret == 0) {
+		ret = send_message (addr, path, msg);
+	}
+
+	lo_message_free (msg);
+	return ret;
+}
+
+int
+ControlOSC::send_message (lo_address addr, const char * path, lo_message msg)
+{
+	if (lo_address_get_protocol (addr) != LO_TCP) {
+		return lo_send_message (addr, path, msg);
+	}
+
+	size_t len = 0;
+	void * data = lo_message_serialise (msg, path, NULL, &len);
+	int ret = send_tcp_packet (addr, data, len);
+
+	free (data);
+	return ret;
+}
+
+int
+ControlOSC::send_packet (lo_address addr, const void * data, size_t len)
+{
+	int proto = lo_address_get_protocol (addr);
+
+	if (proto == LO_TCP) {
+		return send_tcp_packet (addr, data, len);
+	}
+	else if (proto == LO_UDP) {
+		return send_udp_packet (addr, data, len);
+	}
+
+	// anything else (unix sockets) goes back through liblo, one bundle element at a time
+	const char * pos = (const char *) data + 16;
+	const char * end = (const char *) data + len;
+	int ret = 0;
+
+	while (pos + 4 <= end) {
+		uint32_t size;
+		memcpy (&size, pos, 4);
+		size = ntohl (size);
+		pos += 4;
+
+		if (size > (size_t) (end - pos)) {
+			break;
+		}
+
+		lo_message msg = lo_message_deserialise ((void *) pos, size, NULL);
+		if (msg) {
+			if (lo_send_message (addr, lo_get_path ((void *) pos, size), msg) == -1) {
+				ret = -1;
+			}
+			lo_message_free (msg);
+		}
+		pos += size;
+	}
+
+	return ret;
+}
+
+int
+ControlOSC::send_udp_packet (lo_address addr, const void * data, size_t len)
+{
+	UdpSocketMap::iterator sock = _udp_sockets.find (addr);
+
+	if (sock == _udp_sockets.end()) {
+		struct addrinfo hints;
+		struct addrinfo * res = 0;
+		int fd;
+
+		memset (&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+
+		if (getaddrinfo (lo_address_get_hostname (addr), lo_address_get_port (addr), &hints, &res) != 0 || !res) {
+			return -1;
+		}
+
+		// connected, so the address is only resolved once
+		fd = ::socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+		if (fd >= 0 && ::connect (fd, res->ai_addr, res->ai_addrlen) < 0) {
+			close (fd);
+			fd = -1;
+		}
+		freeaddrinfo (res);
+
+		if (fd < 0) {
+			return -1;
+		}
+
+		fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+		sock = _udp_sockets.insert (UdpSocketMap::value_type (addr, fd)).first;
+	}
+
+	if (::send ((*sock).second, data, len, 0) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == ECONNREFUSED) {
+			// no different from a lost datagram.  a refused one is the icmp
+			// port unreachable from an earlier send, which liblo's unconnected
+			// socket never sees either, so it doesn't unregister anybody
+			return 0;
+		}
+
+		close ((*sock).second);
+		_udp_sockets.erase (sock);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+ControlOSC::send_tcp_packet (lo_address addr, const void * data, size_t len)
+{
+	if (!data) {
+		return -1;
+	}
+
+	TcpLinkMap::iterator link = _tcp_links.find (addr);
+
+	if (link == _tcp_links.end()) {
+		// connects once, then the connection is reused for every send to this address
+		link = _tcp_links.insert (TcpLinkMap::value_type (addr, new OscTcpLink (lo_address_get_hostname (addr), lo_address_get_port (addr)))).first;
+	}
+
+	if (!(*link).second->send (data, len)) {
+		// either gone or not keeping up, drop the connection.  the next
+		// send to this address will try a fresh one
+#ifdef DEBUG
+		cerr << "dropping osc tcp connection to " << lo_address_get_hostname (addr) << ":" << lo_address_get_port (addr) << endl;
+#endif
+		delete (*link).second;
+		_tcp_links.erase (link);
+		return -1;
+	}
+
+	return 0;
+}
+
+bool
+ControlOSC::is_congested (lo_address addr)
+{
+	if (_tcp_links.empty()) {
+		return false;
+	}
+
+	TcpLinkMap::iterator link = _tcp_links.find (addr);
+	return (link != _tcp_links.end() && (*link).second->is_congested());
+}
+
+void
+ControlOSC::flush_tcp_links ()
+{
+	for (TcpLinkMap::iterator link = _tcp_links.begin(); link != _tcp_links.end(); )
+	{
+		if (!(*link).second->flush()) {
+			delete (*link).second;
+			_tcp_links.erase (link++);
+		}
+		else {
+			++link;
+		}
+	}
+}
+
 int ControlOSC::get_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, CommandInfo *info)
 {
 	// cerr << "get " << path << endl;
@@ -1161,6 +1965,27 @@ int ControlOSC::get_handler(const char *path, const char *types, lo_arg **argv,
 	return 0;
 }
 
+int ControlOSC::get_peaks_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, CommandInfo *info)
+{
+	// args are start secs, length secs, number of points, return URL and retpath
+	int points = argv[2]->i;
+	string returl (&argv[3]->s);
+	string retpath (&argv[4]->s);
+
+	if (points < 1) {
+		points = 1;
+	}
+	else if (points > MaxPeakPoints) {
+		points = MaxPeakPoints;
+	}
+
+	validate_returl(returl);
+
+	_engine->push_nonrt_event ( new GetPeaksEvent (info->instance, argv[0]->f, argv[1]->f, (unsigned int) points, returl, retpath));
+
+	return 0;
+}
+
 int ControlOSC::register_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, CommandInfo *info)
 {
 	// first arg is control string, 2nd is return URL string 3rd is retpath
@@ -1261,6 +2086,19 @@ ControlOSC::unregister_config_handler(const char *path, const char *types, lo_ar
 	return 0;
 }
 
+int
+ControlOSC::config_diff_handler(RegisterConfigEvent::Type type, lo_arg **argv)
+{
+	// 1st is return URL string 2nd is retpath
+	string returl (&argv[0]->s);
+	string retpath (&argv[1]->s);
+
+	validate_returl(returl);
+
+	_engine->push_nonrt_event ( new RegisterConfigEvent (type, returl, retpath));
+	return 0;
+}
+
 
 void
 ControlOSC::finish_get_event (GetParamEvent & event)
@@ -1278,125 +2116,173 @@ ControlOSC::finish_get_event (GetParamEvent & event)
 	
 //	 cerr << "sending to " << returl << "  path: " << retpath << "  ctrl: " << ctrl << "  val: " <<  event.ret_value << endl;
 
-	if (lo_send(addr, retpath.c_str(), "isf", event.instance, ctrl.c_str(), event.ret_value) == -1) {
+	if (send_to(addr, retpath.c_str(), "isf", event.instance, ctrl.c_str(), event.ret_value, LO_ARGS_END) == -1) {
 		fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
 	}
 	
 }
 
 void
-ControlOSC::finish_global_get_event (GlobalGetEvent & event)
+ControlOSC::finish_get_many_event (GetManyEvent & event)
 {
 	// called from the main event loop (not osc thread)
-	string param (event.param);
-	string returl (event.ret_url);
-	string retpath (event.ret_path);
-	lo_address addr;
-
-	addr = find_or_cache_addr (returl);
+	lo_address addr = find_or_cache_addr (event.ret_url);
 	if (!addr) {
 		return;
 	}
-	
-	// cerr << "sending to " << returl << "  path: " << retpath << "  ctrl: " << param << "  val: " <<  event.ret_value << endl;
 
-	if (lo_send(addr, retpath.c_str(), "isf", -2, param.c_str(), event.ret_value) == -1) {
+	// same replies as for get, bundled together
+	Subscriber dest (addr, event.ret_path);
+
+	for (std::vector<GetManyEvent::Item>::iterator item = event.items.begin(); item != event.items.end(); ++item) {
+		const UpdateTemplate * tmpl = find_update_template (item->control, dest.path);
+		if (tmpl) {
+			queue_update (dest, *tmpl, item->instance, item->value);
+		}
+	}
+
+	if (!dest.packet.empty()) {
+		flush_bundle (dest);
+	}
+	if (dest.failed) {
 		fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
 	}
-	
 }
 
 void
-ControlOSC::finish_update_event (ConfigUpdateEvent & event)
+ControlOSC::finish_get_peaks_event (GetPeaksEvent & event, int instance)
 {
 	// called from the main event loop (not osc thread)
+	lo_address addr = find_or_cache_addr (event.ret_url);
+	if (!addr) {
+		return;
+	}
 
-	lo_address addr;
-	string retpath = event.ret_path;
-	string returl  = event.ret_url;
-	string ctrl    = _cmd_map->to_control_str (event.control);
-	int source  = event.source;
+	// the min,max pairs go out as big endian floats, like any other OSC float
+	std::vector<uint32_t> words (event.peaks.size());
+	for (size_t n = 0; n < event.peaks.size(); ++n) {
+		uint32_t word;
+		memcpy (&word, &event.peaks[n], 4);
+		words[n] = htonl (word);
+	}
 
-	if (event.type == ConfigUpdateEvent::Send)
-	{
-		if (event.instance == -1) {
-			for (unsigned int i = 0; i < _engine->loop_count(); ++i) {
-				send_registered_updates (ctrl, event.value, (int) i, source);
-			}
-		} else {
-			send_registered_updates (ctrl, event.value, event.instance, source);
-		}
+	lo_blob blob = lo_blob_new ((int32_t) (words.size() * 4), words.empty() ? 0 : &words[0]);
 
-	}
-	else if (event.type == ConfigUpdateEvent::Register ||
-		 event.type == ConfigUpdateEvent::RegisterAuto)
+	if (send_to(addr, event.ret_path.c_str(), "iffib", instance, event.start, event.length,
+		    (int) (event.peaks.size() / 2), blob, LO_ARGS_END) == -1)
 	{
-		if ((addr = find_or_cache_addr (returl)) == 0) {
-			return;
+		fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
+	}
+
+	lo_blob_free (blob);
+}
+
+void
+ControlOSC::finish_midi_latency_event (GetMidiLatencyEvent & event, const MidiLatency & latency)
+{
+	// called from the main event loop (not osc thread)
+	lo_address addr = find_or_cache_addr (event.ret_url);
+	if (!addr) {
+		return;
+	}
+
+	// one message per stage, the summary then the bucket counts
+	for (int stage = 0; stage < MidiLatency::Stages; ++stage) {
+		MidiLatency::Stats stats;
+		latency.get ((MidiLatency::Stage) stage, stats);
+
+		lo_message msg = lo_message_new();
+		lo_message_add_string (msg, MidiLatency::stage_name ((MidiLatency::Stage) stage));
+		lo_message_add_int32 (msg, (int32_t) stats.count);
+		lo_message_add_float (msg, (float) stats.mean);
+		lo_message_add_float (msg, (float) stats.p50);
+		lo_message_add_float (msg, (float) stats.p90);
+		lo_message_add_float (msg, (float) stats.p99);
+		lo_message_add_float (msg, (float) stats.max);
+		for (int n = 0; n < MidiLatency::Buckets; ++n) {
+			lo_message_add_int32 (msg, (int32_t) stats.buckets[n]);
 		}
 
-		// add this to register_ctrl map
-		InstancePair ipair(event.instance, ctrl);
-		
-		if (event.type == ConfigUpdateEvent::Register) {
-			ControlRegistrationMap::iterator iter;
-			ControlRegistrationMap * regmap;
-			regmap = &_registration_map;
-			iter = regmap->find (ipair);
-			if (iter == regmap->end()) {
-				(*regmap)[ipair] = UrlList();
-				iter = regmap->find (ipair);
-			}
+		int ret = send_message (addr, event.ret_path.c_str(), msg);
+		lo_message_free (msg);
 
-			UrlList & ulist = (*iter).second;
-			UrlPair upair(addr, retpath);
+		if (ret == -1) {
+			fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
+			break;
+		}
+	}
+}
 
-			if (find(ulist.begin(), ulist.end(), upair) == ulist.end()) {
-#ifdef DEBUG
-				cerr << "registered " << (int)event.instance << "  ctrl: " << ctrl << "  " << returl << endl;
-#endif
-				ulist.push_back (upair);
-			}
+void
+ControlOSC::finish_global_get_event (GlobalGetEvent & event)
+{
+	// called from the main event loop (not osc thread)
+	string param (event.param);
+	string returl (event.ret_url);
+	string retpath (event.ret_path);
+	lo_address addr;
+
+	addr = find_or_cache_addr (returl);
+	if (!addr) {
+		return;
+	}
+	
+	// cerr << "sending to " << returl << "  path: " << retpath << "  ctrl: " << param << "  val: " <<  event.ret_value << endl;
+
+	if (send_to(addr, retpath.c_str(), "isf", -2, param.c_str(), event.ret_value, LO_ARGS_END) == -1) {
+		fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
+	}
+	
+}
+
+void
+ControlOSC::finish_update_event (ConfigUpdateEvent & event)
+{
+	// called from the main event loop (not osc thread)
+
+	lo_address addr;
+	string retpath = event.ret_path;
+	string returl  = event.ret_url;
+	int source  = event.source;
+
+	if (event.type == ConfigUpdateEvent::Send)
+	{
+		if (!_config_clients.empty()) {
+			bump_config_version (event.instance);
 		}
-		else {
-			ControlRegistrationMapAuto::iterator iter;
-			InstancePair ipair(event.instance, ctrl);
-			ControlRegistrationMapAuto * regmap;
-			regmap = &_auto_registration_map;
-			iter = regmap->find (ipair);
-			if (iter == regmap->end()) {
-				(*regmap)[ipair] = UrlListAuto();
-				iter = regmap->find (ipair);
-			}
 
-			UrlListAuto & ulist_auto = (*iter).second;
-			UrlListAuto::iterator list_it;
-			UrlPair upair(addr, retpath);
-			UrlPairAuto upair_auto = {upair,event.update_time_ms};
-			UrlPairAuto upair_dud = {upair,0};
-
-			for(list_it = ulist_auto.begin(); list_it != ulist_auto.end(); ++list_it) {
-				if ((*list_it).upair == upair) {
-					if((*list_it).timeout == event.update_time_ms) {
-						break;
-					} else {
-#ifdef DEBUG
-						cerr << "updated " << (int)event.instance << "  ctrl: " << ctrl << "  " << returl << "  timeout: " << event.update_time_ms << endl;
-#endif
-						(*list_it).timeout = event.update_time_ms;
-						break;
-					}
-				} 
-			}
-			if (list_it == ulist_auto.end()) {
-#ifdef DEBUG
-				cerr << "registered " << (int)event.instance << "  ctrl: " << ctrl << "  " << returl << "  timeout: " << event.update_time_ms << endl;
-#endif
-				ulist_auto.push_back(upair_auto);
+		if (event.instance == -1) {
+			for (unsigned int i = 0; i < _engine->loop_count(); ++i) {
+				send_registered_updates (event.control, event.value, (int) i, source);
 			}
+		} else {
+			send_registered_updates (event.control, event.value, event.instance, source);
+		}
+
+	}
+	else if (event.type == ConfigUpdateEvent::Register ||
+		 event.type == ConfigUpdateEvent::RegisterAuto)
+	{
+		if ((addr = find_or_cache_addr (returl)) == 0) {
+			return;
+		}
+
+		if (event.type == ConfigUpdateEvent::Register) {
+			add_registered_update (event.instance, event.control, addr, retpath);
+		}
+		else {
+			add_auto_update (event.instance, event.control, addr, retpath, event.update_time_ms);
 		}
 
 		
+	}
+	else if (event.type == ConfigUpdateEvent::SetUpdateRate)
+	{
+		if ((addr = find_or_cache_addr (returl)) == 0) {
+			return;
+		}
+
+		set_update_rate (addr, retpath, event.value);
 	}
 	else if (event.type == ConfigUpdateEvent::Unregister ||
 		 event.type == ConfigUpdateEvent::UnregisterAuto)
@@ -1406,50 +2292,11 @@ ControlOSC::finish_update_event (ConfigUpdateEvent & event)
 			return;
 		}
 		
-		// remove this from register_ctrl map
-		InstancePair ipair(event.instance, ctrl);
-
 		if (event.type == ConfigUpdateEvent::Unregister) {
-			ControlRegistrationMap * regmap;
-			ControlRegistrationMap::iterator iter;
-			regmap = &_registration_map;
-			iter = regmap->find (ipair);
-
-			if (iter != regmap->end()) {
-				UrlList & ulist = (*iter).second;
-				UrlPair upair(addr, retpath);
-				UrlList::iterator uiter = find(ulist.begin(), ulist.end(), upair);
-
-				if (uiter != ulist.end()) {
-#ifdef DEBUG
-					cerr << "unregistered " << ctrl << "  " << returl << endl;
-#endif
-					ulist.erase (uiter);
-				}
-			}
+			remove_registered_update (event.instance, event.control, addr, retpath);
 		}
 		else { //UnRegisterAuto 
-			ControlRegistrationMapAuto * regmap;
-			ControlRegistrationMapAuto::iterator iter;
-			regmap = &_auto_registration_map;
-			iter = regmap->find (ipair);
-
-			if (iter != regmap->end()) {
-				UrlListAuto & ulist_auto = (*iter).second;
-				UrlPair upair(addr, retpath);
-				UrlPairAuto upair_auto = {upair, 0};
-				UrlListAuto::iterator list_it;
-				for(list_it = ulist_auto.begin(); list_it != ulist_auto.end(); ++list_it) {
-					if ((*list_it).upair == upair) 
-					break;
-				}
-				if (list_it != ulist_auto.end()) {
-#ifdef DEBUG
-					cerr << "unregistered " << ctrl << "  " << returl << endl;
-#endif
-					ulist_auto.erase (list_it);
-				}
-			}
+			remove_auto_update (event.instance, event.control, addr, retpath);
 		}
 	}
 }
@@ -1459,20 +2306,8 @@ void ControlOSC::finish_loop_config_event (ConfigLoopEvent &event)
 {
 	if (event.type == ConfigLoopEvent::Remove) {
 		// unregister everything for this instance
-		ControlRegistrationMap::iterator citer = _registration_map.begin();
-		ControlRegistrationMap::iterator tmp;
-		
-		while ( citer != _registration_map.end()) {
-			if ((*citer).first.first == event.index) {
-				tmp = citer;
-				++tmp;
-				_registration_map.erase(citer);
-				citer = tmp;
-			}
-			else {
-				++citer;
-			}
-		}
+		remove_registered_updates_for_loop (event.index);
+		remove_auto_updates_for_loop (event.index);
 	}
 }
 
@@ -1485,179 +2320,711 @@ void ControlOSC::finish_midi_binding_event (MidiBindingEvent & event)
 
 	if (event.type == MidiBindingEvent::Learn) {
 		// send back the event, then done
-		if (lo_send(addr, event.ret_path.c_str(), "ss", "add", event.bind_str.c_str()) == -1) {
+		if (send_to(addr, event.ret_path.c_str(), "ss", "add", event.bind_str.c_str(), LO_ARGS_END) == -1) {
 			fprintf(stderr, "OSC error sending binding %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
 			return;
 		}
 		
-		lo_send(addr, event.ret_path.c_str(), "ss", "done", event.bind_str.c_str());
+		send_to(addr, event.ret_path.c_str(), "ss", "done", event.bind_str.c_str(), LO_ARGS_END);
 	}
 	else if (event.type == MidiBindingEvent::GetNextMidi) {
-		lo_send(addr, event.ret_path.c_str(), "ss", "recv", event.bind_str.c_str());
+		send_to(addr, event.ret_path.c_str(), "ss", "recv", event.bind_str.c_str(), LO_ARGS_END);
 	}
 	else if (event.type == MidiBindingEvent::CancelLearn)
 	{
-		lo_send(addr, event.ret_path.c_str(), "ss", "learn_cancel", "");
+		send_to(addr, event.ret_path.c_str(), "ss", "learn_cancel", "", LO_ARGS_END);
 	}
 	else if (event.type == MidiBindingEvent::CancelGetNext)
 	{
-		lo_send(addr, event.ret_path.c_str(), "ss", "next_cancel", "");
+		send_to(addr, event.ret_path.c_str(), "ss", "next_cancel", "", LO_ARGS_END);
 	}
 }
 
+static long long
+update_clock ()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
 void
-ControlOSC::send_registered_updates(string ctrl, float val, int instance, int source)
+ControlOSC::send_registered_updates(Event::control_t ctrl, float val, int instance, int source)
 {
-	InstancePair ipair(instance, ctrl);
-	ControlRegistrationMap::iterator iter = _registration_map.find (ipair);
-	//LastValueMap::iterator lastval;
+	if ((int) ctrl < 0 || (int) ctrl >= (int) _reg_table.size()) {
+		return;
+	}
 
-	if (iter != _registration_map.end())
+	RegEntryList & entries = _reg_table[ctrl];
+	long long now = -1;
+
+	for (RegEntryList::iterator entry = entries.begin(); entry != entries.end(); ++entry)
 	{
-		if ( ! send_registered_updates (iter, ctrl, val, instance, source)) {
-			// remove ipair if false is returned.. no more good registrations
-			_registration_map.erase(ipair);
+		if (entry->instance != instance) {
+			continue;
+		}
+
+		if (source > 0 && entry->sub->port == source) {
+			// ignore if this was caused by a set from this addr, it already
+			// has the latest value so anything held back is stale
+			entry->held = false;
+			continue;
 		}
+
+		if (entry->sub->min_interval > 0) {
+			if (now < 0) {
+				now = update_clock();
+			}
+
+			if (now - entry->last_sent < entry->sub->min_interval) {
+				// too soon, the latest one goes out when the interval is up
+				entry->held = true;
+				entry->held_value = val;
+				_held_updates = true;
+				continue;
+			}
+
+			entry->last_sent = now;
+		}
+
+		// goes out with the next flush_updates()
+		hold_if_congested (*entry, queue_update (*entry->sub, *entry->tmpl, instance, val), val);
 	}
-	else {
+}
+
+void
+ControlOSC::hold_if_congested (RegEntry & entry, bool queued, float val)
+{
+	// a tcp client that isn't keeping up gets only the latest value of
+	// each control, once its link drains
+	entry.held = !queued && !entry.sub->failed;
+
+	if (entry.held) {
+		entry.held_value = val;
+		_held_updates = true;
+	}
+}
+
+void
+ControlOSC::send_held_updates (long long now)
+{
+	_held_updates = false;
+
+	for (vector<RegEntryList>::iterator entries = _reg_table.begin(); entries != _reg_table.end(); ++entries) {
+		for (RegEntryList::iterator entry = entries->begin(); entry != entries->end(); ++entry) {
+			if (!entry->held) {
+				continue;
+			}
+
+			if (now - entry->last_sent < entry->sub->min_interval) {
+				_held_updates = true;
+				continue;
+			}
+
+			entry->last_sent = now;
+			hold_if_congested (*entry, queue_update (*entry->sub, *entry->tmpl, entry->instance, entry->held_value), entry->held_value);
+		}
+	}
+}
+
+void
+ControlOSC::set_update_rate (lo_address addr, const string & path, float max_per_sec)
+{
+	long long interval = (max_per_sec > 0.0f) ? (long long) (1000000.0f / max_per_sec) : 0;
+
+	// remembered for later registrations too
+	_update_intervals[SubscriberKey (addr, path)] = interval;
+
+	for (SubscriberList::iterator sub = _update_subscribers.begin(); sub != _update_subscribers.end(); ++sub) {
+		if (sub->addr == addr && sub->path == path) {
+			sub->min_interval = interval;
+		}
+	}
+}
+
+void
+ControlOSC::add_registered_update (int instance, Event::control_t ctrl, lo_address addr, const string & path)
+{
+	if ((int) ctrl < 0) {
+		return;
+	}
+
+	if ((int) ctrl >= (int) _reg_table.size()) {
+		_reg_table.resize ((int) ctrl + 1);
+	}
+
+	RegEntryList & entries = _reg_table[ctrl];
+
+	for (RegEntryList::iterator entry = entries.begin(); entry != entries.end(); ++entry) {
+		if (entry->instance == instance && entry->sub->addr == addr && entry->sub->path == path) {
+			return;
+		}
+	}
+
+	const UpdateTemplate * tmpl = find_update_template (ctrl, path);
+	if (!tmpl) {
+		return;
+	}
+
+	SubscriberList::iterator sub;
+	for (sub = _update_subscribers.begin(); sub != _update_subscribers.end(); ++sub) {
+		if (sub->addr == addr && sub->path == path) {
+			break;
+		}
+	}
+	if (sub == _update_subscribers.end()) {
+		sub = _update_subscribers.insert (_update_subscribers.end(), Subscriber (addr, path));
+
+		std::map<SubscriberKey, long long>::iterator rate = _update_intervals.find (SubscriberKey (addr, path));
+		if (rate != _update_intervals.end()) {
+			sub->min_interval = (*rate).second;
+		}
+	}
+
+	RegEntry newentry;
+	newentry.instance = instance;
+	newentry.sub = &(*sub);
+	newentry.tmpl = tmpl;
+	newentry.last_sent = 0;
+	newentry.held = false;
+	newentry.held_value = 0.0f;
+
+	entries.push_back (newentry);
+	sub->refcount++;
+
 #ifdef DEBUG
-		//cerr << "not in map: " << instance << " ctrL: " << ctrl << endl;
+	cerr << "registered " << instance << "  ctrl: " << _cmd_map->to_control_str (ctrl) << "  " << path << endl;
 #endif
+}
+
+void
+ControlOSC::remove_registered_update (int instance, Event::control_t ctrl, lo_address addr, const string & path)
+{
+	if ((int) ctrl < 0 || (int) ctrl >= (int) _reg_table.size()) {
+		return;
+	}
+
+	RegEntryList & entries = _reg_table[ctrl];
+
+	for (RegEntryList::iterator entry = entries.begin(); entry != entries.end(); ++entry) {
+		if (entry->instance == instance && entry->sub->addr == addr && entry->sub->path == path) {
+#ifdef DEBUG
+			cerr << "unregistered " << _cmd_map->to_control_str (ctrl) << "  " << path << endl;
+#endif
+			// the subscriber goes away in flush_updates() once nothing refers to it
+			entry->sub->refcount--;
+			entries.erase (entry);
+			break;
+		}
 	}
 }
 
+void
+ControlOSC::remove_registered_updates_for_loop (int instance)
+{
+	for (vector<RegEntryList>::iterator entries = _reg_table.begin(); entries != _reg_table.end(); ++entries) {
+		for (RegEntryList::iterator entry = entries->begin(); entry != entries->end();) {
+			if (entry->instance == instance) {
+				entry->sub->refcount--;
+				entry = entries->erase (entry);
+			}
+			else {
+				++entry;
+			}
+		}
+	}
+}
 
-void ControlOSC::send_auto_updates (const std::list<short int> timeout_list)
+void
+ControlOSC::remove_update_registrations (Subscriber * sub)
+{
+	for (vector<RegEntryList>::iterator entries = _reg_table.begin(); entries != _reg_table.end(); ++entries) {
+		for (RegEntryList::iterator entry = entries->begin(); entry != entries->end();) {
+			if (entry->sub == sub) {
+				entry = entries->erase (entry);
+			}
+			else {
+				++entry;
+			}
+		}
+	}
+	sub->refcount = 0;
+}
+
+void
+ControlOSC::flush_updates ()
 {
-	ControlRegistrationMapAuto::iterator iter = _auto_registration_map.begin();
-	ControlRegistrationMapAuto::iterator tmpiter;
+	// whatever the tcp clients couldn't take last time, first so
+	// a link that has drained takes the held updates below
+	if (!_tcp_links.empty()) {
+		flush_tcp_links ();
+	}
+
+	// the final values of controls that were changing too fast,
+	// or that a congested tcp client couldn't take
+	if (_held_updates) {
+		send_held_updates (update_clock());
+	}
 
-	while (iter != _auto_registration_map.end())
+	for (SubscriberList::iterator sub = _update_subscribers.begin(); sub != _update_subscribers.end(); )
 	{
-		std::list<short int> timeout_after_opt = timeout_list;
-		const InstancePair & ipair = (*iter).first;
-		float val = _engine->get_control_value (_cmd_map->to_control_t(ipair.second), ipair.first);
-		
-		//_engine->ParamChanged(_cmd_map->to_control_t(ipair.second), ipair.first);
+		if (!sub->packet.empty()) {
+			flush_bundle (*sub);
+		}
 
-		if ( ! send_registered_auto_updates (iter, ipair, val, timeout_list)) {
-			// remove ipair if false is returned.. no more good registrations
-			tmpiter = iter;
-			++iter;
-			_auto_registration_map.erase(tmpiter);
+		if (sub->failed) {
+			// auto-unregister
+			remove_update_registrations (&(*sub));
+			sub = _update_subscribers.erase (sub);
+		}
+		else if (sub->refcount <= 0) {
+			sub = _update_subscribers.erase (sub);
 		}
 		else {
-		++iter;
+			++sub;
 		}
+	}
+}
 
+ControlOSC::Subscriber::Subscriber (lo_address ad, const string & pth)
+	: addr(ad), path(pth), port(0), refcount(0), failed(false),
+	  min_interval(1000000 / DefaultUpdateRate)
+{
+	const char * portstr = lo_address_get_port (ad);
+
+	if (portstr) {
+		port = atoi (portstr);
 	}
+
+	packet.reserve (OSC_MAX_BUNDLE_SIZE);
 }
 
-bool
-ControlOSC::send_registered_auto_updates(ControlRegistrationMapAuto::iterator & iter,
-				    const InstancePair & ipair, float val, const std::list<short int> timeout_list)
+const ControlOSC::UpdateTemplate *
+ControlOSC::find_update_template (Event::control_t ctrl, const string & path)
 {
-	UrlListAuto::iterator tmpurl;
-	UrlListAuto & ulist_auto = (*iter).second;
-	string ctrl = ipair.second;
-	int instance = ipair.first;
-	
-	for (UrlListAuto::iterator url = ulist_auto.begin(); url != ulist_auto.end();)
-	{
-		bool unregister = false;
-		lo_address addr = (*url).upair.first;
-		for (std::list<short int>::const_iterator timeout = timeout_list.begin(); timeout != timeout_list.end(); timeout++) {
-			if ((*url).timeout == (*timeout)) {
-				LastValueMap *last_value_map = &_last_value_map[(*url).upair];
-				//optimize out unecessary updates
-				LastValueMap::iterator lastval = (*last_value_map).find (ipair);
-				if (val != (*lastval).second) {
-
-					if (lo_send(addr, (*url).upair.second.c_str(), "isf", instance, ctrl.c_str(), val) == -1) 
-						unregister = true;
-					else
-						(*last_value_map)[ipair] = val;
-				}
+	ControlPathPair key ((int) ctrl, path);
+	UpdateTemplateMap::iterator iter = _update_templates.find (key);
 
-				break;
-			}
+	if (iter != _update_templates.end()) {
+		return &(*iter).second;
+	}
+
+	lo_message msg = lo_message_new();
+	lo_message_add_int32 (msg, 0);
+	lo_message_add_string (msg, _cmd_map->to_control_str (ctrl).c_str());
+	lo_message_add_float (msg, 0.0f);
+
+	size_t len = 0;
+	char * data = (char *) lo_message_serialise (msg, path.c_str(), NULL, &len);
+	lo_message_free (msg);
+
+	if (!data) {
+		return 0;
+	}
+
+	UpdateTemplate & tmpl = _update_templates[key];
+	tmpl.set (data, len, path.size());
+	free (data);
+
+	return &tmpl;
+}
+
+
+void
+ControlOSC::add_auto_update (int instance, Event::control_t ctrl, lo_address addr, const string & path, short int timeout)
+{
+	if ((int) ctrl < 0) {
+		return;
+	}
+
+	if ((int) ctrl >= (int) _auto_table.size()) {
+		_auto_table.resize ((int) ctrl + 1);
+	}
+
+	AutoEntryList & entries = _auto_table[ctrl];
+	AutoEntryList::iterator entry;
+
+	for (entry = entries.begin(); entry != entries.end() && entry->instance <= instance; ++entry) {
+		if (entry->instance == instance && entry->sub->addr == addr && entry->sub->path == path) {
+#ifdef DEBUG
+			cerr << "updated " << instance << "  ctrl: " << _cmd_map->to_control_str (ctrl) << "  timeout: " << timeout << endl;
+#endif
+			entry->timeout = timeout;
+			return;
 		}
-		if (unregister) {
-			tmpurl = url;
-			++url;
-			ulist_auto.erase(tmpurl);
-		} else {
-			++url;
+	}
+
+	const UpdateTemplate * tmpl = find_update_template (ctrl, path);
+	if (!tmpl) {
+		return;
+	}
+
+	SubscriberList::iterator sub;
+	for (sub = _auto_subscribers.begin(); sub != _auto_subscribers.end(); ++sub) {
+		if (sub->addr == addr && sub->path == path) {
+			break;
 		}
 	}
-	
-	if (ulist_auto.empty()) {
-		return false;
+	if (sub == _auto_subscribers.end()) {
+		sub = _auto_subscribers.insert (_auto_subscribers.end(), Subscriber (addr, path));
 	}
 
-	return true;
+	AutoEntry newentry;
+	newentry.instance = instance;
+	newentry.timeout = timeout;
+	newentry.sub = &(*sub);
+	newentry.tmpl = tmpl;
+	newentry.last_value = 0.0f;
+	newentry.has_last = false;
+
+	// keep them sorted by instance so each value is only fetched once per tick
+	entries.insert (entry, newentry);
+	sub->refcount++;
+
+#ifdef DEBUG
+	cerr << "registered " << instance << "  ctrl: " << _cmd_map->to_control_str (ctrl) << "  timeout: " << timeout << endl;
+#endif
 }
 
-bool
-ControlOSC::send_registered_updates(ControlRegistrationMap::iterator & iter,
-				    string ctrl, float val, int instance, int source)
+void
+ControlOSC::remove_auto_update (int instance, Event::control_t ctrl, lo_address addr, const string & path)
 {
-	UrlList::iterator tmpurl;
-	
-	UrlList & ulist = (*iter).second;
-	
-	for (UrlList::iterator url = ulist.begin(); url != ulist.end();)
-	{
-		lo_address addr = (*url).first;
-		const char * port = lo_address_get_port(addr);
-		int aport = atoi (port);
-		
-		if (aport == source) {
-			// ignore if this was caused by a set from this addr
-			//cerr << "ignoreing address to send update for " << ctrl << "  port: " << aport << "  " << port << endl;
-		}
-		
-		else if (lo_send(addr, (*url).second.c_str(), "isf", instance, ctrl.c_str(), val) == -1) {
+	if ((int) ctrl < 0 || (int) ctrl >= (int) _auto_table.size()) {
+		return;
+	}
+
+	AutoEntryList & entries = _auto_table[ctrl];
+
+	for (AutoEntryList::iterator entry = entries.begin(); entry != entries.end(); ++entry) {
+		if (entry->instance == instance && entry->sub->addr == addr && entry->sub->path == path) {
 #ifdef DEBUG
-			fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
+			cerr << "unregistered " << _cmd_map->to_control_str (ctrl) << "  " << path << endl;
 #endif
-			// auto-unregister
-			tmpurl = url;
-			++url;
-			
-			ulist.erase(tmpurl);
-			continue;
+			entry->sub->refcount--;
+			entries.erase (entry);
+			break;
 		}
-		
-		++url;
 	}
-	
-	if (ulist.empty()) {
+
+	purge_auto_updates ();
+}
+
+void
+ControlOSC::remove_auto_updates_for_loop (int instance)
+{
+	for (vector<AutoEntryList>::iterator entries = _auto_table.begin(); entries != _auto_table.end(); ++entries) {
+		for (AutoEntryList::iterator entry = entries->begin(); entry != entries->end();) {
+			if (entry->instance == instance) {
+				entry->sub->refcount--;
+				entry = entries->erase (entry);
+			}
+			else {
+				++entry;
+			}
+		}
+	}
+
+	purge_auto_updates ();
+}
+
+void
+ControlOSC::purge_auto_updates ()
+{
+	// drop every registration of a failed destination, then any destination nobody uses
+	for (vector<AutoEntryList>::iterator entries = _auto_table.begin(); entries != _auto_table.end(); ++entries) {
+		for (AutoEntryList::iterator entry = entries->begin(); entry != entries->end();) {
+			if (entry->sub->failed) {
+				entry->sub->refcount--;
+				entry = entries->erase (entry);
+			}
+			else {
+				++entry;
+			}
+		}
+	}
+
+	for (SubscriberList::iterator sub = _auto_subscribers.begin(); sub != _auto_subscribers.end();) {
+		if (sub->refcount <= 0) {
+			sub = _auto_subscribers.erase (sub);
+		}
+		else {
+			++sub;
+		}
+	}
+}
+
+void ControlOSC::send_auto_updates (const std::list<short int> timeout_list)
+{
+	bool due[AUTO_UPDATE_RANGE];
+	bool purge = false;
+
+	for (int i = 0; i < AUTO_UPDATE_RANGE; ++i) {
+		due[i] = false;
+	}
+	for (std::list<short int>::const_iterator timeout = timeout_list.begin(); timeout != timeout_list.end(); ++timeout) {
+		due[((*timeout) / AUTO_UPDATE_STEP) - 1] = true;
+	}
+
+	for (size_t ctrl = 0; ctrl < _auto_table.size(); ++ctrl)
+	{
+		AutoEntryList & entries = _auto_table[ctrl];
+		int   curr_instance = 0;
+		bool  have_val = false;
+		float val = 0.0f;
+
+		for (AutoEntryList::iterator entry = entries.begin(); entry != entries.end(); ++entry)
+		{
+			if (!due[(entry->timeout / AUTO_UPDATE_STEP) - 1] || entry->sub->failed) {
+				continue;
+			}
+
+			if (!have_val || entry->instance != curr_instance) {
+				val = _engine->get_control_value ((Event::control_t) ctrl, entry->instance);
+				curr_instance = entry->instance;
+				have_val = true;
+			}
+
+			//optimize out unecessary updates
+			if (entry->has_last && entry->last_value == val) {
+				continue;
+			}
+
+			if (queue_update (*entry->sub, *entry->tmpl, entry->instance, val)) {
+				entry->last_value = val;
+				entry->has_last = true;
+			}
+		}
+	}
+
+	// send what is left over for everyone
+	for (SubscriberList::iterator sub = _auto_subscribers.begin(); sub != _auto_subscribers.end(); ++sub) {
+		if (!sub->packet.empty()) {
+			flush_bundle (*sub);
+		}
+		if (sub->failed) {
+			purge = true;
+		}
+	}
+
+	if (purge) {
+		// auto-unregister
+		purge_auto_updates ();
+	}
+}
+
+bool
+ControlOSC::queue_update (Subscriber & sub, const UpdateTemplate & tmpl, int instance, float val)
+{
+	if (sub.failed) {
 		return false;
 	}
 
+	if (is_congested (sub.addr)) {
+		// a tcp client that isn't keeping up, skip it this time around.
+		// auto updates keep their last value and registered ones are
+		// held, so the latest of each goes out once it catches up
+		return false;
+	}
+
+	if (!sub.packet.empty() && sub.packet.size() + tmpl.element_size() > OSC_MAX_BUNDLE_SIZE) {
+		flush_bundle (sub);
+		if (sub.failed) {
+			return false;
+		}
+	}
+
+	tmpl.append_to (sub.packet, instance, val);
+
 	return true;
 }
 
+void
+ControlOSC::flush_bundle (Subscriber & sub)
+{
+	if (send_packet (sub.addr, &sub.packet[0], sub.packet.size()) == -1) {
+#ifdef DEBUG
+		fprintf(stderr, "OSC error sending updates to %s:%s\n", lo_address_get_hostname(sub.addr), lo_address_get_port(sub.addr));
+#endif
+		sub.failed = true;
+	}
+
+	sub.packet.clear();
+}
 
 void
 ControlOSC::finish_register_event (RegisterConfigEvent &event)
 {
 	AddrPathPair apair(event.ret_url, event.ret_path);
-	AddressList::iterator iter = find (_config_registrations.begin(), _config_registrations.end(), apair);
 
-	if (iter == _config_registrations.end()) {
-		_config_registrations.push_back (apair);
+	if (event.type == RegisterConfigEvent::Register) {
+		AddressList::iterator iter = find (_config_registrations.begin(), _config_registrations.end(), apair);
+
+		if (iter == _config_registrations.end()) {
+			_config_registrations.push_back (apair);
+		}
+		return;
+	}
+	else if (event.type == RegisterConfigEvent::Unregister) {
+		_config_registrations.remove (apair);
+		return;
+	}
+
+	ConfigClientList::iterator client;
+	for (client = _config_clients.begin(); client != _config_clients.end(); ++client) {
+		if (client->returl == apair.first && client->path == apair.second) {
+			break;
+		}
+	}
+
+	if (event.type == RegisterConfigEvent::UnregisterDiff) {
+		if (client != _config_clients.end()) {
+			_config_clients.erase (client);
+		}
+		return;
+	}
+
+	if (client == _config_clients.end()) {
+		client = _config_clients.insert (_config_clients.end(), ConfigClient (apair.first, apair.second));
+	}
+	else if (event.type == RegisterConfigEvent::Resync) {
+		// forget what it was sent, so it all goes again
+		client->loop_count = -1;
+		client->versions.clear();
+		client->values.clear();
+	}
+	else {
+		// already registered, nothing new to send
+		return;
+	}
+
+	if (!send_config_diff (*client)) {
+		_config_clients.erase (client);
 	}
 }
 
 void ControlOSC::send_all_config ()
 {
-	// for now just send pingacks to all registered addresses
+	// plain registrations just get pingacks, and fetch what they need themselves
 	for (AddressList::iterator iter = _config_registrations.begin(); iter != _config_registrations.end(); ++iter)
 	{
 		send_pingack (true, false, (*iter).first, (*iter).second);
 	}
+
+	// diff registrations get only what changed since they were last sent anything
+	for (ConfigClientList::iterator client = _config_clients.begin(); client != _config_clients.end(); )
+	{
+		if (!send_config_diff (*client)) {
+			// auto-unregister
+			client = _config_clients.erase (client);
+		}
+		else {
+			++client;
+		}
+	}
+}
+
+void
+ControlOSC::update_config_slots ()
+{
+	size_t slots = _engine->loop_count() + 1;
+
+	while (_config_versions.size() < slots) {
+		_config_versions.push_back (++_config_serial);
+	}
+
+	if (_config_versions.size() > slots) {
+		_config_versions.resize (slots);
+	}
+}
+
+void
+ControlOSC::bump_config_version (int instance)
+{
+	update_config_slots ();
+
+	if (instance == -2) {
+		_config_versions[0] = ++_config_serial;
+	}
+	else if (instance >= 0) {
+		if (instance + 1 < (int) _config_versions.size()) {
+			_config_versions[instance + 1] = ++_config_serial;
+		}
+	}
+	else {
+		// all, or the selected one
+		for (size_t slot = 1; slot < _config_versions.size(); ++slot) {
+			_config_versions[slot] = ++_config_serial;
+		}
+	}
+}
+
+bool
+ControlOSC::send_config_diff (ConfigClient & client)
+{
+	lo_address addr = find_or_cache_addr (client.returl);
+	if (!addr) {
+		return false;
+	}
+
+	int loops = (int) _engine->loop_count();
+
+	if (client.loop_count != loops) {
+		// the loop count comes in a pingack, same as for /register
+		send_pingack (true, false, client.returl, client.path);
+		client.loop_count = loops;
+	}
+
+	update_config_slots ();
+	client.versions.resize (_config_versions.size(), 0);
+	client.values.resize (_config_versions.size());
+
+	Subscriber dest (addr, client.path);
+
+	for (size_t slot = 0; slot < _config_versions.size(); ++slot)
+	{
+		if (client.versions[slot] == _config_versions[slot]) {
+			continue;
+		}
+
+		int instance = (slot == 0) ? -2 : (int) slot - 1;
+		const vector<Event::control_t> & ctrls = (slot == 0) ? _global_config_ctrls : _loop_config_ctrls;
+		vector<float> & values = client.values[slot];
+		bool all = (values.size() != ctrls.size());
+		bool complete = true;
+
+		values.resize (ctrls.size());
+
+		for (size_t n = 0; n < ctrls.size(); ++n) {
+			float val = _engine->get_control_value (ctrls[n], instance);
+
+			if (!all && values[n] == val) {
+				continue;
+			}
+
+			const UpdateTemplate * tmpl = find_update_template (ctrls[n], client.path);
+
+			if (tmpl && queue_update (dest, *tmpl, instance, val)) {
+				values[n] = val;
+			}
+			else {
+				complete = false;
+			}
+		}
+
+		if (complete) {
+			client.versions[slot] = _config_versions[slot];
+		}
+		else if (all) {
+			// try the whole thing again next time
+			values.clear();
+		}
+	}
+
+	if (!dest.packet.empty()) {
+		flush_bundle (dest);
+	}
+
+	return !dest.failed;
 }
 
 void ControlOSC::send_error (std::string returl, std::string retpath, std::string mesg)
@@ -1671,7 +3038,7 @@ void ControlOSC::send_error (std::string returl, std::string retpath, std::strin
 
 	string oururl = get_server_url();
 	
-	if (lo_send(addr, retpath.c_str(), "ss", oururl.c_str(), mesg.c_str()) < 0) {
+	if (send_to(addr, retpath.c_str(), "ss", oururl.c_str(), mesg.c_str(), LO_ARGS_END) < 0) {
 		fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
 	}
 }
@@ -1690,6 +3057,9 @@ void ControlOSC::send_pingack (bool useudp, bool use_id, string returl, string r
 	if (!useudp) {
 		oururl = get_unix_server_url();
 	}
+	else if (lo_address_get_protocol (addr) == LO_TCP) {
+		oururl = get_tcp_server_url();
+	}
 
 	// default to udp
 	if (oururl.empty()) {
@@ -1700,12 +3070,12 @@ void ControlOSC::send_pingack (bool useudp, bool use_id, string returl, string r
 	// sends our server URL, the SL version, the loop count, and a unique id for continuity checking
 	if (use_id)
 	{
-		if (lo_send(addr, retpath.c_str(), "ssii", oururl.c_str(), sooperlooper_version, _engine->loop_count(), _engine->get_id()) < 0) {
+		if (send_to(addr, retpath.c_str(), "ssii", oururl.c_str(), sooperlooper_version, _engine->loop_count(), _engine->get_id(), LO_ARGS_END) < 0) {
 			fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
 		}
 	}
 	else {
-		if (lo_send(addr, retpath.c_str(), "ssi", oururl.c_str(), sooperlooper_version, _engine->loop_count()) < 0) {
+		if (send_to(addr, retpath.c_str(), "ssi", oururl.c_str(), sooperlooper_version, _engine->loop_count(), LO_ARGS_END) < 0) {
 			fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
 		}
 	}
@@ -1726,18 +3096,19 @@ void ControlOSC::send_all_midi_bindings (MidiBindings * bindings, string returl,
 	for (MidiBindings::BindingList::iterator biter = blist.begin(); biter != blist.end(); ++biter) {
 		MidiBindInfo & info = (*biter);
 
-		if (lo_send(addr, retpath.c_str(), "ss", "add", info.serialize().c_str()) == -1) {
+		if (send_to(addr, retpath.c_str(), "ss", "add", info.serialize().c_str(), LO_ARGS_END) == -1) {
 			fprintf(stderr, "OSC error sending binding %d: %s\n", lo_address_errno(addr), lo_address_errstr(addr));
 			break;
 		}
 	}
 
-	lo_send(addr, retpath.c_str(), "ss", "done", "");
+	send_to(addr, retpath.c_str(), "ss", "done", "", LO_ARGS_END);
 			
 }
 
 void ControlOSC::validate_returl(std::string & returl) 
 {
-	if (returl.substr(0,10) != "osc.udp://") 
+	// osc.udp:// unless it says otherwise
+	if (returl.substr(0,4) != "osc.") 
 		returl = "osc.udp://" + returl;
 }
@@ -25,12 +25,15 @@
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
 #include <utility>
 
 #include <sigc++/trackable.h>
 
 #include "event.hpp"
 #include "event_nonrt.hpp"
+#include "engine.hpp"
+#include "osc_update_template.hpp"
 
 //define timing for auto updates in ms
 //having STEP more often than 10ms and a different from the MIN may cause timing problems
@@ -44,19 +47,21 @@ namespace SooperLooper {
 class Engine;
 class MidiBindings;
 class CommandMap;
+class OscTcpLink;
 	
 class ControlOSC
 	: public sigc::trackable
 {
   public:
 	
-	ControlOSC (Engine *, unsigned int port);
+	ControlOSC (Engine *, unsigned int port, bool use_tcp=false);
 	virtual ~ControlOSC();
 
 	std::string get_server_url();
 	int get_server_port () { return _port; }
 
 	std::string get_unix_server_url();
+	std::string get_tcp_server_url();
 	
 	bool is_ok() { return _ok; }
 
@@ -74,6 +79,19 @@ class ControlOSC
 	void finish_loop_config_event (ConfigLoopEvent &event);
 	void finish_global_get_event (GlobalGetEvent & event);
 	void finish_midi_binding_event (MidiBindingEvent & event);
+	void finish_get_many_event (GetManyEvent & event);
+	void finish_get_peaks_event (GetPeaksEvent & event, int instance);
+	void finish_midi_latency_event (GetMidiLatencyEvent & event, const MidiLatency & latency);
+
+	// receive statistics, since startup
+	unsigned long get_recv_packets () const { return _recv_packets; }
+	unsigned long get_recv_dropped () const { return _recv_dropped; }
+	unsigned long get_recv_max_batch () const { return _recv_max_batch; }
+	unsigned long get_recv_max_queue_depth () const { return _recv_max_queue_depth; }
+
+	// sends the registered updates queued since the last call, one bundle per destination,
+	// and pushes out anything still waiting on tcp connections
+	void flush_updates ();
 	
 	
   private:
@@ -88,6 +106,17 @@ class ControlOSC
 		Event::type_t type;
 	};
 
+	typedef int (ControlOSC::*LoopHandler)(const char *path, const char *types, lo_arg **argv, int argc, void *data, CommandInfo * info);
+
+	// one /sl/<instance>/<verb> method
+	struct LoopMethod
+	{
+		const char *  verb;
+		const char *  types;
+		Event::type_t type;
+		LoopHandler   handler;
+	};
+
 	struct MidiBindCommand
 	{
 		enum Command {
@@ -113,21 +142,29 @@ class ControlOSC
 	void on_loop_removed();
 
 	void register_callbacks();
+	void build_loop_methods();
+	const LoopMethod * find_loop_method (const char * verb) const;
 	
 	lo_address find_or_cache_addr(std::string returl);
 
+	// everything outgoing goes through these, so TCP destinations get
+	// their own non-blocking queued connection.  send_to takes the same
+	// arguments as lo_send, terminated with LO_ARGS_END.  send_packet
+	// takes an already serialised message or bundle
+	int send_to (lo_address addr, const char * path, const char * types, ...);
+	int send_message (lo_address addr, const char * path, lo_message msg);
+	int send_packet (lo_address addr, const void * data, size_t len);
+	int send_tcp_packet (lo_address addr, const void * data, size_t len);
+	int send_udp_packet (lo_address addr, const void * data, size_t len);
+	bool is_congested (lo_address addr);
+	void flush_tcp_links ();
+
 	
 	static int _quit_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _global_set_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _global_get_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _updown_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _set_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _get_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int _loop_method_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _dummy_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _register_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _unregister_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _register_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _unregister_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _ping_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _loop_add_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _loop_del_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
@@ -135,9 +172,11 @@ class ControlOSC
 	static int _save_session_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _register_config_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _unregister_config_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _loadloop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
-	static int _saveloop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int _register_diff_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int _unregister_diff_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int _resync_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _global_register_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int _set_update_rate_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _global_unregister_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _global_register_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _global_unregister_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
@@ -147,6 +186,10 @@ class ControlOSC
 	static int _midi_stop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static int _midi_tick_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
+	static int _set_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int _get_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+	static int _get_midi_latency_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
+
 	static int _midi_binding_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 
 
@@ -156,6 +199,13 @@ class ControlOSC
 
 	static void * _osc_receiver(void * arg);
 	void osc_receiver();
+
+	// reads everything waiting on the udp server, up to RecvBatch
+	// datagrams per system call
+	void recv_udp_batch (lo_server srv);
+	bool dispatch_fast (const char * data, size_t len, int srcport);
+	void flush_recv_changes ();
+	int  source_port (void * data);
 	
 	int quit_handler(const char *path, const char *types, lo_arg **argv, int argc,void *data);
 	int ping_handler(const char *path, const char *types, lo_arg **argv, int argc,void *data);
@@ -167,8 +217,10 @@ class ControlOSC
 	int save_session_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 	int register_config_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 	int unregister_config_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
+	int config_diff_handler(RegisterConfigEvent::Type type, lo_arg **argv);
 
 	int global_register_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
+	int set_update_rate_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 	int global_unregister_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 	int global_register_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 	int global_unregister_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
@@ -178,11 +230,16 @@ class ControlOSC
 	int midi_stop_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 	int midi_tick_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 	int midi_binding_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, MidiBindCommand * info);
+	int set_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
+	int get_many_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
+	int get_midi_latency_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
+	int loop_method_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data);
 
 	
 	int updown_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data, CommandInfo * info);
 	int set_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data,  CommandInfo * info);
 	int get_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data,  CommandInfo * info);
+	int get_peaks_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data,  CommandInfo * info);
 	int register_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data,  CommandInfo * info);
 	int unregister_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data,  CommandInfo * info);
 	int register_auto_update_handler(const char *path, const char *types, lo_arg **argv, int argc, void *data,  CommandInfo * info);
@@ -203,45 +260,131 @@ class ControlOSC
 	
 	lo_server _osc_server;
 	lo_server _osc_unix_server;
+	lo_server _osc_tcp_server;
 	std::string _osc_unix_socket_path;
 	
 	int _port;
 	volatile bool _ok;
 	volatile bool _shutdown;
-	int _max_instance;
+
+	enum {
+		RecvBatch      = 16,
+		RecvBufSize    = 65536,
+		RecvMaxBatches = 8,
+		// keeps a get_peaks reply within one datagram
+		MaxPeakPoints  = 4096,
+		// registered updates per second for each control, unless a client asks otherwise
+		DefaultUpdateRate = 100
+	};
+
+	// osc thread only
+	char *                             _recv_bufs;
+	std::vector<Engine::ControlChange> _recv_changes;
+	int                                _recv_changes_src;
+	int                                _recv_source_port;
+
+	volatile unsigned long _recv_packets;
+	volatile unsigned long _recv_dropped;
+	volatile unsigned long _recv_max_batch;
+	volatile unsigned long _recv_max_queue_depth;
+
+	// the /sl/<instance>/<verb> methods, perfect hashed on the verb
+	std::vector<LoopMethod> _loop_methods;
+	std::vector<int>        _loop_method_table;
+	uint32_t                _loop_method_seed;
 	
 	std::map<std::string, lo_address> _retaddr_map;
 
+	// open connections to osc.tcp:// return addresses, keyed by the cached address
+	typedef std::map<lo_address, OscTcpLink *> TcpLinkMap;
+	TcpLinkMap _tcp_links;
+
+	// connected udp sockets for the update bundles, keyed the same way
+	typedef std::map<lo_address, int> UdpSocketMap;
+	UdpSocketMap _udp_sockets;
+
 	CommandMap * _cmd_map;
 	
-	typedef std::pair<int, std::string> InstancePair;
-	typedef std::pair<lo_address, std::string> UrlPair;
-	typedef std::list<UrlPair> UrlList;
-	typedef std::map<InstancePair, UrlList > ControlRegistrationMap;
-	typedef std::map<InstancePair, float> LastValueMap;
-	typedef std::map<UrlPair, LastValueMap> UrlMapToLastValueMap;
-
-	typedef struct {
-		UrlPair upair;
-		short int timeout;
-	} UrlPairAuto;
-
-	typedef std::list<UrlPairAuto> UrlListAuto;
-	typedef std::map<InstancePair, UrlListAuto > ControlRegistrationMapAuto;
-	
-	ControlRegistrationMap _registration_map;
-	ControlRegistrationMapAuto _auto_registration_map;
+	// an update destination, and the bundle being built up for it.  each one
+	// gets at most one bundle per main loop pass (more if it wouldn't fit
+	// in a datagram).  the port is kept as a number for the echo check
+	struct Subscriber
+	{
+		Subscriber (lo_address ad, const std::string & pth);
+
+		lo_address        addr;
+		std::string       path;
+		int               port;
+		int               refcount;
+		std::vector<char> packet;
+		bool              failed;
+		long long         min_interval; // usecs between updates of any one control
+	};
+	typedef std::list<Subscriber> SubscriberList;
 
-	UrlMapToLastValueMap _last_value_map;
+	typedef OscUpdateTemplate UpdateTemplate;
+	typedef std::pair<int, std::string> ControlPathPair;
+	typedef std::map<ControlPathPair, UpdateTemplate> UpdateTemplateMap;
+	UpdateTemplateMap _update_templates;
 
-	int compare_auto(UrlPairAuto a, UrlPairAuto b);
+	const UpdateTemplate * find_update_template (Event::control_t ctrl, const std::string & path);
 
-	void send_registered_updates(std::string ctrl, float val, int instance, int source=-1);
+	// a single registered update
+	struct RegEntry
+	{
+		int                    instance;
+		Subscriber *           sub;
+		const UpdateTemplate * tmpl;
+		long long              last_sent;
+		// a value that came too soon after the last one, sent once the interval is up
+		bool                   held;
+		float                  held_value;
+	};
+	typedef std::vector<RegEntry> RegEntryList;
+
+	// indexed by control
+	std::vector<RegEntryList> _reg_table;
+
+	// destinations of the registered (non-auto) updates
+	SubscriberList _update_subscribers;
 
-	bool send_registered_updates(ControlRegistrationMap::iterator & iter,
-				     std::string ctrl, float val, int instance, int source=-1);
-	bool send_registered_auto_updates(ControlRegistrationMapAuto::iterator & iter,
-				    const InstancePair & ipair, float val, const std::list<short int> timeout_list);
+	// update rates asked for with /set_update_rate, in usecs between updates
+	typedef std::pair<lo_address, std::string> SubscriberKey;
+	std::map<SubscriberKey, long long> _update_intervals;
+	bool _held_updates;
+
+	void set_update_rate (lo_address addr, const std::string & path, float max_per_sec);
+	void send_held_updates (long long now);
+	void hold_if_congested (RegEntry & entry, bool queued, float val);
+
+	void send_registered_updates(Event::control_t ctrl, float val, int instance, int source=-1);
+	void add_registered_update (int instance, Event::control_t ctrl, lo_address addr, const std::string & path);
+	void remove_registered_update (int instance, Event::control_t ctrl, lo_address addr, const std::string & path);
+	void remove_registered_updates_for_loop (int instance);
+	void remove_update_registrations (Subscriber * sub);
+
+	// a single auto update registration
+	struct AutoEntry
+	{
+		int                    instance;
+		short int              timeout;
+		Subscriber *           sub;
+		const UpdateTemplate * tmpl;
+		float                  last_value;
+		bool                   has_last;
+	};
+	typedef std::vector<AutoEntry> AutoEntryList;
+
+	// indexed by control, entries sorted by instance
+	std::vector<AutoEntryList> _auto_table;
+	SubscriberList             _auto_subscribers;
+
+	void add_auto_update (int instance, Event::control_t ctrl, lo_address addr, const std::string & path, short int timeout);
+	void remove_auto_update (int instance, Event::control_t ctrl, lo_address addr, const std::string & path);
+	void remove_auto_updates_for_loop (int instance);
+	bool queue_update (Subscriber & sub, const UpdateTemplate & tmpl, int instance, float val);
+	void flush_bundle (Subscriber & sub);
+	void purge_auto_updates ();
 	
 
 	
@@ -249,6 +392,33 @@ class ControlOSC
 	typedef std::list<AddrPathPair> AddressList;
 	AddressList _config_registrations;
 
+	// a /register_diff client, and the config it was last sent.  slot 0
+	// is the globals, slot n+1 is loop n
+	struct ConfigClient
+	{
+		ConfigClient (const std::string & url, const std::string & pth)
+			: returl(url), path(pth), loop_count(-1) {}
+
+		std::string                      returl;
+		std::string                      path;
+		int                              loop_count;
+		std::vector<uint32_t>            versions;
+		std::vector<std::vector<float> > values;
+	};
+	typedef std::list<ConfigClient> ConfigClientList;
+	ConfigClientList _config_clients;
+
+	// bumped whenever something in a slot may have changed
+	std::vector<uint32_t> _config_versions;
+	uint32_t              _config_serial;
+
+	std::vector<Event::control_t> _loop_config_ctrls;
+	std::vector<Event::control_t> _global_config_ctrls;
+
+	void bump_config_version (int instance);
+	void update_config_slots ();
+	bool send_config_diff (ConfigClient & client);
+
 	void validate_returl(std::string & returl);
 };
 
@@ -39,6 +39,7 @@
 #include "control_osc.hpp"
 #include "midi_bind.hpp"
 #include "midi_bridge.hpp"
+#include "shm_state.hpp"
 #include "utils.hpp"
 #include "debug.hpp"
 
@@ -49,9 +50,26 @@ using namespace sigc;
 
 #define MAX_EVENTS 1024
 #define MAX_SYNC_EVENTS 1024
+// room for the largest timed batch, which has to fire in one cycle
+#define MAX_DUE_EVENTS 1024
+#define MAX_TIMED_EVENTS 1024
+
+// how quickly the wall clock to frame mapping follows drift, and how far
+// off it can get before we assume an xrun or freewheel and start over
+#define FRAME_EPOCH_SMOOTHING 0.01
+#define FRAME_EPOCH_MAX_ERROR 0.05
 
 #define TEMPO_DIFF(t1, t2) (fabs(t1-t2) > 0.000001)
 
+// the midi clock tempo has to move this far (bpm) before loops hear about it
+#define MIDI_CLOCK_TEMPO_TOLERANCE 0.01
+// default bandwidth of the loop following the midi clock, in Hz
+#define MIDI_CLOCK_DLL_BANDWIDTH 1.0
+
+// minimum ms between ParamChanged emissions for each of Looper::tracked_outputs
+// (State, Waiting, LoopPosition, LoopLength, CycleLength, FreeTime)
+static const int tracked_output_intervals[Looper::TrackedOutputCount] = { 10, 10, 50, 10, 10, 50 };
+
 //#define DEBUG 1
 
 Engine::Engine ()
@@ -61,8 +79,13 @@ Engine::Engine ()
   _osc = 0;
   _event_generator = 0;
   _event_queue = 0;
+  _midi_event_queue = 0;
+  _timed_event_queue = 0;
+  _scheduler = 0;
+  _due_event_queue = 0;
   _def_channel_cnt = 2;
   _def_loop_secs = 200;
+  _osc_tcp = false;
   _tempo = 110.0;
   _eighth_cycle = 16.0f;
   _sync_source = NoSync;
@@ -72,6 +95,10 @@ Engine::Engine ()
   _quarter_note_frames = 0.0;
   _midi_ticks = 0;
   _midi_loop_tick = 12;
+  _clock_dll.set_bandwidth (MIDI_CLOCK_DLL_BANDWIDTH);
+  _midi_clock_locked = false;
+  _midi_clock_tempo = 0.0;
+  _pending_pulse_count = 0;
   _midi_bridge = 0;
   _learn_done = false;
   _received_done = false;
@@ -97,6 +124,9 @@ Engine::Engine ()
   _timebase_changed = false;
 
   _running_frames = 0;
+  _frame_clock = 0;
+  _frame_epoch = 0.0;
+  _frame_epoch_valid = false;
   _last_tempo_frame = 0;
   _tempo_changed = false;
   _beat_occurred = false;
@@ -115,6 +145,8 @@ Engine::Engine ()
   _send_midi_start_after_next_hit = false;
 
   _load_sess_event = NULL;
+  _shm_state = 0;
+  _shm_peaks_loop = 0;
 
   // for now just use the current time!
   _unique_id = (int) ::time(NULL);
@@ -177,6 +209,9 @@ bool Engine::initialize(AudioDriver * driver, int buschans, int port, string pin
   _event_generator = new EventGenerator(_driver->get_samplerate());
   _event_queue = new RingBuffer<Event> (MAX_EVENTS);
   _midi_event_queue = new RingBuffer<Event> (MAX_EVENTS);
+  _timed_event_queue = new RingBuffer<Event> (MAX_TIMED_EVENTS);
+  _scheduler = new FrameScheduler<Event> (MAX_TIMED_EVENTS);
+  _due_event_queue = new RingBuffer<Event> (MAX_DUE_EVENTS);
   _sync_queue = new RingBuffer<Event> (MAX_SYNC_EVENTS);
   _nonrt_update_event_queue = new RingBuffer<Event> (MAX_SYNC_EVENTS);
 
@@ -198,7 +233,7 @@ bool Engine::initialize(AudioDriver * driver, int buschans, int port, string pin
 
   calculate_tempo_frames();
 
-  _osc = new ControlOSC(this, port);
+  _osc = new ControlOSC(this, port, _osc_tcp);
 
   if (!_osc->is_ok()) {
     return false;
@@ -230,6 +265,21 @@ Engine::cleanup()
     _midi_event_queue = 0;
   }
 
+  if (_timed_event_queue) {
+    delete _timed_event_queue;
+    _timed_event_queue = 0;
+  }
+
+  if (_scheduler) {
+    delete _scheduler;
+    _scheduler = 0;
+  }
+
+  if (_due_event_queue) {
+    delete _due_event_queue;
+    _due_event_queue = 0;
+  }
+
   if (_sync_queue) {
     delete _sync_queue;
     _sync_queue = 0;
@@ -250,6 +300,11 @@ Engine::cleanup()
     _event_generator = 0;
   }
 
+  if (_shm_state) {
+    delete _shm_state;
+    _shm_state = 0;
+  }
+
   if (_internal_sync_buf) {
     delete [] _internal_sync_buf;
     _internal_sync_buf = 0;
@@ -332,6 +387,30 @@ void Engine::quit(bool force)
   pthread_cond_signal (&_event_cond);
 }
 
+bool
+Engine::set_shm_name (string name)
+{
+  // must be called before the driver is activated
+  if (_shm_state) {
+    delete _shm_state;
+    _shm_state = 0;
+  }
+
+  if (name.empty()) {
+    return true;
+  }
+
+  _shm_state = new ShmState (name, _driver->get_samplerate());
+
+  if (!_shm_state->is_ok()) {
+    delete _shm_state;
+    _shm_state = 0;
+    return false;
+  }
+
+  return true;
+}
+
 bool
 Engine::get_common_input (unsigned int chan, port_id_t & port)
 {
@@ -669,48 +748,45 @@ Engine::get_osc_port ()
 }
 
 
-static inline Event * next_rt_event (RingBuffer<Event>::rw_vector & vec, size_t & pos,
-                                     RingBuffer<Event>::rw_vector & midivec, size_t & midipos)
+static inline Event * peek_rt_event (RingBuffer<Event>::rw_vector & vec, size_t pos)
 {
-  Event * e1 = 0;
-  Event * e2 = 0;
-
   if (pos < vec.len[0]) {
-    e1 = &vec.buf[0][pos];
+    return &vec.buf[0][pos];
   }
   else if (pos < (vec.len[0] + vec.len[1])) {
-    e1 = &vec.buf[1][pos - vec.len[0]];
+    return &vec.buf[1][pos - vec.len[0]];
   }
 
-  if (midipos < midivec.len[0]) {
-    e2 = &midivec.buf[0][midipos];
-  }
-  else if (midipos < (midivec.len[0] + midivec.len[1])) {
-    e2 = &midivec.buf[1][midipos - midivec.len[0]];
-  }
+  return 0;
+}
+
+static inline Event * next_rt_event (RingBuffer<Event>::rw_vector & vec, size_t & pos,
+                                     RingBuffer<Event>::rw_vector & midivec, size_t & midipos,
+                                     RingBuffer<Event>::rw_vector & duevec, size_t & duepos)
+{
+  Event * e1 = peek_rt_event (vec, pos);
+  Event * e2 = peek_rt_event (midivec, midipos);
+  Event * e3 = peek_rt_event (duevec, duepos);
 
   // pick the earliest fragpos
+  Event * evt = e1;
+  size_t * evtpos = &pos;
 
-  if (e1 && e2) {
-    if (e1->FragmentPos() < e2->FragmentPos()) {
-      ++pos;
-      return e1;
-    }
-    else {
-      ++midipos;
-      return e2;
-    }
+  if (e2 && (!evt || e2->FragmentPos() <= evt->FragmentPos())) {
+    evt = e2;
+    evtpos = &midipos;
   }
-  else if (e1) {
-    ++pos;
-    return e1;
+
+  if (e3 && (!evt || e3->FragmentPos() < evt->FragmentPos())) {
+    evt = e3;
+    evtpos = &duepos;
   }
-  else if (e2) {
-    ++midipos;
-    return e2;
+
+  if (evt) {
+    ++(*evtpos);
   }
 
-  return 0;
+  return evt;
 }
 
 void Engine::process_rt_loop_manage_events ()
@@ -775,13 +851,29 @@ Engine::process (nframes_t nframes)
   Event * evt;
   RingBuffer<Event>::rw_vector vec;
   RingBuffer<Event>::rw_vector midivec;
+  RingBuffer<Event>::rw_vector duevec;
+
+  // update event generator
+  _event_generator->updateFragmentTime (nframes);
+
+  // scheduled events: those held for a time (bundle timetags) and
+  // any commands from local shared memory clients
+  update_frame_epoch ();
+  drain_timed_events ();
+  drain_shm_commands ();
+  fire_due_events (nframes);
+
+  // midi that came in with the audio goes straight onto the midi queue,
+  // at the frame it arrived on
+  if (_midi_bridge && _driver->has_midi_ports()) {
+    _midi_bridge->process_driver_midi (*_driver, nframes);
+  }
 
   // get available events
+  double dequeued = MidiLatency::now();
   _event_queue->get_read_vector (&vec);
   _midi_event_queue->get_read_vector (&midivec);
-
-  // update event generator
-  _event_generator->updateFragmentTime (nframes);
+  _due_event_queue->get_read_vector (&duevec);
 
   // process loop instance rt events
   process_rt_loop_manage_events();
@@ -795,15 +887,16 @@ Engine::process (nframes_t nframes)
 
   nframes_t usedframes = 0;
   nframes_t doframes;
-  size_t num = vec.len[0] + midivec.len[0];
+  size_t num = vec.len[0] + midivec.len[0] + duevec.len[0];
   size_t n = 0;
   size_t midi_n = 0;
+  size_t due_n = 0;
   int fragpos;
   int m, syncm;
 
   if (num > 0) {
 
-    evt = next_rt_event (vec, n, midivec, midi_n);
+    evt = next_rt_event (vec, n, midivec, midi_n, duevec, due_n);
 
     while (evt)
       {
@@ -819,6 +912,10 @@ Engine::process (nframes_t nframes)
 	  fragpos = usedframes;
 	}
 
+	if (evt->Stamp.received > 0.0) {
+	  record_midi_latency (*evt, dequeued, fragpos);
+	}
+
 	doframes = fragpos - usedframes;
 
 	// handle special global RT events
@@ -900,15 +997,16 @@ Engine::process (nframes_t nframes)
 	if (evt->Type == Event::type_control_change || evt->Type == Event::type_global_control_change) {
 	  do_push_control_event (_nonrt_update_event_queue,
 				 evt->Type, evt->Control, evt->Value,
-				 evt->Instance, evt->source);
+				 evt->Instance, -1, evt->source);
 	}
 
-	evt = next_rt_event (vec, n, midivec, midi_n);
+	evt = next_rt_event (vec, n, midivec, midi_n, duevec, due_n);
       }
 
     // advance events
     _event_queue->increment_read_ptr (vec.len[0] + vec.len[1]);
     _midi_event_queue->increment_read_ptr (midivec.len[0] + midivec.len[1]);
+    _due_event_queue->increment_read_ptr (duevec.len[0] + duevec.len[1]);
 
 
     m = 0;
@@ -951,11 +1049,269 @@ Engine::process (nframes_t nframes)
   // scales output and mixes common dry
   fill_common_outs (nframes);
 
+  update_state_snapshot();
+
   _running_frames += nframes;
+  _frame_clock += nframes;
 
   return 0;
 }
 
+void
+Engine::update_frame_epoch ()
+{
+  // this is the rt thread
+  double rate = (double) _driver->get_samplerate();
+  double start = _event_generator->fragmentStartTime();
+  nframes_t since = _driver->get_frames_since_cycle_start();
+
+  if (since > 0) {
+    // the driver knows when the cycle really started, which doesn't
+    // depend on when this thread got to run
+    start = _event_generator->createTimeStamp() - (since / rate);
+  }
+
+  double measured = start - ((double) _frame_clock / rate);
+
+  // the cycle start times jitter, the mapping shouldn't
+  if (!_frame_epoch_valid || fabs (measured - _frame_epoch) > FRAME_EPOCH_MAX_ERROR) {
+    _frame_epoch = measured;
+    _frame_epoch_valid = true;
+  }
+  else {
+    _frame_epoch += (measured - _frame_epoch) * FRAME_EPOCH_SMOOTHING;
+  }
+}
+
+void
+Engine::drain_timed_events ()
+{
+  // this is the rt thread
+  RingBuffer<Event>::rw_vector vec;
+  double rate = (double) _driver->get_samplerate();
+
+  while (_timed_event_queue->read_space() > 0)
+    {
+      _timed_event_queue->get_read_vector (&vec);
+      Event * evt = vec.buf[0];
+
+      // a batch goes into the wheel whole, it was queued in one go
+      size_t count = (evt->batch > 1) ? (size_t) evt->batch : 1;
+      if (_scheduler->free_space() < count) {
+	// full, try again next cycle
+	break;
+      }
+
+      double when = (evt->getTimestamp() - _frame_epoch) * rate;
+      uint64_t frame = (when > 0.0) ? (uint64_t) (when + 0.5) : 0;
+
+      for (size_t n = 0; n < count; ++n) {
+	_timed_event_queue->get_read_vector (&vec);
+	_scheduler->schedule (frame, *vec.buf[0]);
+	_timed_event_queue->increment_read_ptr (1);
+      }
+    }
+}
+
+void
+Engine::drain_shm_commands ()
+{
+  // this is the rt thread
+  if (!_shm_state) return;
+
+  const sl_shm_cmd_t * cmd;
+
+  while ((cmd = _shm_state->peek_command()) != 0)
+    {
+      if (cmd->type < Event::type_cmd_down || cmd->type > Event::type_global_control_change
+	  || cmd->type == Event::type_control_request)
+	{
+	  // garbage from a client, drop it
+	  _shm_state->pop_command();
+	  continue;
+	}
+
+      Event evt = get_event_generator().createEvent (0);
+
+      evt.Type = (Event::type_t) cmd->type;
+      evt.Instance = (int8_t) cmd->instance;
+      evt.source = 0;
+
+      if (evt.Type == Event::type_control_change || evt.Type == Event::type_global_control_change) {
+	evt.Control = (Event::control_t) cmd->id;
+	evt.Value = cmd->value;
+      }
+      else {
+	evt.Command = (Event::command_t) cmd->id;
+      }
+
+      // frame 0 (or any past frame) means asap
+      if (!_scheduler->schedule (cmd->frame, evt)) {
+	// full, try the rest next cycle
+	break;
+      }
+
+      _shm_state->pop_command();
+    }
+}
+
+void
+Engine::fire_due_events (nframes_t nframes)
+{
+  // this is the rt thread, moves what falls in this cycle over
+  // to the due queue, in frame order
+  RingBuffer<Event>::rw_vector vec;
+  const Event * next;
+  uint64_t frame;
+  Event evt;
+
+  while ((next = _scheduler->peek_due (_frame_clock + nframes)) != 0)
+    {
+      // a batch goes over whole, or waits for the next cycle
+      size_t count = (next->batch > 1) ? (size_t) next->batch : 1;
+      if (_due_event_queue->write_space() < count) {
+	break;
+      }
+
+      while (count-- > 0 && _scheduler->pop_due (_frame_clock + nframes, frame, evt))
+	{
+	  // anything left over from a previous cycle goes first
+	  evt.setFragmentPos ((frame > _frame_clock) ? (int) (frame - _frame_clock) : 0);
+
+	  _due_event_queue->get_write_vector (&vec);
+	  *vec.buf[0] = evt;
+	  _due_event_queue->increment_write_ptr (1);
+	}
+    }
+}
+
+void
+Engine::update_state_snapshot()
+{
+  // this is the rt thread
+  EngineStateSnapshot & snap = _state_snapshot.begin_write();
+
+  unsigned int n = 0;
+  for (Instances::iterator i = _rt_instances.begin(); i != _rt_instances.end() && n < SNAPSHOT_MAX_LOOPS; ++i, ++n) {
+    (*i)->fill_state_snapshot (snap.loops[n]);
+  }
+  snap.loop_count = n;
+
+  snap.tempo = _tempo;
+  snap.sync_source = _sync_source;
+  snap.eighth_cycle = _eighth_cycle;
+  snap.dry = _curr_common_dry;
+  snap.wet = _curr_common_wet;
+  snap.input_gain = _curr_input_gain;
+  snap.in_peak = _common_input_peak;
+  snap.out_peak = _common_output_peak;
+  snap.selected_loop = _selected_loop;
+
+  _state_snapshot.end_write();
+
+  if (_shm_state) {
+    _shm_state->publish (snap, _frame_clock);
+
+    // and one loop's waveform overview, taking turns
+    if (_shm_peaks_loop >= n) {
+      _shm_peaks_loop = 0;
+    }
+
+    float * minmax;
+    if (n > 0 && (minmax = _shm_state->begin_peaks (_shm_peaks_loop)) != 0) {
+      float length = snap.loops[_shm_peaks_loop].ports[LoopLength];
+      nframes_t frames = (nframes_t) lrintf (length * _driver->get_samplerate());
+      unsigned int points = 0;
+
+      // bins only, a short loop would otherwise have all its samples read here
+      if (frames > 0 && _rt_instances[_shm_peaks_loop]->get_peaks (minmax, SL_SHM_PEAK_POINTS, 0, frames, false)) {
+	points = SL_SHM_PEAK_POINTS;
+      }
+
+      _shm_state->end_peaks (_shm_peaks_loop, points, length);
+      ++_shm_peaks_loop;
+    }
+  }
+}
+
+bool
+Engine::read_state_snapshot (Event::control_t ctrl, int instance, float & val) const
+{
+  // returns false if the value isn't one the rt thread publishes,
+  // the caller should read it directly then
+  const EngineStateSnapshot * snap;
+  uint32_t token;
+  int index = (int) ctrl;
+  bool found;
+
+  do {
+    token = _state_snapshot.read_begin (snap);
+    if (token < 2) {
+      // nothing published yet
+      return false;
+    }
+
+    found = true;
+
+    if (instance >= 0) {
+      if (instance >= (int) snap->loop_count || snap->loops[instance].looper != _instances[instance]) {
+	// rt thread hasn't caught up with a loop add/remove yet
+	return false;
+      }
+
+      const LoopStateSnapshot & lsnap = snap->loops[instance];
+
+      if (ctrl == Event::DryLevel) {
+	val = lsnap.dry;
+      }
+      else if (index >= 0 && index < LASTPORT) {
+	val = lsnap.ports[index];
+      }
+      else if (ctrl == Event::InPeakMeter) {
+	val = lsnap.in_peak;
+      }
+      else if (ctrl == Event::OutPeakMeter) {
+	val = lsnap.out_peak;
+      }
+      else if (ctrl == Event::InputGain) {
+	val = lsnap.input_gain;
+      }
+      else {
+	found = false;
+      }
+    }
+    else {
+      if (ctrl == Event::InPeakMeter) {
+	val = snap->in_peak;
+      }
+      else if (ctrl == Event::OutPeakMeter) {
+	val = snap->out_peak;
+      }
+      else if (ctrl == Event::DryLevel) {
+	val = snap->dry;
+      }
+      else if (ctrl == Event::WetLevel) {
+	val = snap->wet;
+      }
+      else if (ctrl == Event::InputGain) {
+	val = snap->input_gain;
+      }
+      else if (ctrl == Event::Tempo) {
+	val = snap->tempo;
+      }
+      else if (ctrl == Event::SelectedLoopNum) {
+	val = snap->selected_loop;
+      }
+      else {
+	found = false;
+      }
+    }
+
+  } while (!_state_snapshot.read_valid (token));
+
+  return found;
+}
+
 void
 Engine::do_global_rt_event (Event * ev, nframes_t offset, nframes_t nframes)
 {
@@ -1255,9 +1611,16 @@ bool Engine::push_loop_manage_to_main (LoopManageEvent & lme)
 }
 
 bool
-Engine::push_command_event (Event::type_t type, Event::command_t cmd, int8_t instance)
+Engine::push_command_event (Event::type_t type, Event::command_t cmd, int8_t instance, EventGenerator::time_stamp_t when)
 {
-  bool ret = do_push_command_event (_event_queue, type, cmd, instance);
+  bool ret;
+
+  if (when > 0) {
+    ret = do_push_command_event (_timed_event_queue, type, cmd, instance, -1, when);
+  }
+  else {
+    ret = do_push_command_event (_event_queue, type, cmd, instance);
+  }
 
 
   // this is a known race condition, if the osc thread is changing controls
@@ -1274,7 +1637,11 @@ Engine::push_command_event (Event::type_t type, Event::command_t cmd, int8_t ins
 void
 Engine::push_midi_command_event (Event::type_t type, Event::command_t cmd, int8_t instance, long framepos)
 {
-  do_push_command_event (_midi_event_queue, type, cmd, instance, framepos);
+  Event::MidiStamp stamp;
+  _midi_bridge->get_input_stamp (stamp);
+  stamp.queued = MidiLatency::now();
+
+  do_push_command_event (_midi_event_queue, type, cmd, instance, framepos, 0, &stamp);
 
   // this is a known race condition, if the osc thread is changing controls
   // simultaneously.  it's just an update :)
@@ -1287,7 +1654,8 @@ Engine::push_midi_command_event (Event::type_t type, Event::command_t cmd, int8_
 
 
 bool
-Engine::do_push_command_event (RingBuffer<Event> * evqueue, Event::type_t type, Event::command_t cmd, int8_t instance, long framepos)
+Engine::do_push_command_event (RingBuffer<Event> * evqueue, Event::type_t type, Event::command_t cmd, int8_t instance, long framepos,
+				EventGenerator::time_stamp_t when, const Event::MidiStamp * stamp)
 {
   // todo support more than one simulataneous pusher safely
   RingBuffer<Event>::rw_vector vec;
@@ -1302,11 +1670,14 @@ Engine::do_push_command_event (RingBuffer<Event> * evqueue, Event::type_t type,
   }
 
   Event * evt = vec.buf[0];
-  *evt = get_event_generator().createEvent(framepos);
+  *evt = (when > 0) ? get_event_generator().createTimestampedEvent(when) : get_event_generator().createEvent(framepos);
 
   evt->Type = type;
   evt->Command = cmd;
   evt->Instance = instance;
+  if (stamp) {
+    evt->Stamp = *stamp;
+  }
 
   evqueue->increment_write_ptr (1);
 
@@ -1315,7 +1686,8 @@ Engine::do_push_command_event (RingBuffer<Event> * evqueue, Event::type_t type,
 
 
 bool
-Engine::do_push_control_event (RingBuffer<Event> * evqueue, Event::type_t type, Event::control_t ctrl, float val, int8_t instance, long framepos, int src)
+Engine::do_push_control_event (RingBuffer<Event> * evqueue, Event::type_t type, Event::control_t ctrl, float val, int8_t instance, long framepos, int src,
+				EventGenerator::time_stamp_t when, const Event::MidiStamp * stamp)
 {
   // todo support more than one simulataneous pusher safely
 
@@ -1331,13 +1703,16 @@ Engine::do_push_control_event (RingBuffer<Event> * evqueue, Event::type_t type,
   }
 
   Event * evt = vec.buf[0];
-  *evt = get_event_generator().createEvent(framepos);
+  *evt = (when > 0) ? get_event_generator().createTimestampedEvent(when) : get_event_generator().createEvent(framepos);
 
   evt->Type = type;
   evt->Control = ctrl;
   evt->Value = val;
   evt->Instance = instance;
   evt->source = src;
+  if (stamp) {
+    evt->Stamp = *stamp;
+  }
 
   evqueue->increment_write_ptr (1);
 
@@ -1345,9 +1720,14 @@ Engine::do_push_control_event (RingBuffer<Event> * evqueue, Event::type_t type,
 }
 
 void
-Engine::push_control_event (Event::type_t type, Event::control_t ctrl, float val, int8_t instance, int src)
+Engine::push_control_event (Event::type_t type, Event::control_t ctrl, float val, int8_t instance, int src, EventGenerator::time_stamp_t when)
 {
-  do_push_control_event (_event_queue, type, ctrl, val, instance);
+  if (when > 0) {
+    do_push_control_event (_timed_event_queue, type, ctrl, val, instance, -1, src, when);
+  }
+  else {
+    do_push_control_event (_event_queue, type, ctrl, val, instance, -1, src);
+  }
 
   // the nonrt update queue is now pushed on the realtime thread
 
@@ -1361,10 +1741,55 @@ Engine::push_control_event (Event::type_t type, Event::control_t ctrl, float val
 
 }
 
+bool
+Engine::push_control_batch (const std::vector<ControlChange> & changes, int src, EventGenerator::time_stamp_t when)
+{
+  RingBuffer<Event>::rw_vector vec;
+  RingBuffer<Event> * evqueue = (when > 0) ? _timed_event_queue : _event_queue;
+
+  evqueue->get_write_vector (&vec);
+
+  if (vec.len[0] + vec.len[1] < changes.size()) {
+#ifdef DEBUG
+    cerr << "ctrl event queue too full for batch of " << changes.size() << ", dropping it" << endl;
+#endif
+    return false;
+  }
+
+  // they all share a timestamp, and the rt thread can only see them
+  // once the write pointer moves past the last one
+  Event proto = (when > 0) ? get_event_generator().createTimestampedEvent (when) : get_event_generator().createEvent();
+  size_t n = 0;
+
+  for (std::vector<ControlChange>::const_iterator change = changes.begin(); change != changes.end(); ++change, ++n) {
+    Event * evt = (n < vec.len[0]) ? &vec.buf[0][n] : &vec.buf[1][n - vec.len[0]];
+
+    *evt = proto;
+    evt->batch = (when > 0 && n == 0) ? (int) changes.size() : 0;
+    evt->Type = (change->instance == -2) ? Event::type_global_control_change : Event::type_control_change;
+    evt->Control = change->ctrl;
+    evt->Value = change->value;
+    evt->Instance = change->instance;
+    evt->source = src;
+  }
+
+  evqueue->increment_write_ptr (changes.size());
+
+  // wakeup nonrt loop... this lock should really not block... but still
+  TentativeLockMonitor mon(_event_loop_lock,  __LINE__, __FILE__);
+  pthread_cond_signal (&_event_cond);
+
+  return true;
+}
+
 void
 Engine::push_midi_control_event (Event::type_t type, Event::control_t ctrl, float val, int8_t instance, long framepos)
 {
-  do_push_control_event (_midi_event_queue, type, ctrl, val, instance, framepos);
+  Event::MidiStamp stamp;
+  _midi_bridge->get_input_stamp (stamp);
+  stamp.queued = MidiLatency::now();
+
+  do_push_control_event (_midi_event_queue, type, ctrl, val, instance, framepos, 0, 0, &stamp);
 
   // the nonrt update queue is now pushed on the realtime thread
 
@@ -1378,7 +1803,26 @@ Engine::push_midi_control_event (Event::type_t type, Event::control_t ctrl, floa
 }
 
 void
-Engine::push_sync_event (Event::control_t ctrl, long framepos, MIDI::timestamp_t timestamp)
+Engine::record_midi_latency (const Event & evt, double dequeued, int fragpos)
+{
+  // rt thread.  the queue wait is measured to when this cycle picked up
+  // its events, and the rest to the frame it lands on in this cycle
+  const Event::MidiStamp & stamp = evt.Stamp;
+  double bridge = max (0.0, stamp.queued - stamp.received);
+  double queue = max (0.0, dequeued - stamp.queued);
+  double fragment = fragpos / (double) _driver->get_samplerate();
+
+  if (stamp.device_delay > 0.0) {
+    _midi_latency.add (MidiLatency::Device, stamp.device_delay);
+  }
+  _midi_latency.add (MidiLatency::Bridge, bridge);
+  _midi_latency.add (MidiLatency::Queue, queue);
+  _midi_latency.add (MidiLatency::Fragment, fragment);
+  _midi_latency.add (MidiLatency::Total, stamp.device_delay + bridge + queue + fragment);
+}
+
+void
+Engine::push_sync_event (Event::control_t ctrl, long framepos, MIDI::timestamp_t timestamp, double device_delay)
 {
   // todo support more than one simulataneous pusher safely
 
@@ -1404,8 +1848,11 @@ Engine::push_sync_event (Event::control_t ctrl, long framepos, MIDI::timestamp_t
     //fprintf(stderr, "creating sync event at frame %ld\n", framepos);
     *evt = get_event_generator().createEvent(framepos);
   } else {
+    // the port's timestamp may not be on the event clock, but how long
+    // ago it was is the same on either.  the bridge passes that along
+    // with the event, anyone else has no delay to give
     //fprintf(stderr, "creating sync event at time %.14g\n", timestamp);
-    *evt = get_event_generator().createTimestampedEvent(timestamp);
+    *evt = get_event_generator().createTimestampedEvent(get_event_generator().createTimeStamp() - device_delay);
   }
 
   evt->Type = Event::type_sync;
@@ -1473,6 +1920,8 @@ Engine::load_midi_bindings (std::istream & instream, bool append, CommandMap & c
       _midi_bridge->bindings().add_binding (info);
     }
 
+  _midi_bridge->update_bindings();
+
   return true;
 }
 
@@ -1490,12 +1939,22 @@ Engine::get_control_value (Event::control_t ctrl, int8_t instance)
     instance = 0;
   }
 
+  float val;
+
   if (instance >= 0 && instance < (int) _instances.size()) {
 
+    // the rt owned values come from the last published snapshot
+    if (read_state_snapshot (ctrl, instance, val)) {
+      return val;
+    }
+
     return _instances[instance]->get_control_value (ctrl);
   }
   else if (instance == -2) {
-    if (ctrl == Event::InPeakMeter) {
+    if (read_state_snapshot (ctrl, -2, val)) {
+      return val;
+    }
+    else if (ctrl == Event::InPeakMeter) {
       return _common_input_peak;
     }
     else if (ctrl == Event::OutPeakMeter) {
@@ -1564,6 +2023,8 @@ Engine::push_nonrt_event (EventNonRT * event)
   }
   else {
     //cerr << "UGH, couldn't push event, no writespace" << endl;
+    // we own it now, give the block back to the pool
+    delete event;
     return false;
   }
 }
@@ -1598,6 +2059,8 @@ Engine::mainloop()
   struct timeval timeoutv = {0, 0};
   struct timeval auto_update_timer_v[AUTO_UPDATE_RANGE];
   struct timeval timer_last[AUTO_UPDATE_RANGE];
+  struct timeval tracked_interval_v[Looper::TrackedOutputCount];
+  struct timeval tracked_last[Looper::TrackedOutputCount];
   int  wait_ret = 0;
 
   EventNonRT * event;
@@ -1612,6 +2075,13 @@ Engine::mainloop()
     auto_update_timer_v[i].tv_usec = ((AUTO_UPDATE_STEP*(i+1)))*1000;
   }
 
+  for (int i = 0; i < Looper::TrackedOutputCount; i++) {
+    tracked_last[i].tv_sec = 0;
+    tracked_last[i].tv_usec = 0;
+    tracked_interval_v[i].tv_sec = 0;
+    tracked_interval_v[i].tv_usec = tracked_output_intervals[i] * 1000;
+  }
+
   // non-rt event processing loop
   while (is_ok())
     {
@@ -1660,11 +2130,7 @@ Engine::mainloop()
 	  }
 	  else if (evt->Type == Event::type_control_change) {
 	    int instance = evt->Instance == -3 ? _selected_loop : evt->Instance;
-	    ConfigUpdateEvent cuev (ConfigUpdateEvent::Send, instance, evt->Control, "", "", evt->Value);
-	    cuev.source = evt->source;
-	    _osc->finish_update_event (cuev);
-
-	    ParamChanged(evt->Control, instance); // emit
+	    coalesce_update (instance, evt->Control, evt->Value, evt->source);
 	  }
 	  else if (evt->Type == Event::type_cmd_down || evt->Type == Event::type_cmd_hit) {
 	    cerr << "got nonrt- command: " << evt->Command << endl;
@@ -1677,6 +2143,8 @@ Engine::mainloop()
 	  _nonrt_update_event_queue->increment_read_ptr(1);
 	}
 
+      send_pending_updates ();
+
       if (!is_ok()) break;
 
       // handle special requests from the audio thread
@@ -1729,10 +2197,17 @@ Engine::mainloop()
 	  _conns_changed = false;
 	}
 
-      // handle learning done from the midi thread
+      // midi trace and osc mirror and midi learn, kept off
+      // the midi threads, before the learn result is handled
+      if (_midi_bridge) {
+	_midi_bridge->service(this);
+      }
+
+      // handle learning done in service()
       if (_learn_done && _midi_bridge) {
 	LockMonitor lm (_midi_bridge->bindings_lock(), __LINE__, __FILE__);
 	_midi_bridge->bindings().add_binding (_learninfo, _learn_event.options == "exclusive");
+	_midi_bridge->update_bindings();
 
 	_learn_event.bind_str = _learninfo.serialize();
 	_osc->finish_midi_binding_event (_learn_event);
@@ -1763,14 +2238,28 @@ Engine::mainloop()
 
 	_osc->send_auto_updates(timeout_list);
 
-	// emit a parameter changed for state and others
-	for (unsigned int n=0; n < _instances.size(); ++n) {
-	  ParamChanged(Event::State, n); // emit
-	  ParamChanged(Event::Waiting, n);
-	  ParamChanged(Event::LoopPosition, n);
-	  ParamChanged(Event::LoopLength, n);
-	  ParamChanged(Event::CycleLength, n);
-	  ParamChanged(Event::FreeTime, n);
+	// emit a parameter changed for state and others, but only for those
+	// the rt thread saw change, and no more often than their interval
+	uint32_t allowed = 0;
+	for (int i = 0; i < Looper::TrackedOutputCount; i++) {
+	  struct timeval timer_diff = {0,0};
+	  timersub(&now, &tracked_last[i], &timer_diff);
+	  if (timercmp(&timer_diff, &tracked_interval_v[i], >=)) {
+	    allowed |= (1 << i);
+	    tracked_last[i] = now;
+	  }
+	}
+
+	if (allowed) {
+	  for (unsigned int n=0; n < _instances.size(); ++n) {
+	    uint32_t changed = _instances[n]->take_changed_outputs (allowed);
+
+	    for (int i = 0; changed; ++i, changed >>= 1) {
+	      if (changed & 1) {
+		ParamChanged(Looper::tracked_outputs[i], n); // emit
+	      }
+	    }
+	  }
 	}
 
 	// wake up every 10 ms for servicing auto-update parameters
@@ -1787,6 +2276,9 @@ Engine::mainloop()
 	timeoutv.tv_usec = timeout.tv_nsec / 1000;
       }
 
+      // everything updated in this pass goes out as one bundle per destination
+      _osc->flush_updates();
+
       // sleep on condition
       {
 	LockMonitor mon(_event_loop_lock, __LINE__, __FILE__);
@@ -1796,11 +2288,43 @@ Engine::mainloop()
 
 }
 
+void
+Engine::coalesce_update (int instance, Event::control_t ctrl, float val, int src)
+{
+  // a fader sweep only needs its latest value sent
+  for (std::vector<PendingUpdate>::iterator upd = _pending_updates.begin(); upd != _pending_updates.end(); ++upd) {
+    if (upd->instance == instance && upd->control == ctrl) {
+      upd->value = val;
+      upd->source = src;
+      return;
+    }
+  }
+
+  _pending_updates.push_back (PendingUpdate (instance, ctrl, val, src));
+}
+
+void
+Engine::send_pending_updates ()
+{
+  for (std::vector<PendingUpdate>::iterator upd = _pending_updates.begin(); upd != _pending_updates.end(); ++upd) {
+    ConfigUpdateEvent cuev (ConfigUpdateEvent::Send, upd->instance, upd->control, "", "", upd->value);
+    cuev.source = upd->source;
+    _osc->finish_update_event (cuev);
+
+    ParamChanged(upd->control, upd->instance); // emit
+  }
+
+  _pending_updates.clear();
+}
+
 bool
 Engine::process_nonrt_event (EventNonRT * event)
 {
   ConfigUpdateEvent * cu_event;
   GetParamEvent *     gp_event;
+  GetManyEvent *      gm_event;
+  GetPeaksEvent *     gpk_event;
+  GetMidiLatencyEvent * gml_event;
   ConfigLoopEvent *   cl_event;
   PingEvent *         ping_event;
   RegisterConfigEvent * rc_event;
@@ -1817,6 +2341,44 @@ Engine::process_nonrt_event (EventNonRT * event)
       gp_event->ret_value = get_control_value (gp_event->control, gp_event->instance);
       _osc->finish_get_event (*gp_event);
     }
+  else if ((gm_event = dynamic_cast<GetManyEvent*> (event)) != 0)
+    {
+      for (std::vector<GetManyEvent::Item>::iterator item = gm_event->items.begin(); item != gm_event->items.end(); ++item) {
+	item->value = get_control_value (item->control, item->instance);
+      }
+      _osc->finish_get_many_event (*gm_event);
+    }
+  else if ((gpk_event = dynamic_cast<GetPeaksEvent*> (event)) != 0)
+    {
+      // one reply per loop asked for, with no points if it has no loop
+      double srate = (double) _driver->get_samplerate();
+      int instance = (gpk_event->instance == -3) ? _selected_loop : gpk_event->instance;
+
+      for (unsigned int n = 0; n < _instances.size(); ++n) {
+	if (instance != -1 && instance != (int) n) {
+	  continue;
+	}
+
+	float length = gpk_event->length;
+	if (length <= 0.0f) {
+	  length = get_control_value (Event::LoopLength, n) - gpk_event->start;
+	}
+
+	gpk_event->peaks.resize (gpk_event->points * 2);
+	if (gpk_event->start < 0.0f || length <= 0.0f
+	    || !_instances[n]->get_peaks (&gpk_event->peaks[0], gpk_event->points,
+					  (nframes_t) lrint (gpk_event->start * srate), (nframes_t) lrint (length * srate), true))
+	{
+	  gpk_event->peaks.clear();
+	}
+
+	_osc->finish_get_peaks_event (*gpk_event, n);
+      }
+    }
+  else if ((gml_event = dynamic_cast<GetMidiLatencyEvent*> (event)) != 0)
+    {
+      _osc->finish_midi_latency_event (*gml_event, _midi_latency);
+    }
   else if ((gg_event = dynamic_cast<GlobalGetEvent*> (event)) != 0)
     {
       if (gg_event->param == "dry") {
@@ -1864,6 +2426,52 @@ Engine::process_nonrt_event (EventNonRT * event)
       else if (gg_event->param == "eighth_per_cycle") {
 	gg_event->ret_value = _eighth_cycle;
       }
+      else if (gg_event->param == "midi_feedback") {
+	gg_event->ret_value = (_midi_bridge && _midi_bridge->get_feedback_out()) ? 1.0f : 0.0f;
+      }
+      else if (gg_event->param == "midi_clock_bandwidth") {
+	gg_event->ret_value = (float) _clock_dll.get_bandwidth();
+      }
+      else if (gg_event->param == "midi_clock_locked") {
+	gg_event->ret_value = _midi_clock_locked ? 1.0f : 0.0f;
+      }
+      else if (gg_event->param == "midi_clock_tempo") {
+	gg_event->ret_value = (float) _midi_clock_tempo;
+      }
+      else if (gg_event->param == "osc_packets_received") {
+	gg_event->ret_value = (float) _osc->get_recv_packets();
+      }
+      else if (gg_event->param == "osc_packets_dropped") {
+	gg_event->ret_value = (float) _osc->get_recv_dropped();
+      }
+      else if (gg_event->param == "osc_max_batch") {
+	gg_event->ret_value = (float) _osc->get_recv_max_batch();
+      }
+      else if (gg_event->param == "osc_max_queue_depth") {
+	gg_event->ret_value = (float) _osc->get_recv_max_queue_depth();
+      }
+      else if (gg_event->param.compare (0, 17, "midi_clock_jitter") == 0
+	       || gg_event->param == "midi_clock_ticks") {
+	unsigned long ticks = 0;
+	double mean = 0.0, max = 0.0, stddev = 0.0;
+
+	if (_midi_bridge) {
+	  _midi_bridge->get_clock_jitter (ticks, mean, max, stddev);
+	}
+
+	if (gg_event->param == "midi_clock_ticks") {
+	  gg_event->ret_value = (float) ticks;
+	}
+	else if (gg_event->param == "midi_clock_jitter_mean") {
+	  gg_event->ret_value = (float) mean;
+	}
+	else if (gg_event->param == "midi_clock_jitter_max") {
+	  gg_event->ret_value = (float) max;
+	}
+	else if (gg_event->param == "midi_clock_jitter_stddev") {
+	  gg_event->ret_value = (float) stddev;
+	}
+      }
 
       _osc->finish_global_get_event (*gg_event);
     }
@@ -1911,6 +2519,16 @@ Engine::process_nonrt_event (EventNonRT * event)
 	  _midi_bridge->select_alternate_binding_set();
 	}
       }
+      else if (gs_event->param == "midi_feedback") {
+	if (_midi_bridge) {
+	  _midi_bridge->set_feedback_out (gs_event->value > 0.0f);
+	}
+      }
+      else if (gs_event->param == "midi_clock_bandwidth") {
+	if (gs_event->value > 0.0f) {
+	  _clock_dll.set_bandwidth (gs_event->value);
+	}
+      }
       else if (gs_event->param == "smart_eighths") {
 	_smart_eighths = gs_event->value > 0.0f;
       }
@@ -2002,6 +2620,7 @@ Engine::process_nonrt_event (EventNonRT * event)
 
 	  LockMonitor lm (_midi_bridge->bindings_lock(), __LINE__, __FILE__);
 	  _midi_bridge->bindings().add_binding (info, exclus);
+	  _midi_bridge->update_bindings();
 	}
       }
       else if (mb_event->type == MidiBindingEvent::Learn)
@@ -2033,6 +2652,7 @@ Engine::process_nonrt_event (EventNonRT * event)
 	  if (info.unserialize (mb_event->bind_str)) {
 	    LockMonitor lm (_midi_bridge->bindings_lock(), __LINE__, __FILE__);
 	    _midi_bridge->bindings().remove_binding (info);
+	    _midi_bridge->update_bindings();
 	  }
 	}
       else if (mb_event->type == MidiBindingEvent::GetAll)
@@ -2044,6 +2664,7 @@ Engine::process_nonrt_event (EventNonRT * event)
 	{
 	  LockMonitor lm (_midi_bridge->bindings_lock(), __LINE__, __FILE__);
 	  _midi_bridge->bindings().clear_bindings();
+	  _midi_bridge->update_bindings();
 	}
       else if (mb_event->type == MidiBindingEvent::Load)
 	{
@@ -2328,6 +2949,46 @@ Engine::calculate_midi_tick (bool rt)
 }
 
 
+void
+Engine::emit_pending_pulses (nframes_t upto, nframes_t & usedframes, int & hit_at)
+{
+  // writes the pulses put off by generate_sync whose frame comes
+  // before upto in this cycle, zeroing the sync buffer up to each one
+  int done = 0;
+
+  while (done < _pending_pulse_count) {
+    PendingPulse & pulse = _pending_pulses[done];
+
+    if (pulse.frame < _frame_clock) {
+      // left over from before the sync source changed
+      ++done;
+      continue;
+    }
+
+    nframes_t pulsepos = (pulse.frame > _frame_clock + usedframes) ? (nframes_t) (pulse.frame - _frame_clock) : usedframes;
+    if (pulsepos >= upto) {
+      break;
+    }
+
+    memset (&(_internal_sync_buf[usedframes]), 0, (pulsepos - usedframes) * sizeof(float));
+    _internal_sync_buf[pulsepos] = pulse.loopsync ? 2.0f : 0.0f;
+    usedframes = pulsepos + 1;
+
+    if (pulse.quarter) {
+      hit_at = (int) pulsepos;
+      _quarter_counter = - ((double) pulsepos);
+    }
+    ++done;
+  }
+
+  if (done > 0) {
+    _pending_pulse_count -= done;
+    for (int n = 0; n < _pending_pulse_count; ++n) {
+      _pending_pulses[n] = _pending_pulses[n + done];
+    }
+  }
+}
+
 int
 Engine::generate_sync (nframes_t offset, nframes_t nframes)
 {
@@ -2398,8 +3059,10 @@ Engine::generate_sync (nframes_t offset, nframes_t nframes)
     size_t num = vec.len[0];
     size_t n = 0;
     size_t vecn = 0;
+    size_t used = 0;
     nframes_t fragpos;
     MIDI::timestamp_t timestamp = 0;
+    double rate = (double) _driver->get_samplerate();
 
 
     if (num > 0) {
@@ -2407,9 +3070,33 @@ Engine::generate_sync (nframes_t offset, nframes_t nframes)
       while (n < num)
 	{
 	  evt = vec.buf[vecn] + n;
-	  fragpos = (nframes_t) (evt->FragmentPos() % nframes);
 	  timestamp = evt->getTimestamp();
 
+	  // the absolute frame it belongs at.  ones with a time are put a
+	  // period behind, so everything that came in during the last cycle
+	  // lands in this one with its spacing intact
+	  double frame;
+	  if (timestamp > 0.0) {
+	    frame = (timestamp - _frame_epoch) * rate + (double) nframes;
+	  }
+	  else {
+	    frame = (double) _frame_clock + evt->FragmentPos();
+	  }
+
+	  if (frame >= (double) (_frame_clock + 2 * nframes)) {
+	    // nothing that already arrived can be that far ahead, the
+	    // mapping must have jumped
+	    frame = (double) (_frame_clock + usedframes);
+	  }
+	  else if (frame >= (double) (_frame_clock + nframes)) {
+	    // came in during this cycle, it waits in the queue for the next
+	    break;
+	  }
+
+	  // anything later than the look-behind covers goes as soon as possible
+	  fragpos = (frame > (double) (_frame_clock + usedframes)) ? (nframes_t) (frame - (double) _frame_clock) : usedframes;
+	  ++used;
+
 	  ++n;
 	  // to avoid code copying
 	  if (n == num && vecn == 0) {
@@ -2418,19 +3105,21 @@ Engine::generate_sync (nframes_t offset, nframes_t nframes)
 	    num = vec.len[1];
 	  }
 
-	  if (fragpos < usedframes || fragpos >= nframes) {
-	    // bad fragment pos
-#ifdef DEBUG
-	    cerr << "BAD SYNC FRAGMENT POS: " << fragpos << endl;
-#endif
-	    //	continue;
-	  }
-
-	  doframes = fragpos - usedframes;
+	  // where the sync pulse goes, if this event makes one
+	  double syncpos = (double) fragpos;
 
 	  // handle special global RT events
 	  if (evt->Control == Event::MidiTick) {
 	    _midi_ticks++;
+
+	    // pulses go where the filtered clock says this tick belongs,
+	    // not where it happened to arrive
+	    syncpos = _clock_dll.tick (frame, rate) - (double) _frame_clock;
+
+	    _midi_clock_locked = _clock_dll.is_locked();
+	    if (_clock_dll.has_period()) {
+	      _midi_clock_tempo = _driver->get_samplerate() * 60.0 / (24.0 * _clock_dll.get_period());
+	    }
 	  }
 	  else if (evt->Control == Event::MidiStart) {
 	    _midi_ticks = 0;
@@ -2461,18 +3150,39 @@ Engine::generate_sync (nframes_t offset, nframes_t nframes)
 	    }
 	  }
 
-	  if ((_midi_ticks % 24) == 0 && TEMPO_DIFF(timestamp,_prev_beatstamp)) {
+	  // the filtered time can be a little outside of this cycle
+	  nframes_t pulsepos = (syncpos <= (double) usedframes) ? usedframes : (nframes_t) min (syncpos, (double) nframes);
+
+	  // pulses put off from an earlier cycle that come before this one
+	  emit_pending_pulses (pulsepos, usedframes, hit_at);
+	  pulsepos = max (pulsepos, usedframes);
+
+	  bool quarter = (evt->Control == Event::MidiTick && (_midi_ticks % 24) == 0 && _clock_dll.has_period());
+	  bool loopsync = ((_midi_ticks % _midi_loop_tick) == 0);
+
+	  if ((quarter || loopsync) && pulsepos >= nframes) {
+	    // the filtered time is past the end of this cycle, so the pulse
+	    // goes out at that frame in the next one instead of getting lost
+	    if (_pending_pulse_count < MAX_PENDING_PULSES) {
+	      PendingPulse & pulse = _pending_pulses[_pending_pulse_count++];
+	      pulse.frame = _frame_clock + (uint64_t) max (syncpos, (double) nframes);
+	      pulse.loopsync = loopsync;
+	      pulse.quarter = quarter;
+	    }
+	  }
+
+	  if (quarter) {
 	    // every quarter note
-	    hit_at = (int) fragpos;
-	    //double tcount = _quarter_counter + (double) fragpos;
+	    if (pulsepos < nframes) {
+	      hit_at = (int) pulsepos;
+	      _quarter_counter = - ((double)usedframes);
+	    }
 
-	    // calc new tempo
-	    //double ntempo = (_driver->get_samplerate() * 60.0 / tcount);
-	    double ntempo = 60 / (timestamp - _prev_beatstamp);
-	    ntempo = avg_tempo(ntempo);
+	    // calc new tempo, only small changes are taken as jitter
+	    double ntempo = _midi_clock_tempo;
 
-	    if (TEMPO_DIFF(ntempo, _tempo)) {
-	      //cerr << "new tempo is: " << ntempo << "   tcount = " << tcount << " frag: " << fragpos << "  used: " << usedframes << " delta: " << (timestamp - _prev_beatstamp) << endl;
+	    if (fabs (ntempo - _tempo) > MIDI_CLOCK_TEMPO_TOLERANCE) {
+	      //cerr << "new tempo is: " << ntempo << " frag: " << fragpos << "  used: " << usedframes << endl;
 
 	      set_tempo(ntempo, true);
 	      _tempo_changed = true;
@@ -2480,18 +3190,18 @@ Engine::generate_sync (nframes_t offset, nframes_t nframes)
 	      pthread_cond_signal (&_event_cond);
 	    }
 
-	    _quarter_counter = - ((double)usedframes);
 	    _prev_beatstamp = timestamp;
 	  }
 
-	  if ((_midi_ticks % _midi_loop_tick) == 0) {
-	    //cerr << "GOT SYNC TICK at " << fragpos << endl;
+	  // zero sync before this event
+	  doframes = pulsepos - usedframes;
+	  memset (&(_internal_sync_buf[usedframes]), 0, doframes * sizeof(float));
 
-	    // zero sync before this event
-	    memset (&(_internal_sync_buf[usedframes]), 0, doframes * sizeof(float));
+	  if (loopsync && pulsepos < nframes) {
+	    //cerr << "GOT SYNC TICK at " << pulsepos << endl;
 
 	    // mark it high
-	    _internal_sync_buf[fragpos] = 2.0f;
+	    _internal_sync_buf[pulsepos] = 2.0f;
 
 	    doframes += 1;
 
@@ -2501,8 +3211,10 @@ Engine::generate_sync (nframes_t offset, nframes_t nframes)
 	  usedframes += doframes;
 	}
 
-      // advance events
-      _sync_queue->increment_read_ptr (vec.len[0] + vec.len[1]);
+      // advance past the ones used, the rest are for later cycles
+      _sync_queue->increment_read_ptr (used);
+
+      emit_pending_pulses (nframes, usedframes, hit_at);
 
       // zero the rest
       memset (&(_internal_sync_buf[usedframes]), 0, (nframes - usedframes) * sizeof(float));
@@ -2510,8 +3222,10 @@ Engine::generate_sync (nframes_t offset, nframes_t nframes)
       _quarter_counter += (double) nframes;
     }
     else {
-      // no sync events... all zero
-      memset (_internal_sync_buf, 0, nframes * sizeof(float));
+      // no sync events... all zero, but for ones put off from before
+      nframes_t usedframes = 0;
+      emit_pending_pulses (nframes, usedframes, hit_at);
+      memset (&(_internal_sync_buf[usedframes]), 0, (nframes - usedframes) * sizeof(float));
       _quarter_counter += (double) nframes;
     }
 
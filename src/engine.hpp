@@ -32,12 +32,17 @@
 #include "audio_driver.hpp"
 #include "midi_bind.hpp"
 #include "command_map.hpp"
+#include "state_snapshot.hpp"
+#include "frame_scheduler.hpp"
+#include "tempo_dll.hpp"
+#include "midi_latency.hpp"
 
 namespace SooperLooper {
 
 class Looper;
 class ControlOSC;
 class MidiBridge;
+class ShmState;
 	
 class Engine
 	: public sigc::trackable
@@ -46,6 +51,7 @@ class Engine
 
 	static const int TEMPO_WINDOW_SIZE = 4;
 	static const int TEMPO_WINDOW_SIZE_MASK = 3;
+	static const int MAX_PENDING_PULSES = 8;
 	
 	Engine();
 	virtual ~Engine();
@@ -58,9 +64,14 @@ class Engine
 
 	void set_default_loop_secs (float secs) { _def_loop_secs = secs; }
 	void set_default_channels (int chan) { _def_channel_cnt = chan; }
+	// also accept OSC over TCP, on the same port number.  must be set before initialize()
+	void set_osc_tcp (bool flag) { _osc_tcp = flag; }
 	
 	void set_midi_bridge (MidiBridge * bridge);
 	MidiBridge * get_midi_bridge() { return _midi_bridge; }
+
+	// how long midi input takes to get to the audio, since startup
+	const MidiLatency & get_midi_latency() const { return _midi_latency; }
 	
 	bool is_ok() const { return _ok; }
 
@@ -96,14 +107,30 @@ class Engine
 	
 	EventGenerator & get_event_generator() { return *_event_generator;}
 
-	bool push_command_event (Event::type_t type, Event::command_t cmd, int8_t instance);
-	void push_control_event (Event::type_t type, Event::control_t ctrl, float val, int8_t instance, int src=0);
+	// a non-zero when (wall clock, see EventGenerator) holds the event until that moment
+	bool push_command_event (Event::type_t type, Event::command_t cmd, int8_t instance, EventGenerator::time_stamp_t when=0);
+	void push_control_event (Event::type_t type, Event::control_t ctrl, float val, int8_t instance, int src=0, EventGenerator::time_stamp_t when=0);
 
 	void push_midi_command_event (Event::type_t type, Event::command_t cmd, int8_t instance, long framepos=-1);
 	void push_midi_control_event (Event::type_t type, Event::control_t ctrl, float val, int8_t instance, long framepos=-1);
 	
-	void push_sync_event (Event::control_t ctrl, long framepos=-1, MIDI::timestamp_t timestamp=0);
+	void push_sync_event (Event::control_t ctrl, long framepos=-1, MIDI::timestamp_t timestamp=0, double device_delay=0.0);
+
+	struct ControlChange
+	{
+		ControlChange (int8_t inst, Event::control_t ctl, float val) : instance(inst), ctrl(ctl), value(val) {}
+
+		int8_t           instance;
+		Event::control_t ctrl;
+		float            value;
+	};
+
+	// all or nothing, the changes are applied together in the same process cycle
+	bool push_control_batch (const std::vector<ControlChange> & changes, int src=0, EventGenerator::time_stamp_t when=0);
 	
+	// export loop state to the named POSIX shared memory segment, see sl_shm.h
+	bool set_shm_name (std::string name);
+
 	std::string get_osc_url (bool udp=true);
 	int get_osc_port ();
 
@@ -121,6 +148,9 @@ class Engine
 	void mainloop();
 	
 	bool push_nonrt_event (EventNonRT * event);
+
+	// events waiting for the rt thread to pick up
+	size_t get_event_queue_depth () { return _event_queue->read_space(); }
 	
 	void binding_learned(MidiBindInfo info);
 	void next_midi_received(MidiBindInfo info);
@@ -157,6 +187,7 @@ class Engine
 	
 	// returns >= 0 offset position on tempo beats
 	int generate_sync (nframes_t offset, nframes_t nframes);
+	void emit_pending_pulses (nframes_t upto, nframes_t & usedframes, int & hit_at);
 	
 	void update_sync_source ();
 	void calculate_tempo_frames ();
@@ -164,8 +195,13 @@ class Engine
 
 	void do_global_rt_event (Event * ev, nframes_t offset, nframes_t nframes);
 
-	bool do_push_command_event (RingBuffer<Event> * rb, Event::type_t type, Event::command_t cmd, int8_t instance, long framepos=-1);
-	bool do_push_control_event (RingBuffer<Event> * rb, Event::type_t type, Event::control_t ctrl, float val, int8_t instance, long framepos=-1, int src=0);
+	bool do_push_command_event (RingBuffer<Event> * rb, Event::type_t type, Event::command_t cmd, int8_t instance, long framepos=-1,
+				    EventGenerator::time_stamp_t when=0, const Event::MidiStamp * stamp=0);
+	bool do_push_control_event (RingBuffer<Event> * rb, Event::type_t type, Event::control_t ctrl, float val, int8_t instance, long framepos=-1, int src=0,
+				    EventGenerator::time_stamp_t when=0, const Event::MidiStamp * stamp=0);
+
+	// a midi event applied at fragpos in the cycle that dequeued it
+	void record_midi_latency (const Event & evt, double dequeued, int fragpos);
 
 	bool push_loop_manage_to_rt (LoopManageEvent & lme);
 	bool push_loop_manage_to_main (LoopManageEvent & lme);
@@ -180,8 +216,32 @@ class Engine
 
 	void connections_changed();
 
+	void update_state_snapshot();
+	void update_frame_epoch ();
+	void drain_timed_events ();
+	void drain_shm_commands ();
+	void fire_due_events (nframes_t nframes);
+	bool read_state_snapshot (Event::control_t ctrl, int instance, float & val) const;
+
 	void handle_load_session_event();
 
+	// control updates from the rt thread not yet sent, only the latest value
+	// for each instance and control is kept.  non-rt thread only
+	struct PendingUpdate
+	{
+		PendingUpdate (int inst, Event::control_t ctl, float val, int src)
+			: instance(inst), control(ctl), value(val), source(src) {}
+
+		int              instance;
+		Event::control_t control;
+		float            value;
+		int              source;
+	};
+	std::vector<PendingUpdate> _pending_updates;
+
+	void coalesce_update (int instance, Event::control_t ctrl, float val, int src);
+	void send_pending_updates ();
+
 	
 	AudioDriver * _driver;
 	
@@ -197,6 +257,13 @@ class Engine
 	Instances _instances;
 	PBD::NonBlockingLock _instance_lock;
 
+	// rt state published each cycle for the non-rt readers
+	SeqLockBuffer<EngineStateSnapshot> _state_snapshot;
+
+	// optional shared memory copy of the same
+	ShmState * _shm_state;
+	unsigned int _shm_peaks_loop; // next loop whose overview is refreshed
+
 	// looper (de)allocation event
 	RingBuffer<LoopManageEvent> * _loop_manage_to_rt_queue;
 	RingBuffer<LoopManageEvent> * _loop_manage_to_main_queue;
@@ -212,6 +279,11 @@ class Engine
 	// RT event queue
 	RingBuffer<Event> * _event_queue;
 	RingBuffer<Event> * _midi_event_queue;
+	// events held for a given time, and the wheel they wait in until their frame
+	RingBuffer<Event> * _timed_event_queue;
+	FrameScheduler<Event> * _scheduler;
+	// scheduled events due in the current cycle
+	RingBuffer<Event> * _due_event_queue;
 	RingBuffer<Event> * _sync_queue;
 	RingBuffer<Event> * _nonrt_update_event_queue;
 
@@ -226,6 +298,7 @@ class Engine
 
 	int _def_channel_cnt;
 	float _def_loop_secs;
+	bool  _osc_tcp;
 	nframes_t _buffersize;
 	
 	// global parameters
@@ -294,7 +367,32 @@ class Engine
 	unsigned int _midi_ticks;     // counts ticks as they're coming in
 	unsigned int _midi_loop_tick; // tick number to loop (sync) on
 
+	// follows the incoming midi clock, rt thread only
+	TempoDll _clock_dll;
+	// what it last said, for the non-rt side
+	volatile bool   _midi_clock_locked;
+	volatile double _midi_clock_tempo;
+
+	// midi clock pulses whose filtered time fell past the end of the
+	// cycle they were worked out in, rt thread only
+	struct PendingPulse
+	{
+		uint64_t frame;     // absolute, on _frame_clock
+		bool     loopsync;  // marks the sync buffer
+		bool     quarter;   // counts as a beat
+	};
+	PendingPulse _pending_pulses[MAX_PENDING_PULSES];
+	int          _pending_pulse_count;
+
+	// from midi input to the frame it's applied at, added to by the rt thread
+	MidiLatency _midi_latency;
+
 	nframes_t _running_frames;
+	// same, but never wraps
+	uint64_t  _frame_clock;
+	// wall clock time of frame 0, smoothed
+	double    _frame_epoch;
+	bool      _frame_epoch_valid;
 	nframes_t _last_tempo_frame;
 	volatile bool _tempo_changed;
 	volatile bool _beat_occurred;
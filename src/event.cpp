@@ -104,7 +104,7 @@ namespace SooperLooper {
      * Will be called by an EventGenerator to create a new Event.
      */
     Event::Event(EventGenerator* pGenerator, time_stamp_t Time)
-      : Type(type_cmd_down),Command(UNKNOWN),Control(Unknown),Instance(0), Value(0)
+      : Type(type_cmd_down),Command(UNKNOWN),Control(Unknown),Instance(0), Value(0), batch(0), Stamp()
       {
         pEventGenerator = pGenerator;
         TimeStamp       = Time;
@@ -112,9 +112,10 @@ namespace SooperLooper {
     }
 
     Event::Event(EventGenerator* pGenerator, int fragmentpos)
-      : Type(type_cmd_down),Command(UNKNOWN),Control(Unknown),Instance(0), Value(0)
+      : Type(type_cmd_down),Command(UNKNOWN),Control(Unknown),Instance(0), Value(0), batch(0), Stamp()
     {
         pEventGenerator = pGenerator;
+        TimeStamp       = 0;
         iFragmentPos    = fragmentpos;
     }
 
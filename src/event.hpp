@@ -42,6 +42,12 @@ namespace SooperLooper {
     Event createEvent(long fragTime=-1);
     Event createTimestampedEvent(time_stamp_t timeStamp);
 
+    /// Real time stamp of the beginning of the current audio fragment cycle.
+    time_stamp_t fragmentStartTime() const { return fragmentTime.end; }
+
+    /// Real time stamp for the current moment, on the clock all of these use.
+    time_stamp_t createTimeStamp();
+
   protected:
 
     inline uint32_t toFragmentPos(time_stamp_t timeStamp) {
@@ -59,8 +65,6 @@ namespace SooperLooper {
       double        sample_ratio; ///< (Samples per cycle) / (Real time duration of cycle)
     } fragmentTime;
 
-    time_stamp_t createTimeStamp();
-
   };
 
   /**
@@ -73,7 +77,7 @@ namespace SooperLooper {
   class Event {
   public:
 
-    Event() : Type(type_t::type_cmd_down),Command(UNKNOWN),Control(Unknown),Instance(0), Value(0) {}
+    Event() : Type(type_t::type_cmd_down),Command(UNKNOWN),Control(Unknown),Instance(0), Value(0), batch(0), Stamp() {}
 
     enum type_t {
       type_cmd_down,
@@ -231,11 +235,26 @@ namespace SooperLooper {
       return (int) (iFragmentPos = pEventGenerator->toFragmentPos(TimeStamp));
     }
 
+    // for events the engine has already placed in the fragment
+    void setFragmentPos(int pos) { iFragmentPos = pos; }
+
     typedef EventGenerator::time_stamp_t timestamp_t;
     EventGenerator::time_stamp_t getTimestamp() const { return TimeStamp; }
 
     int source;
 
+    /// On the first event of a timed batch, how many events (itself
+    /// included) must be applied in the same cycle.  0 for any other event.
+    int batch;
+
+    /// How a midi event got here, for the latency stats (see midi_latency.hpp).
+    /// Times are on the monotonic clock, received is 0 for anything but midi.
+    struct MidiStamp {
+      double device_delay;  ///< port timestamp to the bridge reading it, 0 if unknown
+      double received;      ///< when the bridge read it
+      double queued;        ///< when it went on the engine's midi queue
+    } Stamp;
+
   protected:
     typedef EventGenerator::time_stamp_t time_stamp_t;
     Event(EventGenerator* pGenerator, EventGenerator::time_stamp_t Time);
@@ -0,0 +1,134 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#include <new>
+#include <cstdlib>
+
+#include "event_nonrt.hpp"
+#include "lockmonitor.hpp"
+
+using namespace SooperLooper;
+using namespace PBD;
+
+// same depth as the engine's nonrt event queue
+#define NONRT_POOL_EVENTS 1024
+
+namespace {
+
+	template <size_t A, size_t B>
+	struct max_size { static const size_t value = A > B ? A : B; };
+
+	// large enough for any of the EventNonRT subclasses
+	const size_t nonrt_block_size =
+		max_size<sizeof(ConfigLoopEvent),
+		max_size<sizeof(SessionEvent),
+		max_size<sizeof(LoopFileEvent),
+		max_size<sizeof(GetParamEvent),
+		max_size<sizeof(GetManyEvent),
+		max_size<sizeof(GetPeaksEvent),
+		max_size<sizeof(GetMidiLatencyEvent),
+		max_size<sizeof(ConfigUpdateEvent),
+		max_size<sizeof(PingEvent),
+		max_size<sizeof(RegisterConfigEvent),
+		max_size<sizeof(GlobalGetEvent),
+		max_size<sizeof(GlobalSetEvent),
+		         sizeof(MidiBindingEvent)
+		>::value>::value>::value>::value>::value>::value>::value>::value>::value>::value>::value>::value;
+
+	class EventNonRTPool
+	{
+	  public:
+		EventNonRTPool (size_t block_size, size_t count)
+			: _count(count), _free_count(count)
+		{
+			// keep every block suitably aligned for any member type
+			_block_size = (block_size + 15) & ~((size_t) 15);
+			_blocks = (char *) malloc (_block_size * _count);
+			_free = new void * [_count];
+
+			for (size_t n = 0; n < _count; ++n) {
+				_free[n] = _blocks + (n * _block_size);
+			}
+		}
+
+		void * alloc (size_t sz)
+		{
+			if (sz <= _block_size) {
+				LockMonitor lm (_lock, __LINE__, __FILE__);
+				if (_free_count > 0) {
+					return _free[--_free_count];
+				}
+			}
+			return 0;
+		}
+
+		bool release (void * ptr)
+		{
+			char * cptr = (char *) ptr;
+
+			if (cptr < _blocks || cptr >= _blocks + (_block_size * _count)) {
+				// not one of ours
+				return false;
+			}
+
+			LockMonitor lm (_lock, __LINE__, __FILE__);
+			_free[_free_count++] = ptr;
+			return true;
+		}
+
+	  private:
+		char *  _blocks;
+		void ** _free;
+		size_t  _block_size;
+		size_t  _count;
+		size_t  _free_count;
+
+		Lock    _lock;
+	};
+
+	EventNonRTPool & nonrt_pool()
+	{
+		// never destroyed, events may still be freed during static destruction
+		static EventNonRTPool * pool = new EventNonRTPool (nonrt_block_size, NONRT_POOL_EVENTS);
+		return *pool;
+	}
+}
+
+void *
+EventNonRT::operator new (size_t sz)
+{
+	void * ptr = nonrt_pool().alloc (sz);
+
+	if (!ptr) {
+		// pool is exhausted, use the heap
+		ptr = ::operator new (sz);
+	}
+
+	return ptr;
+}
+
+void
+EventNonRT::operator delete (void * ptr)
+{
+	if (!ptr) return;
+
+	if (!nonrt_pool().release (ptr)) {
+		::operator delete (ptr);
+	}
+}
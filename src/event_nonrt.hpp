@@ -23,14 +23,30 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "event.hpp"
+#include "inline_string.hpp"
 
 namespace SooperLooper {
 
+	// return urls and paths fit inline, so queueing an event doesn't hit the heap
+	typedef InlineString<64> EventString;
+
+	/*
+	 * Non-rt events are allocated by the OSC thread and freed by the
+	 * main loop at a high rate, so they are carved out of a fixed
+	 * capacity pool of blocks instead of the general heap.  If the pool
+	 * is exhausted (or a subclass outgrows the block size) we fall back
+	 * to the regular allocator.
+	 */
 	class EventNonRT {
 	public:
 		virtual ~EventNonRT() {}
+
+		static void * operator new (size_t sz);
+		static void operator delete (void * ptr);
+
 	protected:
 		EventNonRT() {};
 		
@@ -65,15 +81,15 @@ namespace SooperLooper {
 			Save
 		} type;
 
-		SessionEvent(Type tp, std::string fname, std::string returl, std::string retpath, bool audio=false) 
+		SessionEvent(Type tp, std::string fname, const EventString & returl, const EventString & retpath, bool audio=false) 
 			: type(tp), filename(fname), write_audio(audio), ret_url(returl), ret_path(retpath) {}
 
 		virtual ~SessionEvent() {}
 
 		std::string      filename;
 		bool             write_audio;
-		std::string      ret_url;
-		std::string      ret_path;
+		EventString      ret_url;
+		EventString      ret_path;
 	};
 
 	
@@ -100,7 +116,7 @@ namespace SooperLooper {
 		};
 	
 		
-		LoopFileEvent(Type tp, int inst, std::string fname, std::string returl, std::string retpath,
+		LoopFileEvent(Type tp, int inst, std::string fname, const EventString & returl, const EventString & retpath,
 			      FileFormat fmt=FormatFloat, Endian end=LittleEndian)
 			: type(tp), instance(inst), filename(fname), format(fmt), endian(end), ret_url(returl), ret_path(retpath) {}
 
@@ -110,25 +126,77 @@ namespace SooperLooper {
 		std::string      filename;
 		FileFormat       format;
 		Endian           endian;
-		std::string      ret_url;
-		std::string      ret_path;
+		EventString      ret_url;
+		EventString      ret_path;
 	};
 	
 	class GetParamEvent : public EventNonRT
 	{
 	public:
-		GetParamEvent( int8_t inst, Event::control_t ctrl, std::string returl, std::string retpath)
+		GetParamEvent( int8_t inst, Event::control_t ctrl, const EventString & returl, const EventString & retpath)
 			: control(ctrl), instance(inst), ret_url(returl), ret_path(retpath), ret_value(0.0f) {}
 		virtual ~GetParamEvent() {}
 		
 		Event::control_t       control;
 		int8_t           instance;
-		std::string      ret_url;
-		std::string      ret_path;
+		EventString      ret_url;
+		EventString      ret_path;
 
 		float            ret_value;
 	};
 
+	class GetManyEvent : public EventNonRT
+	{
+	public:
+		struct Item
+		{
+			Item (int8_t inst, Event::control_t ctrl) : control(ctrl), instance(inst), value(0.0f) {}
+
+			Event::control_t control;
+			int8_t           instance;
+			float            value;
+		};
+
+		GetManyEvent(const EventString & returl, const EventString & retpath)
+			: ret_url(returl), ret_path(retpath) {}
+		virtual ~GetManyEvent() {}
+
+		std::vector<Item> items;
+		EventString       ret_url;
+		EventString       ret_path;
+	};
+
+	class GetPeaksEvent : public EventNonRT
+	{
+	public:
+		GetPeaksEvent(int8_t inst, float startsecs, float lensecs, unsigned int npoints,
+			      const EventString & returl, const EventString & retpath)
+			: instance(inst), start(startsecs), length(lensecs), points(npoints),
+			  ret_url(returl), ret_path(retpath) {}
+		virtual ~GetPeaksEvent() {}
+
+		int8_t           instance;
+		float            start;
+		float            length;  // <= 0 means to the end of the loop
+		unsigned int     points;
+		EventString      ret_url;
+		EventString      ret_path;
+
+		// filled in per loop by the engine, points min,max pairs
+		std::vector<float> peaks;
+	};
+
+	class GetMidiLatencyEvent : public EventNonRT
+	{
+	public:
+		GetMidiLatencyEvent(const EventString & returl, const EventString & retpath)
+			: ret_url(returl), ret_path(retpath) {}
+		virtual ~GetMidiLatencyEvent() {}
+
+		EventString      ret_url;
+		EventString      ret_path;
+	};
+
 	class ConfigUpdateEvent : public EventNonRT
 	{
 	public:
@@ -143,11 +211,12 @@ namespace SooperLooper {
 			RegisterCmd,
 			UnregisterCmd,
 			SendCmd,
+			SetUpdateRate,  // value is the max updates per second, 0 for unlimited
 		} type;
 
-		ConfigUpdateEvent(Type tp, int8_t inst,  Event::control_t ctrl, std::string returl="", std::string retpath="",float val=0.0, int src=-1, short int ms=0)
+		ConfigUpdateEvent(Type tp, int8_t inst,  Event::control_t ctrl, const EventString & returl="", const EventString & retpath="",float val=0.0, int src=-1, short int ms=0)
 			: type(tp), control(ctrl), instance(inst), ret_url(returl), ret_path(retpath), value(val), source(src),update_time_ms(ms) {}
-		ConfigUpdateEvent(Type tp, int8_t inst,  Event::command_t cmd, std::string returl="", std::string retpath="", int src=-1)
+		ConfigUpdateEvent(Type tp, int8_t inst,  Event::command_t cmd, const EventString & returl="", const EventString & retpath="", int src=-1)
 			: type(tp), command(cmd), instance(inst), ret_url(returl), ret_path(retpath), value(0.0f), source(src) {}
 
 		virtual ~ConfigUpdateEvent() {}
@@ -156,8 +225,8 @@ namespace SooperLooper {
 		Event::control_t       control;
 		Event::command_t       command;
 		int8_t                 instance;
-		std::string            ret_url;
-		std::string            ret_path;
+		EventString            ret_url;
+		EventString            ret_path;
 		float                  value;
 		int                    source;
 		short int              update_time_ms;
@@ -166,13 +235,13 @@ namespace SooperLooper {
 	class PingEvent : public EventNonRT
 	{
 	public:
-		PingEvent(std::string returl, std::string retpath, bool useid)
+		PingEvent(const EventString & returl, const EventString & retpath, bool useid)
 			: ret_url(returl), ret_path(retpath), use_id(useid) {}
 
 		virtual ~PingEvent() {}
 
-		std::string  ret_url;
-		std::string  ret_path;
+		EventString  ret_url;
+		EventString  ret_path;
 		bool         use_id;
 	};
 
@@ -182,29 +251,32 @@ namespace SooperLooper {
 		enum Type
 		{
 			Register,
-			Unregister
+			Unregister,
+			RegisterDiff,
+			UnregisterDiff,
+			Resync
 		} type;
 
-		RegisterConfigEvent(Type tp, std::string returl, std::string retpath)
+		RegisterConfigEvent(Type tp, const EventString & returl, const EventString & retpath)
 			: type(tp), ret_url(returl), ret_path(retpath) {}
 
 		virtual ~RegisterConfigEvent() {}
 
-		std::string  ret_url;
-		std::string  ret_path;
+		EventString  ret_url;
+		EventString  ret_path;
 	};
 
 
 	class GlobalGetEvent : public EventNonRT
 	{
 	public:
-		GlobalGetEvent(std::string par, std::string returl, std::string retpath)
+		GlobalGetEvent(std::string par, const EventString & returl, const EventString & retpath)
 			: param(par), ret_url(returl), ret_path(retpath), ret_value(0.0f) {}
 		virtual ~GlobalGetEvent() {}
 		
 		std::string      param;
-		std::string      ret_url;
-		std::string      ret_path;
+		EventString      ret_url;
+		EventString      ret_path;
 
 		float            ret_value;
 	};
@@ -237,15 +309,15 @@ namespace SooperLooper {
 			CancelGetNext
 		} type;
 
-		MidiBindingEvent(Type tp, std::string bindstr, std::string opt, std::string returl="", std::string retpath="")
+		MidiBindingEvent(Type tp, std::string bindstr, std::string opt, const EventString & returl="", const EventString & retpath="")
 			: type(tp), bind_str(bindstr), options(opt), ret_url(returl), ret_path(retpath) {}
 		MidiBindingEvent() {}
 		virtual ~MidiBindingEvent() {}
 		
 		std::string      bind_str;
 		std::string      options;
-		std::string      ret_url;
-		std::string      ret_path;
+		EventString      ret_url;
+		EventString      ret_path;
 	};
 	
 	
@@ -0,0 +1,171 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_frame_scheduler__
+#define __sooperlooper_frame_scheduler__
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace SooperLooper {
+
+/*
+ * Hashed timer wheel keyed by absolute engine frame.  Each slot covers
+ * SlotFrames frames and keeps its items sorted by frame, items more than
+ * one revolution out just sit at the back of their slot until their turn.
+ * Popping walks the slots of the current cycle in order, so items come
+ * out sorted by frame.
+ *
+ * All the memory is allocated up front, it is meant to be used only
+ * from the rt thread.
+ */
+template <class T>
+class FrameScheduler
+{
+  public:
+	enum {
+		SlotBits   = 8,
+		SlotFrames = 1 << SlotBits,
+		SlotCount  = 1024
+	};
+
+	FrameScheduler (size_t capacity)
+		: _capacity(capacity), _next_frame(0)
+	{
+		_nodes = new Node[_capacity];
+		for (size_t n = 0; n < _capacity; ++n) {
+			_nodes[n].next = (n + 1 < _capacity) ? &_nodes[n + 1] : 0;
+		}
+		_free = _capacity ? _nodes : 0;
+		_free_count = _capacity;
+
+		for (size_t n = 0; n < SlotCount; ++n) {
+			_slots[n] = 0;
+		}
+	}
+
+	~FrameScheduler() { delete [] _nodes; }
+
+	// items for frames already passed are due at the start of the next cycle.
+	// returns false if it is full
+	bool schedule (uint64_t frame, const T & item) {
+		if (!_free) {
+			return false;
+		}
+
+		if (frame < _next_frame) {
+			frame = _next_frame;
+		}
+
+		Node * node = _free;
+		_free = node->next;
+		--_free_count;
+		node->frame = frame;
+		node->item = item;
+
+		// after any others for the same frame, so order of arrival is kept
+		Node ** pos = &_slots[slot_of (frame)];
+		while (*pos && (*pos)->frame <= frame) {
+			pos = &(*pos)->next;
+		}
+		node->next = *pos;
+		*pos = node;
+
+		return true;
+	}
+
+	// the next item due before end, in frame order.  once this returns
+	// false, end becomes the start of the next cycle.
+	bool pop_due (uint64_t end, uint64_t & frame, T & item) {
+		Node ** head = find_due (end);
+
+		if (!head) {
+			return false;
+		}
+
+		Node * node = *head;
+		*head = node->next;
+
+		frame = node->frame;
+		item = node->item;
+
+		node->next = _free;
+		_free = node;
+		++_free_count;
+		return true;
+	}
+
+	// the item pop_due would return next, left in place, or 0
+	const T * peek_due (uint64_t end) {
+		Node ** head = find_due (end);
+		return head ? &(*head)->item : 0;
+	}
+
+	// how many more items fit
+	size_t free_space() const { return _free_count; }
+
+	uint64_t next_frame() const { return _next_frame; }
+
+  private:
+
+	struct Node {
+		uint64_t frame;
+		T        item;
+		Node *   next;
+	};
+
+	static size_t slot_of (uint64_t frame) { return (size_t) ((frame >> SlotBits) & (SlotCount - 1)); }
+
+	// the list head holding the next item due before end, or 0 when
+	// there is none, and then end becomes the start of the next cycle
+	Node ** find_due (uint64_t end) {
+		uint64_t first = _next_frame >> SlotBits;
+		uint64_t last  = (end - 1) >> SlotBits;
+
+		if (end <= _next_frame) {
+			return 0;
+		}
+		if (last - first >= SlotCount) {
+			first = last - SlotCount + 1;
+		}
+
+		for (uint64_t s = first; s <= last; ++s) {
+			Node ** head = &_slots[s & (SlotCount - 1)];
+
+			if (*head && (*head)->frame < end) {
+				return head;
+			}
+		}
+
+		_next_frame = end;
+		return 0;
+	}
+
+	Node *  _nodes;
+	Node *  _free;
+	size_t  _free_count;
+	size_t  _capacity;
+	Node *  _slots[SlotCount];
+
+	uint64_t _next_frame;
+};
+
+} // namespace SooperLooper
+
+#endif
@@ -0,0 +1,88 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_inline_string__
+#define __sooperlooper_inline_string__
+
+#include <string>
+#include <cstring>
+
+namespace SooperLooper {
+
+/*
+ * A string that keeps up to N-1 characters inline and only touches the
+ * heap for longer contents.  Used for the return urls and paths carried
+ * by the non-rt events so that passing one through the event queue
+ * doesn't allocate.
+ */
+template <size_t N>
+class InlineString
+{
+  public:
+	InlineString() : _heap(0), _len(0) { _buf[0] = '\0'; }
+	InlineString(const char * str) : _heap(0), _len(0) { assign (str, strlen(str)); }
+	InlineString(const std::string & str) : _heap(0), _len(0) { assign (str.data(), str.size()); }
+	InlineString(const InlineString & other) : _heap(0), _len(0) { assign (other.c_str(), other._len); }
+
+	~InlineString() { delete [] _heap; }
+
+	InlineString & operator= (const InlineString & other) {
+		if (&other != this) {
+			assign (other.c_str(), other._len);
+		}
+		return *this;
+	}
+	InlineString & operator= (const std::string & str) { assign (str.data(), str.size()); return *this; }
+	InlineString & operator= (const char * str) { assign (str, strlen(str)); return *this; }
+
+	operator std::string () const { return std::string (c_str(), _len); }
+
+	const char * c_str() const { return _heap ? _heap : _buf; }
+	size_t size() const { return _len; }
+	size_t length() const { return _len; }
+	bool empty() const { return _len == 0; }
+
+	bool operator== (const InlineString & other) const {
+		return _len == other._len && memcmp (c_str(), other.c_str(), _len) == 0;
+	}
+	bool operator!= (const InlineString & other) const { return !(*this == other); }
+
+  private:
+
+	void assign (const char * str, size_t len) {
+		delete [] _heap;
+		_heap = 0;
+
+		char * dest = _buf;
+		if (len >= N) {
+			dest = _heap = new char[len + 1];
+		}
+		memcpy (dest, str, len);
+		dest[len] = '\0';
+		_len = len;
+	}
+
+	char * _heap;
+	size_t _len;
+	char   _buf[N];
+};
+
+} // namespace SooperLooper
+
+#endif
@@ -17,10 +17,15 @@
 **  
 */
 
+#include <config.h>
+
 #include <string>
 #include <iostream>
 
 #include <jack/jack.h>
+#ifdef HAVE_JACK_MIDI
+#include <jack/midiport.h>
+#endif
 
 #include "jack_audio_driver.hpp"
 #include "engine.hpp"
@@ -33,6 +38,10 @@ JackAudioDriver::JackAudioDriver(string client_name, string serv_name)
 	: AudioDriver(client_name, serv_name)
 {
 	_timebase_master = false;
+	_midi_input = 0;
+	_midi_output = 0;
+	_midi_input_buf = 0;
+	_midi_output_buf = 0;
 }
 
 JackAudioDriver::~JackAudioDriver()
@@ -224,6 +233,14 @@ JackAudioDriver::_process_callback (jack_nframes_t nframes, void* arg)
 int
 JackAudioDriver::process_callback (jack_nframes_t nframes)
 {
+#ifdef HAVE_JACK_MIDI
+	if (_midi_input) {
+		_midi_input_buf = jack_port_get_buffer (_midi_input, nframes);
+		_midi_output_buf = jack_port_get_buffer (_midi_output, nframes);
+		jack_midi_clear_buffer (_midi_output_buf);
+	}
+#endif
+
 	if (_engine) {
 		_engine->process (nframes);
 	}
@@ -338,6 +355,70 @@ JackAudioDriver::get_output_port_buffer (port_id_t port, nframes_t nframes)
 	return (sample_t*) jack_port_get_buffer (_output_ports[port-1], nframes);	
 }
 
+bool
+JackAudioDriver::create_midi_ports (std::string inname, std::string outname)
+{
+#ifdef HAVE_JACK_MIDI
+	if (!_jack) return false;
+
+	jack_port_t * inport;
+	jack_port_t * outport;
+
+	if ((inport = jack_port_register (_jack, inname.c_str(), JACK_DEFAULT_MIDI_TYPE,
+					  JackPortIsInput, 0)) == 0) {
+		cerr << "JackAudioDriver: cannot register midi input port" << endl;
+		return false;
+	}
+
+	if ((outport = jack_port_register (_jack, outname.c_str(), JACK_DEFAULT_MIDI_TYPE,
+					   JackPortIsOutput, 0)) == 0) {
+		cerr << "JackAudioDriver: cannot register midi output port" << endl;
+		jack_port_unregister (_jack, inport);
+		return false;
+	}
+
+	// the process callback goes by the input port
+	_midi_output = outport;
+	_midi_input = inport;
+
+	return true;
+#else
+	cerr << "JackAudioDriver: built without JACK midi support" << endl;
+	return false;
+#endif
+}
+
+bool
+JackAudioDriver::get_midi_input_event (unsigned int index, nframes_t & offset, const unsigned char *& data, size_t & size)
+{
+#ifdef HAVE_JACK_MIDI
+	jack_midi_event_t event;
+
+	if (!_midi_input_buf || jack_midi_event_get (&event, _midi_input_buf, index) != 0) {
+		return false;
+	}
+
+	offset = event.time;
+	data = event.buffer;
+	size = event.size;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool
+JackAudioDriver::write_midi_output_event (nframes_t offset, const unsigned char * data, size_t size)
+{
+#ifdef HAVE_JACK_MIDI
+	if (!_midi_output_buf) return false;
+
+	return (jack_midi_event_write (_midi_output_buf, offset, data, size) == 0);
+#else
+	return false;
+#endif
+}
+
 nframes_t
 JackAudioDriver::get_input_port_latency (port_id_t port)
 {
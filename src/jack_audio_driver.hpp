@@ -57,6 +57,12 @@ class JackAudioDriver
 
 	nframes_t get_input_port_latency (port_id_t portid);
 	nframes_t get_output_port_latency (port_id_t portid);
+
+	bool create_midi_ports (std::string inname, std::string outname);
+	bool has_midi_ports () { return _midi_input != 0; }
+
+	bool get_midi_input_event (unsigned int index, nframes_t & offset, const unsigned char *& data, size_t & size);
+	bool write_midi_output_event (nframes_t offset, const unsigned char * data, size_t size);
 	
 	bool get_transport_info (TransportInfo &info);
 	void set_transport_info (const TransportInfo &info);
@@ -65,6 +71,8 @@ class JackAudioDriver
 	bool get_timebase_master() { return _timebase_master; }
 
 	void reposition_transport(nframes_t framepos);
+
+	nframes_t get_frames_since_cycle_start() { return _jack ? jack_frames_since_cycle_start (_jack) : 0; }
 	
   protected:
 
@@ -97,6 +105,12 @@ class JackAudioDriver
 	std::vector<jack_port_t *> _input_ports;
 	std::vector<jack_port_t *> _output_ports;
 
+	jack_port_t * volatile _midi_input;
+	jack_port_t * volatile _midi_output;
+	// fetched at the start of each cycle
+	void * _midi_input_buf;
+	void * _midi_output_buf;
+
 	bool _timebase_master;
 	TransportInfo _transport_info;
 
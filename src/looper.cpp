@@ -62,6 +62,15 @@ static const double MinResamplingRate = 0.25f;
 static const double MaxResamplingRate = 8.0f;
 static const int SrcAudioQuality = SRC_LINEAR;
 
+const Event::control_t Looper::tracked_outputs[Looper::TrackedOutputCount] = {
+	Event::State,
+	Event::Waiting,
+	Event::LoopPosition,
+	Event::LoopLength,
+	Event::CycleLength,
+	Event::FreeTime
+};
+
 
 Looper::Looper (AudioDriver * driver, unsigned int index, unsigned int chan_count, float loopsecs, bool discrete)
 	: _driver (driver), _index(index), _chan_count(chan_count), _loopsecs(loopsecs)
@@ -97,6 +106,11 @@ Looper::initialize (unsigned int index, unsigned int chan_count, float loopsecs,
 	requested_cmd = -1;
 	last_requested_cmd = -1;
 	request_pending = false;
+	_changed_outputs = 0;
+	for (int n=0; n < TrackedOutputCount; ++n) {
+		// force everything to be published after the first run
+		_published_outputs[n] = -1.0f;
+	}
 	_input_ports = 0;
 	_output_ports = 0;
 	_instances = 0;
@@ -653,6 +667,22 @@ bool Looper::has_loop() const
 	return (_instances && _instances[0] && sl_has_loop(_instances[0]));
 }
 
+bool
+Looper::get_peaks (float * minmax, unsigned int points, nframes_t loop_offset, nframes_t frames, bool exact)
+{
+	if (!_instances || !_instances[0]) return false;
+
+	if (!sl_get_loop_peaks (_instances[0], minmax, points, loop_offset, frames, false, exact)) {
+		return false;
+	}
+
+	for (unsigned int i=1; i < _chan_count; ++i) {
+		sl_get_loop_peaks (_instances[i], minmax, points, loop_offset, frames, true, exact);
+	}
+
+	return true;
+}
+
 float
 Looper::get_control_value (Event::control_t ctrl)
 {
@@ -739,6 +769,17 @@ Looper::get_control_value (Event::control_t ctrl)
 	return 0.0f;
 }
 
+void
+Looper::fill_state_snapshot (LoopStateSnapshot & snap) const
+{
+	snap.looper = this;
+	memcpy (snap.ports, ports, sizeof(snap.ports));
+	snap.dry = _target_dry;
+	snap.input_gain = _curr_input_gain;
+	snap.in_peak = _input_peak;
+	snap.out_peak = _output_peak;
+}
+
 void Looper::set_port (ControlPort n, float val)
 {
 	switch ((int)n)
@@ -1091,6 +1132,27 @@ Looper::run (nframes_t offset, nframes_t nframes)
 	}
 */
 	ports[Sync] = oldsync;
+
+	update_changed_outputs();
+}
+
+void
+Looper::update_changed_outputs ()
+{
+	// this is the audio thread
+	uint32_t changed = 0;
+
+	for (int n=0; n < TrackedOutputCount; ++n) {
+		LADSPA_Data val = ports[tracked_outputs[n]];
+		if (val != _published_outputs[n]) {
+			_published_outputs[n] = val;
+			changed |= (1 << n);
+		}
+	}
+
+	if (changed) {
+		__sync_fetch_and_or (&_changed_outputs, changed);
+	}
 }
 
 
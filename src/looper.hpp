@@ -38,6 +38,7 @@
 #include "event.hpp"
 #include "event_nonrt.hpp"
 #include "utils.hpp"
+#include "state_snapshot.hpp"
 
 #include <pbd/xml++.h>
 
@@ -108,18 +109,39 @@ class Looper
 	bool is_muted() const { return ports[State] == LooperStateMuted || ports[State] == LooperStateOffMuted; }
 	bool has_loop() const ;
 
+	// fills points min,max pairs over frames of the loop from loop_offset, all
+	// channels combined.  returns false if there is no loop.  RT-safe, and the
+	// cost depends only on points.  exact reads the samples for points narrower
+	// than a peak bin (see sl_get_loop_peaks), which the rt thread shouldn't ask for.
+	bool get_peaks (float * minmax, unsigned int points, nframes_t loop_offset, nframes_t frames, bool exact=false);
+
 	// finishes any active state that may be going (rec, overdub, etc)
 	bool finish_state();
 	
 	bool is_longpress (int command);
 
+	// copies the rt owned values, called from the rt thread
+	void fill_state_snapshot (LoopStateSnapshot & snap) const;
+
 	XMLNode& get_state () const;
 	int set_state (const XMLNode&);
 
 	void recompute_latencies();
+
+	// read-only controls whose changes are published to the non-rt thread
+	enum { TrackedOutputCount = 6 };
+	static const Event::control_t tracked_outputs[TrackedOutputCount];
+
+	// returns which of the tracked outputs in mask (bit n is tracked_outputs[n])
+	// changed since the last call, and clears them. called from the non-rt thread.
+	uint32_t take_changed_outputs (uint32_t mask) {
+		return __sync_fetch_and_and (&_changed_outputs, ~mask) & mask;
+	}
 	
   protected:
 
+	void update_changed_outputs ();
+
 	void run_loops (nframes_t offset, nframes_t nframes);
 	void run_loops_resampled (nframes_t offset, nframes_t nframes);
 
@@ -224,6 +246,10 @@ class Looper
 	bool _ok;
 	volatile bool request_pending;
 
+	// rt thread sets bits here for tracked outputs that differ from the last published value
+	volatile uint32_t   _changed_outputs;
+	LADSPA_Data         _published_outputs[TrackedOutputCount];
+
 	PBD::NonBlockingLock _loop_lock;
 };
 
@@ -18,11 +18,16 @@
 */
 
 
+#include <config.h>
+
 #include "midi_bridge.hpp"
 
 #include <sys/poll.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include <iostream>
 #include <cstdio>
@@ -35,6 +40,7 @@
 
 #include "command_map.hpp"
 #include "utils.hpp"
+#include "midi_latency.hpp"
 #include "engine.hpp"
 
 using namespace SooperLooper;
@@ -86,6 +92,22 @@ MidiBridge::MidiBridge (string name, string oscurl, PortRequest & req)
 	_output_clock = false;
 	_getnext = false;
 	_feedback_out = false;
+	_feedback_refresh = false;
+	_feedback_next = 0;
+	_feedback_budget = 0.0;
+	_feedback_stamp = 0.0;
+	_binding_table = 0;
+	_binding_epoch = 1;
+	_input_device_delay = _input_received = 0.0;
+	_reader_epoch[PortReader] = _reader_epoch[ProcessReader] = 0;
+	_trace_ring = new RingBuffer<MidiTrace> (1024);
+	_forward_ring = new RingBuffer<MidiAction> (1024);
+	_learn_ring = new RingBuffer<RawMidi> (64);
+	_port_learn_ring = new RingBuffer<RawMidi> (64);
+	_output_ring = new RingBuffer<RawMidi> (512);
+	_trace_midi = false;
+	_trace_dropped = _forward_dropped = 0;
+	_trace_dropped_reported = _forward_dropped_reported = 0;
 
 	_addr = lo_address_new_from_url (_oscurl.c_str());
 	if (lo_address_errno (_addr) < 0) {
@@ -100,8 +122,9 @@ MidiBridge::MidiBridge (string name, string oscurl, PortRequest & req)
 		return;
 	}
 
-	// this is a callback that will be made from the parser
-	_port->input()->any.connect (mem_fun (*this, &MidiBridge::incoming_midi));
+	// the parser hands over whole reads at a time
+	_port->input()->set_bulk (true);
+	_port->input()->bulk.connect (mem_fun (*this, &MidiBridge::incoming_midi));
 
 	init_thread();
 	init_clock_thread();
@@ -125,6 +148,22 @@ MidiBridge::MidiBridge (string name,  PortRequest & req)
 	_output_clock = false;
 	_getnext = false;
 	_feedback_out = false;
+	_feedback_refresh = false;
+	_feedback_next = 0;
+	_feedback_budget = 0.0;
+	_feedback_stamp = 0.0;
+	_binding_table = 0;
+	_binding_epoch = 1;
+	_input_device_delay = _input_received = 0.0;
+	_reader_epoch[PortReader] = _reader_epoch[ProcessReader] = 0;
+	_trace_ring = new RingBuffer<MidiTrace> (1024);
+	_forward_ring = new RingBuffer<MidiAction> (1024);
+	_learn_ring = new RingBuffer<RawMidi> (64);
+	_port_learn_ring = new RingBuffer<RawMidi> (64);
+	_output_ring = new RingBuffer<RawMidi> (512);
+	_trace_midi = false;
+	_trace_dropped = _forward_dropped = 0;
+	_trace_dropped_reported = _forward_dropped_reported = 0;
 
 	PortFactory factory;
 
@@ -133,8 +172,9 @@ MidiBridge::MidiBridge (string name,  PortRequest & req)
 		return;
 	}
 
-	// this is a callback that will be made from the parser
-	_port->input()->any.connect (mem_fun (*this, &MidiBridge::incoming_midi));
+	// the parser hands over whole reads at a time
+	_port->input()->set_bulk (true);
+	_port->input()->bulk.connect (mem_fun (*this, &MidiBridge::incoming_midi));
 
 	init_thread();
 	init_clock_thread();
@@ -160,6 +200,22 @@ MidiBridge::MidiBridge (string name)
 	_output_clock = false;
 	_getnext = false;
 	_feedback_out = false;
+	_feedback_refresh = false;
+	_feedback_next = 0;
+	_feedback_budget = 0.0;
+	_feedback_stamp = 0.0;
+	_binding_table = 0;
+	_binding_epoch = 1;
+	_input_device_delay = _input_received = 0.0;
+	_reader_epoch[PortReader] = _reader_epoch[ProcessReader] = 0;
+	_trace_ring = new RingBuffer<MidiTrace> (1024);
+	_forward_ring = new RingBuffer<MidiAction> (1024);
+	_learn_ring = new RingBuffer<RawMidi> (64);
+	_port_learn_ring = new RingBuffer<RawMidi> (64);
+	_output_ring = new RingBuffer<RawMidi> (512);
+	_trace_midi = false;
+	_trace_dropped = _forward_dropped = 0;
+	_trace_dropped_reported = _forward_dropped_reported = 0;
 
 	init_clock_thread();
 }
@@ -182,6 +238,14 @@ MidiBridge::~MidiBridge()
 		delete _port;
 		_port = 0;
 	}
+
+	reclaim_bindings (true);
+	delete _binding_table;
+	delete _trace_ring;
+	delete _forward_ring;
+	delete _learn_ring;
+	delete _port_learn_ring;
+	delete _output_ring;
 }
 
 
@@ -258,6 +322,10 @@ bool MidiBridge::init_clock_thread()
 	_tempo = 0.0;
 	_beatstamp = 0.0;
 	_pending_start = false;
+	_clock_next = 0.0;
+	_clock_running = false;
+	_clock_ticks = 0;
+	_jitter_sum = _jitter_sumsq = _jitter_max = 0.0;
 
 	pthread_create (&_clock_thread, NULL, &MidiBridge::_clock_thread_entry, this);
 	if (!_clock_thread) {
@@ -315,12 +383,10 @@ MidiBridge::finish_learn(MIDI::byte chcmd, MIDI::byte param, MIDI::byte val)
 	int chan;
 	string type;
 
-	TentativeLockMonitor lm (_bindings_lock, __LINE__, __FILE__);
-	if (!lm.locked()) {
-		// just drop it if we don't get the lock
-		return;
-	}
-
+	// only runs from service(), on the engine's main loop, so the
+	// learned binding is handed over on the thread that reads it.
+	// only looks at the type names and the current set, which
+	// don't need the bindings lock
 
 	if (_learning) {
 
@@ -391,32 +457,42 @@ MidiBridge::cancel_get_next()
 
 
 void
-MidiBridge::incoming_midi (Parser &p, byte *msg, size_t len, timestamp_t timestamp)
+MidiBridge::incoming_midi (Parser &p, ParsedEvent *events, size_t count)
 {
-	/* we only respond to channel messages */
+	const BindingTable * table = pin_bindings (PortReader);
+	timestamp_t port_now = _port ? _port->get_current_host_time() : 0;
 
-	byte b1 = msg[0];
-	byte b2 = len>1 ? msg[1]: 0;
-	byte b3 = len>2 ? msg[2]: 0;
+	_input_received = MidiLatency::now();
 
-// 	if ((msg[0] & 0xF0) < 0x80 || (msg[0] & 0xF0) > 0xE0) {
-// 		return;
-// 	}
+	for (size_t i = 0; i < count; ++i) {
+		const ParsedEvent & ev = events[i];
+		byte b1 = ev.status;
+		byte b3 = ev.data2;
 
-	// convert noteoffs to noteons with val = 0
-	if ((msg[0] & 0xF0) == MIDI::off) {
- 		b1 = MIDI::on | (b1 & 0x0F);
-		b3 = 0;
-	}
+		// on the port's own clock.  only coremidi stamps events on arrival,
+		// alsa and fd ports stamp them as they're read, so this is ~0 there
+		_input_device_delay = (ev.timestamp > 0 && port_now > ev.timestamp) ? port_now - ev.timestamp : 0.0;
 
-	// fprintf(stderr, "incmoing: %02x  %02x  %02x\n", (int) b1,(int) b2, (int) b3);
+		// convert noteoffs to noteons with val = 0
+		if ((b1 & 0xF0) == MIDI::off) {
+			b1 = MIDI::on | (b1 & 0x0F);
+			b3 = 0;
+		}
 
-	if (_learning || _getnext) {
-		finish_learn(b1, b2, b3);
-	}
-	else {
-		queue_midi (b1, b2, b3, -1, timestamp);
+		if (_learning || _getnext) {
+			// service() finishes it, on the thread that reads the result
+			RawMidi raw;
+			raw.data[0] = b1;
+			raw.data[1] = ev.data1;
+			raw.data[2] = b3;
+			_port_learn_ring->write (&raw, 1);
+		}
+		else {
+			queue_midi (table, b1, ev.data1, b3, -1, ev.timestamp);
+		}
 	}
+
+	unpin_bindings (PortReader);
 }
 
 
@@ -431,27 +507,346 @@ MidiBridge::inject_midi (MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, lon
 
 
 	if (_learning || _getnext) {
-		finish_learn(chcmd, param, val);
+		// learning isn't realtime safe, service() finishes it
+		RawMidi raw;
+		raw.data[0] = chcmd;
+		raw.data[1] = param;
+		raw.data[2] = val;
+		_learn_ring->write (&raw, 1);
 	}
 	else {
-		queue_midi (chcmd, param, val, framepos);
+		_input_device_delay = 0.0;
+		_input_received = MidiLatency::now();
+		queue_midi (pin_bindings (ProcessReader), chcmd, param, val, framepos);
+		unpin_bindings (ProcessReader);
 	}
 }
 
 
 void
-MidiBridge::queue_midi (MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, long framepos, timestamp_t timestamp)
+MidiBridge::process_driver_midi (AudioDriver & driver, nframes_t nframes)
 {
-	TentativeLockMonitor lm (_bindings_lock, __LINE__, __FILE__);
-	if (!lm.locked()) {
-		// just drop it if we don't get the lock
+	nframes_t offset;
+	const unsigned char * data;
+	size_t size;
+	RawMidi raw;
+	const BindingTable * table = pin_bindings (ProcessReader);
+
+	// jack already placed it in the cycle, so there is no device stage
+	_input_device_delay = 0.0;
+	_input_received = MidiLatency::now();
+
+	for (unsigned int i = 0; driver.get_midi_input_event (i, offset, data, size); ++i) {
+		// sysex and system common messages aren't bound to anything
+		if (size == 0 || data[0] < 0x80 || (data[0] >= 0xf0 && data[0] < 0xf8)) {
+			continue;
+		}
+
+		raw.data[0] = data[0];
+		raw.data[1] = size > 1 ? data[1] : 0;
+		raw.data[2] = size > 2 ? data[2] : 0;
+
+		// convert noteoffs to noteons with val = 0
+		if ((raw.data[0] & 0xF0) == MIDI::off) {
+			raw.data[0] = MIDI::on | (raw.data[0] & 0x0F);
+			raw.data[2] = 0;
+		}
+
+		if (_learning || _getnext) {
+			// learning isn't realtime safe, service() finishes it
+			_learn_ring->write (&raw, 1);
+		}
+		else {
+			queue_midi (table, raw.data[0], raw.data[1], raw.data[2], (long) min (offset, nframes - 1));
+		}
+	}
+
+	unpin_bindings (ProcessReader);
+
+	// queued messages go out at the start of the cycle
+	while (_output_ring->read (&raw, 1) == 1) {
+		driver.write_midi_output_event (0, raw.data, raw.size);
+	}
+
+	if (_tempo_updated) {
+		_tempo_updated = false;
+
+		if (_tempo > 0.0) {
+			// restart the clock from the start of this cycle
+			_clock_next = 0.0;
+		}
+		else if (_clock_running) {
+			MIDI::byte stopmsg = MIDI::stop;
+			driver.write_midi_output_event (0, &stopmsg, 1);
+			_clock_running = false;
+		}
+	}
+
+	if (!_output_clock || _tempo <= 0.0) {
+		_clock_running = false;
 		return;
 	}
 
-	// convert midi to lookup key
-	// lookup key = (chcmd << 12) | (param << 4) | set
+	if (_pending_start) {
+		MIDI::byte startmsg = MIDI::start;
+		driver.write_midi_output_event (0, &startmsg, 1);
+		_pending_start = false;
+	}
+
+	// 24 clocks per quarter note
+	double tickframes = driver.get_samplerate() * 60.0 / (24.0 * _tempo);
+	MIDI::byte clockmsg = MIDI::timing;
+
+	while (_clock_next < (double) nframes) {
+		driver.write_midi_output_event ((nframes_t) _clock_next, &clockmsg, 1);
+		_clock_next += tickframes;
+	}
+
+	_clock_next -= (double) nframes;
+	_clock_running = true;
+}
+
+bool
+MidiBridge::send_midi (const MIDI::byte * msg, size_t len)
+{
+	if (len == 0 || len > sizeof(((RawMidi *) 0)->data)) {
+		return false;
+	}
+
+	// the clock thread or the process callback writes it out
+	RawMidi raw;
+	memcpy (raw.data, msg, len);
+	raw.size = (uint8_t) len;
 
-	int key = (chcmd << 12) | param << 4 | _midi_bindings.current_set();
+	if (_output_ring->write (&raw, 1) != 1) {
+		return false;
+	}
+
+	if (_port) {
+		poke_clock_thread();
+	}
+	return true;
+}
+
+void
+MidiBridge::write_queued_midi ()
+{
+	// clock thread only, the port isn't safe to write from two threads
+	MIDI::byte buf[256];
+	size_t len;
+	RawMidi raw;
+
+	do {
+		len = 0;
+		while (len + sizeof(raw.data) <= sizeof(buf) && _output_ring->read (&raw, 1) == 1) {
+			memcpy (&buf[len], raw.data, raw.size);
+			len += raw.size;
+		}
+
+		if (len > 0) {
+			_port->write (buf, len);
+		}
+	} while (len > 0);
+}
+
+void
+MidiBridge::update_bindings ()
+{
+	// non-rt thread, with the bindings lock held
+	BindingTable * old = _binding_table;
+	BindingTable * table = new BindingTable;
+	CommandMap & cmdmap = CommandMap::instance();
+	MidiBindings::BindingsMap & bmap = _midi_bindings.bindings_map();
+	MidiBindings::BindingsMap::iterator biter;
+	MidiBindings::BindingList::iterator eiter;
+	int set, status, data;
+	size_t total = 0;
+	std::vector<uint16_t> written (BindingTable::Sets * 128 * 128, 0);
+
+	memset (table->count, 0, sizeof(table->count));
+
+	// count them per slot first, so each slot's bindings can be kept together
+	for (int pass = 0; pass < 2; ++pass) {
+		for (biter = bmap.begin(); biter != bmap.end(); ++biter) {
+			for (eiter = biter->second.begin(); eiter != biter->second.end(); ++eiter) {
+				MidiBindInfo & info = (*eiter);
+
+				// key is (chcmd << 12) | param << 4 | set
+				int key = _midi_bindings.binding_key (info);
+				status = (key >> 12) & 0xff;
+				data = (key >> 4) & 0x7f;
+				set = key & 0xf;
+
+				if (key == 0 || status < 0x80 || status >= 0xf0 || set >= BindingTable::Sets) {
+					continue;
+				}
+
+				if ((status & 0xf0) == MIDI::pitchbend || (status & 0xf0) == MIDI::chanpress) {
+					data = 0;
+				}
+
+				if (pass == 0) {
+					if (total < 0xffff) {
+						table->count[set][status & 0x7f][data]++;
+						total++;
+					}
+					continue;
+				}
+
+				// the ones that didn't fit in the first pass don't get a place
+				uint16_t & used = written[(set * 128 + (status & 0x7f)) * 128 + data];
+				if (used >= table->count[set][status & 0x7f][data]) {
+					continue;
+				}
+				used++;
+
+				CompiledBinding & bind = table->bindings[table->first[set][status & 0x7f][data]++];
+
+				bind.flags = 0;
+				if (info.type == "on" || info.type == "ccon") {
+					bind.flags |= CompiledBinding::OnlyNonZero;
+				}
+				else if (info.type == "off" || info.type == "ccoff") {
+					bind.flags |= CompiledBinding::OnlyZero;
+				}
+				if ((status & 0xf0) == MIDI::pitchbend) {
+					bind.flags |= CompiledBinding::Pitchbend;
+				}
+
+				if (info.command == "set") {
+					bind.kind = CompiledBinding::SetControl;
+				}
+				else if (info.command == "note") {
+					bind.kind = CompiledBinding::Note;
+				}
+				else if (info.command == "susnote") {
+					bind.kind = CompiledBinding::SusNote;
+				}
+				else {
+					bind.kind = CompiledBinding::Command;
+				}
+
+				bind.instance = (int8_t) info.instance;
+				bind.style = info.style;
+				bind.optype = cmdmap.to_type_t (info.command);
+				bind.control = cmdmap.to_control_t (info.control);
+				bind.command = cmdmap.to_command_t (info.control);
+				bind.data_min = info.data_min;
+				bind.data_max = info.data_max;
+				bind.ratio_scale = (info.data_max == info.data_min) ? 0.0f : 1.0f / (float) (info.data_max - info.data_min);
+				bind.lbound = info.lbound;
+				bind.range = info.ubound - info.lbound;
+				bind.ubound = info.ubound;
+				bind.toggle_val = info.last_toggle_val;
+
+				if (bind.style == MidiBindInfo::ToggleStyle && old) {
+					// carry the toggle state over from the same binding in the old table
+					const CompiledBinding * prev = &old->bindings[old->first[set][status & 0x7f][data]];
+					for (const CompiledBinding * end = prev + old->count[set][status & 0x7f][data]; prev != end; ++prev) {
+						if (prev->style == bind.style && prev->kind == bind.kind && prev->flags == bind.flags
+						    && prev->instance == bind.instance && prev->control == bind.control && prev->command == bind.command)
+						{
+							bind.toggle_val = prev->toggle_val;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		if (pass == 0) {
+			// slot starts, which the second pass advances as it fills them in
+			size_t pos = 0;
+			for (set = 0; set < BindingTable::Sets; ++set) {
+				for (status = 0; status < 128; ++status) {
+					for (data = 0; data < 128; ++data) {
+						table->first[set][status][data] = (uint16_t) pos;
+						pos += table->count[set][status][data];
+					}
+				}
+			}
+
+			CompiledBinding empty;
+			memset (&empty, 0, sizeof(empty));
+			table->bindings.assign (total, empty);
+		}
+	}
+
+	// back to the slot starts
+	for (set = 0; set < BindingTable::Sets; ++set) {
+		for (status = 0; status < 128; ++status) {
+			for (data = 0; data < 128; ++data) {
+				table->first[set][status][data] -= table->count[set][status][data];
+			}
+		}
+	}
+
+	_binding_table = table;
+	__sync_synchronize();
+
+	if (old) {
+		// anyone who still has it pinned started before this epoch
+		RetiredTable retired;
+		retired.table = old;
+		retired.epoch = __sync_add_and_fetch (&_binding_epoch, 1);
+		_retired_tables.push_back (retired);
+	}
+
+	reclaim_bindings ();
+
+	update_feedback_bindings ();
+}
+
+const MidiBridge::BindingTable *
+MidiBridge::pin_bindings (BindingReader reader)
+{
+	// the epoch has to be visible before the table is read, or
+	// reclaim_bindings() could miss this reader
+	_reader_epoch[reader] = _binding_epoch;
+	__sync_synchronize();
+
+	return _binding_table;
+}
+
+void
+MidiBridge::unpin_bindings (BindingReader reader)
+{
+	__sync_synchronize();
+	_reader_epoch[reader] = 0;
+}
+
+void
+MidiBridge::reclaim_bindings (bool all)
+{
+	// non-rt thread
+	unsigned long oldest = 0;
+
+	for (int i = 0; i < BindingReaders; ++i) {
+		unsigned long epoch = _reader_epoch[i];
+		if (epoch != 0 && (oldest == 0 || epoch < oldest)) {
+			oldest = epoch;
+		}
+	}
+
+	std::vector<RetiredTable>::iterator iter = _retired_tables.begin();
+	while (iter != _retired_tables.end()) {
+		if (all || oldest == 0 || oldest >= iter->epoch) {
+			delete iter->table;
+			iter = _retired_tables.erase (iter);
+		}
+		else {
+			++iter;
+		}
+	}
+}
+
+void
+MidiBridge::queue_midi (const BindingTable * table, MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, long framepos, timestamp_t timestamp)
+{
+	int set = _midi_bindings.current_set();
+	int data = param & 0x7f;
+	unsigned int count = 0;
+	MidiAction action;
 
 	switch(chcmd & 0xF0)
 	{
@@ -459,154 +854,297 @@ MidiBridge::queue_midi (MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, long
 		val = param;
 		// fallthrough intentional
 	case MIDI::pitchbend:
-		key = chcmd << 8;
+		data = 0;
 		break;
 	default: break;// nothing
 	}
 
-	MidiBindings::BindingsMap::iterator iter = _midi_bindings.bindings_map().find(key);
+	if (table && chcmd >= 0x80 && chcmd < 0xf0 && set >= 0 && set < BindingTable::Sets) {
+		count = table->count[set][chcmd & 0x7f][data];
+	}
 
-	if (iter != _midi_bindings.bindings_map().end())
+	if (count > 0)
 	{
-		MidiBindings::BindingList & elist = (*iter).second;
+		const CompiledBinding * bind = &table->bindings[table->first[set][chcmd & 0x7f][data]];
 
-		for (MidiBindings::BindingList::iterator eiter = elist.begin(); eiter != elist.end(); ++eiter) {
-			MidiBindInfo & info = (*eiter);
+		for (const CompiledBinding * end = bind + count; bind != end; ++bind) {
 			float scaled_val = 0.0;
 			float val_ratio;
 			int clamped_val;
 
-			if (_midi_bindings.current_set() != info.set || (((info.type == "off") || (info.type == "ccon")) && val == 0) || (((info.type == "on") || (info.type == "ccoff")) && val > 0)) {
-				// binding was for another set, or for note off or on only, skip this
+			if (((bind->flags & CompiledBinding::OnlyNonZero) && val == 0) || ((bind->flags & CompiledBinding::OnlyZero) && val > 0)) {
+				// binding was for note off or on only, skip this
 				continue;
 			}
 
 			// clamp it
-			if ((chcmd & 0xF0) == MIDI::pitchbend) {
-				clamped_val = min( info.data_max, max(info.data_min, (param | (val << 7))));
-				// cerr << "Pitchbend: " << (int) (param | (val << 7)) << "  clamped: " << clamped_val << endl;
+			if (bind->flags & CompiledBinding::Pitchbend) {
+				clamped_val = min (bind->data_max, max (bind->data_min, (param | (val << 7))));
 			}
 			else {
-				clamped_val = min((MIDI::byte) info.data_max, max((MIDI::byte) info.data_min, val));
+				clamped_val = min (bind->data_max, max (bind->data_min, (int) val));
 			}
 
-			if (info.data_min == info.data_max) {
-				val_ratio = 0.0f;
-			}
-			else {
-				// calculate value as a ratio to map to the target range
-				val_ratio = (clamped_val - info.data_min) / (float)(info.data_max - info.data_min);
-			}
+			// calculate value as a ratio to map to the target range
+			val_ratio = (clamped_val - bind->data_min) * bind->ratio_scale;
 
-			if (info.style == MidiBindInfo::GainStyle) {
-				scaled_val = (float) (val_ratio *  ( info.ubound - info.lbound)) + info.lbound;
+			if (bind->style == MidiBindInfo::GainStyle) {
+				scaled_val = (float) (val_ratio * bind->range) + bind->lbound;
 				scaled_val = uniform_position_to_gain (scaled_val);
 			}
-			else if (info.style == MidiBindInfo::NormalStyle) {
-				scaled_val = (float) (val_ratio *  ( info.ubound - info.lbound)) + info.lbound;
+			else if (bind->style == MidiBindInfo::NormalStyle) {
+				scaled_val = (float) (val_ratio * bind->range) + bind->lbound;
 			}
-			else if (info.style == MidiBindInfo::IntegerStyle) {
+			else if (bind->style == MidiBindInfo::IntegerStyle) {
 				// round to nearest integer value
-				scaled_val = (float) nearbyintf((val_ratio *  ( info.ubound - info.lbound)) + info.lbound);
+				scaled_val = (float) nearbyintf((val_ratio * bind->range) + bind->lbound);
 			}
 			else {
 				// toggle style is a bit of a hack, but here we go
-				if (info.last_toggle_val != info.ubound) {
-					scaled_val = info.ubound;
+				if (bind->toggle_val != bind->ubound) {
+					scaled_val = bind->ubound;
 				}
 				else {
-					scaled_val = info.lbound;
+					scaled_val = bind->lbound;
 				}
-				info.last_toggle_val = scaled_val;
+				bind->toggle_val = scaled_val;
 			}
 
-			fprintf(stderr, "found binding: key: %x  val: %02x  scaled: %g  type: %s, \n", (int) key, (int) val, scaled_val, info.type.c_str());
-			cerr << "ctrl: " << info.control << "  cmd: " << info.command << " set: " << info.set << endl;
-
-			send_event (info, scaled_val, framepos);
+			send_event (*bind, scaled_val, framepos, action);
+			post_action (action, chcmd, param, val, timestamp);
 		}
+		return;
 	}
-	else if (chcmd == MIDI::start || chcmd == MIDI::contineu) {  // MIDI start
-		if (_use_osc) {
-			lo_send(_addr, "/sl/midi_start", "");
-		}
-		MidiSyncEvent (Event::MidiStart, framepos, timestamp); // emit
-		//cerr << "got start" << endl;
+
+	action.kind = MidiAction::Sync;
+	action.instance = -1;
+	action.optype = Event::type_sync;
+	action.command = Event::UNKNOWN;
+	action.value = 0.0f;
+
+	if (chcmd == MIDI::start || chcmd == MIDI::contineu) {  // MIDI start
+		action.control = Event::MidiStart;
+		MidiSyncEvent (Event::MidiStart, framepos, timestamp, _input_device_delay); // emit
 	}
 	else if (chcmd == MIDI::stop) { // MIDI stop
-		if (_use_osc) {
-			lo_send(_addr, "/sl/midi_stop", "");
-		}
-		MidiSyncEvent (Event::MidiStop, framepos, timestamp); // emit
-		//cerr << "got stop" << endl;
+		action.control = Event::MidiStop;
+		MidiSyncEvent (Event::MidiStop, framepos, timestamp, _input_device_delay); // emit
 	}
 	else if (chcmd == MIDI::timing) {  // MIDI clock tick
-		if (_use_osc) {
-			lo_send(_addr, "/sl/midi_tick", "");
-		}
-		MidiSyncEvent (Event::MidiTick, framepos, timestamp); // emit
+		action.control = Event::MidiTick;
+		MidiSyncEvent (Event::MidiTick, framepos, timestamp, _input_device_delay); // emit
 	}
 	else {
-	  fprintf(stderr, "binding %x not found\n", key);
+		action.kind = MidiAction::None;
+		action.optype = Event::type_cmd_hit;
+		action.control = Event::Unknown;
+	}
+
+	post_action (action, chcmd, param, val, timestamp);
+}
+
+void
+MidiBridge::send_event (const CompiledBinding & bind, float val, long framepos, MidiAction & action)
+{
+	Event::type_t optype = bind.optype;
+
+	action.instance = bind.instance;
+	action.control = bind.control;
+	action.command = bind.command;
+	action.value = val;
+
+	if (bind.kind == CompiledBinding::SetControl) {
+		action.kind = MidiAction::SetControl;
+		action.optype = optype;
+
+		MidiControlEvent (optype, bind.control, val, bind.instance, framepos); // emit
+	}
+	else {
+		if (bind.kind == CompiledBinding::Note) {
+			optype = (val > 0.0f) ? Event::type_cmd_down : Event::type_cmd_up;
+		}
+		else if (bind.kind == CompiledBinding::SusNote) {
+			optype = (val > 0.0f) ? Event::type_cmd_down : Event::type_cmd_upforce;
+		}
+
+		action.kind = MidiAction::Command;
+		action.optype = optype;
+
+		MidiCommandEvent (optype, bind.command, bind.instance, framepos); // emit
+	}
+}
+
+void
+MidiBridge::post_action (const MidiAction & action, MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, timestamp_t timestamp)
+{
+	// midi comes in from either the midi thread or the process callback,
+	// never both, so each ring has a single writer
+
+	if (_use_osc && action.kind != MidiAction::None) {
+		MidiAction fwd = action;
+		if (_forward_ring->write (&fwd, 1) != 1) {
+			++_forward_dropped;
+		}
+	}
+
+	// clock ticks would drown everything else out
+	if (_trace_midi && !(action.kind == MidiAction::Sync && action.control == Event::MidiTick)) {
+		MidiTrace trace;
+		trace.status = chcmd;
+		trace.data1 = param;
+		trace.data2 = val;
+		trace.timestamp = timestamp;
+		trace.action = action;
+
+		if (_trace_ring->write (&trace, 1) != 1) {
+			++_trace_dropped;
+		}
 	}
 }
 
 void
-MidiBridge::send_event (const MidiBindInfo & info, float val, long framepos)
+MidiBridge::service (Engine * engine)
 {
-	static char tmpbuf[100];
+	RawMidi raw;
+
+	if (!_retired_tables.empty()) {
+		reclaim_bindings ();
+	}
+
+	// one ring per writer, the midi port thread and the process callback
+	while (_port_learn_ring->read (&raw, 1) == 1) {
+		finish_learn (raw.data[0], raw.data[1], raw.data[2]);
+	}
+	while (_learn_ring->read (&raw, 1) == 1) {
+		finish_learn (raw.data[0], raw.data[1], raw.data[2]);
+	}
+
+	write_trace ();
 
+	if (_use_osc) {
+		forward_actions ();
+	}
 
-	string cmd = info.command;
+	if (_feedback_out) {
+		if (_feedback_refresh) {
+			refresh_feedback (engine);
+		}
+		flush_feedback ();
+	}
+}
+
+void
+MidiBridge::write_trace ()
+{
 	CommandMap & cmdmap = CommandMap::instance();
+	MidiTrace trace;
 
-	Event::type_t optype = cmdmap.to_type_t (cmd);
-	Event::control_t ctrltype = cmdmap.to_control_t (info.control);
-	Event::command_t cmdtype = cmdmap.to_command_t (info.control);
+	while (_trace_ring->read (&trace, 1) == 1) {
+		const MidiAction & action = trace.action;
 
-	if (cmd == "set") {
-		if (_use_osc) {
-			snprintf (tmpbuf, sizeof(tmpbuf)-1, "/sl/%d/%s", info.instance, cmd.c_str());
+		fprintf (stderr, "midi: %.6f  %02x %02x %02x  ", (double) trace.timestamp, (int) trace.status, (int) trace.data1, (int) trace.data2);
 
-			if (lo_send(_addr, tmpbuf, "sf", info.control.c_str(), val) < 0) {
-				fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(_addr), lo_address_errstr(_addr));
-			}
+		switch (action.kind) {
+		case MidiAction::SetControl:
+			fprintf (stderr, "-> loop %d  %s %s %g\n", (int) action.instance, cmdmap.to_type_str(action.optype).c_str(),
+				 cmdmap.to_control_str(action.control).c_str(), action.value);
+			break;
+		case MidiAction::Command:
+			fprintf (stderr, "-> loop %d  %s %s\n", (int) action.instance, cmdmap.to_type_str(action.optype).c_str(),
+				 cmdmap.to_command_str(action.command).c_str());
+			break;
+		case MidiAction::Sync:
+			fprintf (stderr, "-> %s\n", action.control == Event::MidiStart ? "start" : "stop");
+			break;
+		default:
+			fprintf (stderr, "-> no binding\n");
+			break;
 		}
+	}
 
-		MidiControlEvent (optype, ctrltype, val, (int8_t) info.instance, framepos); // emit
+	unsigned long dropped = _trace_dropped;
+	if (dropped != _trace_dropped_reported) {
+		fprintf (stderr, "midi: %lu events missing from the trace\n", dropped - _trace_dropped_reported);
+		_trace_dropped_reported = dropped;
 	}
-	else {
-		if (cmd == "note") {
-			if (val > 0.0f) {
-				//cerr << "val is " << val << "  type is: " << info.type << endl;
-				cmd = "down";
-				optype = Event::type_cmd_down;
+}
+
+void
+MidiBridge::forward_actions ()
+{
+	// keep each bundle inside a single udp datagram
+	static const size_t max_per_bundle = 24;
+
+	CommandMap & cmdmap = CommandMap::instance();
+	MidiAction action;
+	vector<MidiAction>::iterator iter;
+
+	_forward_pending.clear();
+
+	while (_forward_ring->read (&action, 1) == 1) {
+		if (action.kind == MidiAction::SetControl) {
+			// only the last value of a control that moved matters, but it
+			// can't be moved ahead of a command or sync that came before it,
+			// so only the sets since the last one of those are looked at
+			bool merged = false;
+			vector<MidiAction>::reverse_iterator riter;
+
+			for (riter = _forward_pending.rbegin(); riter != _forward_pending.rend() && riter->kind == MidiAction::SetControl; ++riter) {
+				if (riter->instance == action.instance && riter->control == action.control && riter->optype == action.optype) {
+					riter->value = action.value;
+					merged = true;
+					break;
+				}
 			}
-			else {
-				cmd = "up";
-				optype = Event::type_cmd_up;
+			if (merged) {
+				continue;
 			}
 		}
-		else if (cmd == "susnote") {
-			if (val > 0.0f) {
-				cmd = "down";
-				optype = Event::type_cmd_down;
-			}
-			else {
-				cmd = "upforce";
-				optype = Event::type_cmd_upforce;
-			}
+
+		_forward_pending.push_back (action);
+	}
+
+	unsigned long dropped = _forward_dropped;
+	if (dropped != _forward_dropped_reported) {
+		cerr << "MidiBridge: " << dropped - _forward_dropped_reported << " midi events were not sent over osc" << endl;
+		_forward_dropped_reported = dropped;
+	}
+
+	// older liblo keeps the path pointers, they must outlive the bundle
+	char paths[max_per_bundle][40];
+	lo_bundle bundle = 0;
+	size_t used = 0;
+
+	for (iter = _forward_pending.begin(); iter != _forward_pending.end(); ++iter) {
+		lo_message msg = lo_message_new();
+
+		if (iter->kind == MidiAction::SetControl) {
+			snprintf (paths[used], sizeof(paths[used]), "/sl/%d/%s", (int) iter->instance, cmdmap.to_type_str(iter->optype).c_str());
+			lo_message_add_string (msg, cmdmap.to_control_str(iter->control).c_str());
+			lo_message_add_float (msg, iter->value);
+		}
+		else if (iter->kind == MidiAction::Command) {
+			snprintf (paths[used], sizeof(paths[used]), "/sl/%d/%s", (int) iter->instance, cmdmap.to_type_str(iter->optype).c_str());
+			lo_message_add_string (msg, cmdmap.to_command_str(iter->command).c_str());
+		}
+		else {
+			snprintf (paths[used], sizeof(paths[used]), "/sl/%s", iter->control == Event::MidiStart ? "midi_start"
+				  : (iter->control == Event::MidiStop ? "midi_stop" : "midi_tick"));
 		}
 
-		if (_use_osc) {
-			snprintf (tmpbuf, sizeof(tmpbuf)-1, "/sl/%d/%s", info.instance, cmd.c_str());
+		if (!bundle) {
+			bundle = lo_bundle_new (LO_TT_IMMEDIATE);
+		}
+		lo_bundle_add_message (bundle, paths[used], msg);
 
-			if (lo_send(_addr, tmpbuf, "s", info.control.c_str()) < 0) {
+		if (++used == max_per_bundle || iter + 1 == _forward_pending.end()) {
+			if (lo_send_bundle (_addr, bundle) < 0) {
 				fprintf(stderr, "OSC error %d: %s\n", lo_address_errno(_addr), lo_address_errstr(_addr));
 			}
+			lo_bundle_free_messages (bundle);
+			bundle = 0;
+			used = 0;
 		}
-
-		MidiCommandEvent (optype, cmdtype, (int8_t) info.instance, framepos); // emit
 	}
 }
 
@@ -699,7 +1237,182 @@ void  MidiBridge::midi_receiver()
 	}
 }
 
+// how far a running clock moves toward a new beat per tick, as a part of a tick
+#define CLOCK_PHASE_STEP 0.05
+// the longest the clock thread sleeps before it looks for changes again
+#define CLOCK_MAX_SLEEP 0.05
+
+static inline double
+monotonic_now ()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (double) now.tv_sec + now.tv_nsec * 1e-9;
+}
+
 void * MidiBridge::clock_thread_entry()
+{
+	if (!_port) return 0;
+
+#if WITH_COREMIDI
+	// coremidi schedules timestamped writes itself
+	return write_at_clock_loop();
+#else
+	return scheduled_clock_loop();
+#endif
+}
+
+void * MidiBridge::scheduled_clock_loop()
+{
+	MIDI::byte clockmsg = MIDI::timing;
+	MIDI::byte startmsg = MIDI::start;
+	MIDI::byte stopmsg = MIDI::stop;
+	struct pollfd pfd;
+	struct timespec ts;
+	char buf[16];
+	double ticktime = 0.0;
+	double beat = 0.0;   // a beat the ticks line up with, on the monotonic clock
+	double next = 0.0;   // when the next tick is due
+	double now, wake;
+	bool ticking = false;
+	bool correcting = false;
+
+	// ticks should go out when they are due, not when the scheduler gets to us
+	struct sched_param param;
+	param.sched_priority = min (50, sched_get_priority_max (SCHED_FIFO));
+	if (pthread_setschedparam (pthread_self(), SCHED_FIFO, &param) != 0) {
+		cerr << "MidiBridge: cannot run the midi clock thread with realtime priority" << endl;
+	}
+
+	pfd.fd = _clock_request_pipe[0];
+	pfd.events = POLLIN;
+
+	while (!_clockdone) {
+		now = monotonic_now();
+
+		if (_tempo_updated) {
+			_tempo_updated = false;
+
+			if (_tempo > 0.0) {
+				ticktime = 60.0 / (24.0 * _tempo);
+
+				// the beat stamp is host time, move it over to the monotonic clock
+				beat = (_beatstamp > 0.0) ? now - (get_current_host_time() - _beatstamp) : now;
+
+				if (ticking && !_pending_start) {
+					// slide the running ticks over to the new beat, a jump would
+					// look like a tempo change to whatever follows us
+					correcting = true;
+				}
+				else {
+					ticking = false;
+				}
+			}
+			else {
+				if (ticking) {
+					_port->write (&stopmsg, 1);
+				}
+				ticking = false;
+				ticktime = 0.0;
+			}
+		}
+
+		if (!_output_clock || ticktime == 0.0) {
+			ticking = false;
+		}
+		else if (!ticking) {
+			// start on the first tick of the beat's grid still to come
+			next = beat + ceil ((now - beat) / ticktime) * ticktime;
+			correcting = false;
+			ticking = true;
+		}
+
+		if (!ticking) {
+			// wait for a tempo update, looking at the output flag now and then
+			if (poll (&pfd, 1, 100) > 0) {
+				while (::read (_clock_request_pipe[0], buf, sizeof(buf)) > 0);
+			}
+			write_queued_midi ();
+			continue;
+		}
+
+		if (now < next) {
+			// wait until the tick is due, but not so long that changes wait.
+			// a poke for queued output or a new tempo wakes us right away,
+			// and waking early just comes back around to wait for the rest
+			wake = min (next - now, (double) CLOCK_MAX_SLEEP);
+			ts.tv_sec = (time_t) wake;
+			ts.tv_nsec = (long) ((wake - ts.tv_sec) * 1e9);
+
+			if (ppoll (&pfd, 1, &ts, NULL) > 0) {
+				while (::read (_clock_request_pipe[0], buf, sizeof(buf)) > 0);
+			}
+			write_queued_midi ();
+			continue;
+		}
+
+		if (_pending_start) {
+			_port->write (&startmsg, 1);
+			_pending_start = false;
+		}
+
+		_port->write (&clockmsg, 1);
+		record_clock_jitter (monotonic_now() - next);
+
+		next += ticktime;
+
+		if (correcting) {
+			// distance to the nearest tick of the new grid, within half a tick
+			double err = next - beat;
+			err -= floor (err / ticktime + 0.5) * ticktime;
+
+			double step = ticktime * CLOCK_PHASE_STEP;
+			if (fabs (err) <= step) {
+				next -= err;
+				correcting = false;
+			}
+			else {
+				next -= (err > 0.0) ? step : -step;
+			}
+		}
+
+		if (next < now - ticktime) {
+			// we were held up, skip the missed ticks instead of sending a burst
+			next = beat + ceil ((now - beat) / ticktime) * ticktime;
+		}
+	}
+
+	return 0;
+}
+
+void
+MidiBridge::record_clock_jitter (double late)
+{
+	double usecs = late * 1e6;
+
+	_jitter_sum += usecs;
+	_jitter_sumsq += usecs * usecs;
+	if (usecs > _jitter_max) {
+		_jitter_max = usecs;
+	}
+	++_clock_ticks;
+}
+
+void
+MidiBridge::get_clock_jitter (unsigned long & ticks, double & mean, double & max, double & stddev) const
+{
+	// read while the clock thread may be writing, it is only a statistic
+	ticks = _clock_ticks;
+	max = _jitter_max;
+	mean = stddev = 0.0;
+
+	if (ticks > 0) {
+		mean = _jitter_sum / ticks;
+		stddev = sqrt (fabs (_jitter_sumsq / ticks - mean * mean));
+	}
+}
+
+void * MidiBridge::write_at_clock_loop()
 {
 	//struct pollfd pfd[3];
 	int nfds = 0;
@@ -762,6 +1475,9 @@ void * MidiBridge::clock_thread_entry()
 		// time to write out a clock message, the timer expired
 		nowtime = _port->get_current_host_time();
 
+		// anything queued to go out, such as feedback
+		write_queued_midi ();
+
 		if (ret == 1) {
 			::read(_clock_request_pipe[0], &buf, 1);
 			//cerr << "poke event read" << endl;
@@ -862,7 +1578,10 @@ void MidiBridge::tempo_clock_update(double tempo, MIDI::timestamp_t timestamp, b
 	_tempo = tempo;
 	_beatstamp = timestamp;
 	_tempo_updated = true;
-	poke_clock_thread();
+
+	if (_port) {
+		poke_clock_thread();
+	}
 }
 
 MIDI::timestamp_t MidiBridge::get_current_host_time()
@@ -876,16 +1595,32 @@ MIDI::timestamp_t MidiBridge::get_current_host_time()
 void MidiBridge::select_alternate_binding_set()
 {
 	_midi_bindings.select_alternate_set();
+	_feedback_refresh = true;
 }
 
 int MidiBridge::get_current_binding_set() const
 {
-	_midi_bindings.current_set();
+	return _midi_bindings.current_set();
 }
 
 void MidiBridge::select_binding_set(int set)
 {
 	_midi_bindings.select_set(set);
+	_feedback_refresh = true;
+}
+
+// a 31.25 kbaud link carries about 3000 bytes a second, leave most of it
+// for everything else a surface might be sent
+#define FEEDBACK_BYTES_PER_SEC 1000.0
+#define FEEDBACK_BURST_BYTES   96.0
+
+void MidiBridge::set_feedback_out(bool flag)
+{
+	if (flag && !_feedback_out) {
+		// bring the surface up to date
+		_feedback_refresh = true;
+	}
+	_feedback_out = flag;
 }
 
 void MidiBridge::parameter_changed(int ctrl_id, int instance, Engine *engine)
@@ -898,22 +1633,213 @@ void MidiBridge::parameter_changed(int ctrl_id, int instance, Engine *engine)
 
 	if (!_feedback_out) return;
 
+	if (ctrl_id == SooperLooper::Event::SelectedLoopNum) {
+		// bindings to the selected loop now show a different one
+		_feedback_refresh = true;
+	}
+
+	std::map<int, std::vector<size_t> >::iterator found = _feedback_index.find (ctrl_id);
+	if (found == _feedback_index.end()) {
+		return;
+	}
+
 	int selected_loop = (int) engine->get_control_value(Event::SelectedLoopNum, -2);
 	bool selected = (selected_loop == instance || selected_loop == -1 || engine->loop_count()==1);
+	int set = _midi_bindings.current_set();
+	float value = engine->get_control_value((Event::control_t)ctrl_id, instance);
 
-	if (ctrl_id == SooperLooper::Event::State)
-	{
-		int currstate = (int) engine->get_control_value(Event::State, instance);
+	for (vector<size_t>::iterator iter = found->second.begin(); iter != found->second.end(); ++iter) {
+		const FeedbackBinding & bind = _feedback_bindings[*iter];
+
+		if (bind.set != set) {
+			continue;
+		}
+
+		// a binding to all loops shows the first one
+		if (bind.instance == instance
+		    || (bind.instance == -3 && selected)
+		    || (bind.instance == -1 && instance == 0))
+		{
+			queue_feedback (bind, value);
+		}
+	}
+}
+
+void
+MidiBridge::update_feedback_bindings ()
+{
+	// non-rt thread, with the bindings lock held
+	CommandMap & cmdmap = CommandMap::instance();
+	MidiBindings::BindingsMap & bmap = _midi_bindings.bindings_map();
+	MidiBindings::BindingsMap::iterator biter;
+	MidiBindings::BindingList::iterator eiter;
+	std::map<int, size_t> slots;
+
+	_feedback_slots.clear();
+	_feedback_bindings.clear();
+	_feedback_index.clear();
+	_feedback_next = 0;
+
+	for (biter = bmap.begin(); biter != bmap.end(); ++biter) {
+		for (eiter = biter->second.begin(); eiter != biter->second.end(); ++eiter) {
+			MidiBindInfo & info = (*eiter);
+
+			// only values set by a fader, knob or key can be shown on one
+			if (info.command != "set" || (info.type != "cc" && info.type != "n" && info.type != "pb")) {
+				continue;
+			}
+
+			FeedbackBinding bind;
+			bind.control = cmdmap.to_control_t (info.control);
+			if (bind.control == Event::Unknown) {
+				continue;
+			}
+
+			int status = (_midi_bindings.binding_key (info) >> 12) & 0xff;
+			int data1 = (info.type == "pb") ? 0 : (info.param & 0x7f);
+			int slotkey = (status << 8) | data1;
+
+			std::map<int, size_t>::iterator slot = slots.find (slotkey);
+			if (slot == slots.end()) {
+				FeedbackSlot fslot;
+				fslot.status = (MIDI::byte) status;
+				fslot.data1 = (MIDI::byte) data1;
+				fslot.sent = -1;
+				fslot.value = -1;
+				_feedback_slots.push_back (fslot);
+				slot = slots.insert (std::make_pair (slotkey, _feedback_slots.size() - 1)).first;
+			}
+
+			bind.instance = info.instance;
+			bind.set = info.set;
+			bind.slot = slot->second;
+			bind.style = info.style;
+			bind.pitchbend = (info.type == "pb");
+			bind.data_min = info.data_min;
+			bind.data_max = info.data_max;
+			bind.lbound = info.lbound;
+			bind.ubound = info.ubound;
+
+			_feedback_bindings.push_back (bind);
+			_feedback_index[bind.control].push_back (_feedback_bindings.size() - 1);
+		}
+	}
+
+	_feedback_refresh = true;
+}
+
+void
+MidiBridge::queue_feedback (const FeedbackBinding & bind, float value)
+{
+	// the reverse of the scaling queue_midi does
+	float ratio;
+	float range = bind.ubound - bind.lbound;
+
+	if (bind.style == MidiBindInfo::ToggleStyle) {
+		ratio = (value == bind.ubound) ? 1.0f : 0.0f;
 	}
 	else {
-		float value = engine->get_control_value((Event::control_t)ctrl_id, instance);
+		if (bind.style == MidiBindInfo::GainStyle) {
+			value = (float) gain_to_uniform_position (value);
+		}
+		ratio = (range != 0.0f) ? (value - bind.lbound) / range : 0.0f;
+	}
+
+	int data = bind.data_min + (int) lrintf (ratio * (bind.data_max - bind.data_min));
+	int maxdata = bind.pitchbend ? 16383 : 127;
+
+	data = min (max (data, min (bind.data_min, bind.data_max)), max (bind.data_min, bind.data_max));
+	data = min (max (data, 0), maxdata);
+
+	// only the latest value goes out, whenever there is room for it
+	_feedback_slots[bind.slot].value = data;
+}
+
+void
+MidiBridge::refresh_feedback (Engine * engine)
+{
+	int selected_loop = (int) engine->get_control_value(Event::SelectedLoopNum, -2);
+	int set = _midi_bindings.current_set();
 
-		if (instance == -1) {
-			// all loops
+	_feedback_refresh = false;
+
+	for (vector<FeedbackBinding>::iterator bind = _feedback_bindings.begin(); bind != _feedback_bindings.end(); ++bind) {
+		if (bind->set != set) {
+			continue;
+		}
+
+		int instance = bind->instance;
+		if (instance == -3) {
+			instance = (selected_loop >= 0) ? selected_loop : 0;
+		}
+		else if (instance == -1) {
+			instance = 0;
+		}
+
+		if (instance >= 0 && instance >= (int) engine->loop_count()) {
+			continue;
+		}
+
+		queue_feedback (*bind, engine->get_control_value (bind->control, instance));
+		// sent again even if the surface should already show it
+		_feedback_slots[bind->slot].sent = -1;
+	}
+}
+
+void
+MidiBridge::flush_feedback ()
+{
+	MIDI::byte buf[(int) FEEDBACK_BURST_BYTES];
+	size_t len = 0;
+	size_t count = _feedback_slots.size();
+	double now = monotonic_now();
+
+	// refill what the link allows since last time
+	_feedback_budget = min (FEEDBACK_BURST_BYTES, _feedback_budget + (now - _feedback_stamp) * FEEDBACK_BYTES_PER_SEC);
+	_feedback_stamp = now;
+
+	// start where the last flush stopped, so every slot gets its turn
+	for (size_t n = 0; n < count; ++n) {
+		size_t index = (_feedback_next + n) % count;
+		FeedbackSlot & slot = _feedback_slots[index];
+
+		if (slot.value < 0 || slot.value == slot.sent) {
+			continue;
+		}
+
+		if (_feedback_budget < 3.0 || len + 3 > sizeof(buf)) {
+			_feedback_next = index;
+			break;
 		}
-		else {
-			// normal control
 
+		buf[len] = slot.status;
+		if ((slot.status & 0xf0) == MIDI::pitchbend) {
+			buf[len+1] = slot.value & 0x7f;
+			buf[len+2] = (slot.value >> 7) & 0x7f;
 		}
+		else {
+			buf[len+1] = slot.data1;
+			buf[len+2] = slot.value & 0x7f;
+		}
+		len += 3;
+
+		slot.sent = slot.value;
+		_feedback_budget -= 3.0;
+	}
+
+	if (len == 0) {
+		return;
+	}
+
+	// they go out together with one wakeup of whoever writes the port
+	RawMidi raw;
+	raw.size = 3;
+	for (size_t pos = 0; pos < len; pos += 3) {
+		memcpy (raw.data, &buf[pos], 3);
+		_output_ring->write (&raw, 1);
+	}
+
+	if (_port) {
+		poke_clock_thread();
 	}
 }
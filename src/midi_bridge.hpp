@@ -35,9 +35,11 @@
 #include <midi++/port.h>
 #include <midi++/port_request.h>
 
+#include "audio_driver.hpp"
 #include "event.hpp"
 #include "midi_bind.hpp"
 #include "lockmonitor.hpp"
+#include "ringbuffer.hpp"
 
 namespace SooperLooper {
 
@@ -58,6 +60,11 @@ class MidiBridge
 
 	virtual bool is_ok() { return _ok; }
 
+	// rebuilds the table queue_midi looks bindings up in from bindings(),
+	// call it with the bindings lock held after changing them.  the lock
+	// only keeps non-rt threads apart, midi input never waits for it
+	void update_bindings ();
+
 	void start_learn (MidiBindInfo & info, bool exclus=false);
 	void cancel_learn();
 
@@ -71,11 +78,28 @@ class MidiBridge
 	sigc::signal4<void, Event::type_t, Event::command_t, int8_t, long> MidiCommandEvent;
 	sigc::signal5<void, Event::type_t, Event::control_t, float, int8_t, long> MidiControlEvent;
 
-	sigc::signal3<void, Event::control_t, long, MIDI::timestamp_t> MidiSyncEvent;
+	// the last argument is how long ago the port stamped it, in seconds
+	sigc::signal4<void, Event::control_t, long, MIDI::timestamp_t, double> MidiSyncEvent;
+
 
+	// of the midi message being handled, for the MidiCommandEvent and
+	// MidiControlEvent handlers.  queued is left alone
+	void get_input_stamp (Event::MidiStamp & stamp) const {
+		stamp.device_delay = _input_device_delay;
+		stamp.received = _input_received;
+	}
 
+	// from the process callback
 	void inject_midi (MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, long framepos=-1);
 
+	// from the process callback, when the driver has midi ports: handles
+	// this cycle's midi input at the frames it arrived on, and writes out
+	// the clock and anything queued with send_midi()
+	void process_driver_midi (AudioDriver & driver, nframes_t nframes);
+
+	// queues a message for the midi output, from the engine's non-rt thread
+	bool send_midi (const MIDI::byte * msg, size_t len);
+
 	// the tempo updated on a beat starting at timestamp
 	void tempo_clock_update(double tempo, MIDI::timestamp_t timestamp, bool forcestart=false);
 
@@ -83,9 +107,24 @@ class MidiBridge
 
 	void set_output_midi_clock(bool flag) { _output_clock = flag; }
 
-	void set_feedback_out(bool flag) { _feedback_out = flag; }
+	// how late the clock ticks went out since startup, in microseconds
+	void get_clock_jitter (unsigned long & ticks, double & mean, double & max, double & stddev) const;
+
+	// send the values of bound controls back out, for control surface
+	// leds and motor faders
+	void set_feedback_out(bool flag);
 	bool get_feedback_out() const { return _feedback_out; }
 
+	// log incoming midi and what it was bound to, written out by service()
+	void set_trace_midi(bool flag) { _trace_midi = flag; }
+	bool get_trace_midi() const { return _trace_midi; }
+
+	// call regularly from the engine's non-rt thread.  writes out the midi
+	// trace, sends the osc mirror of what arrived since the last call and
+	// the feedback that is due, so the midi thread itself never waits on a
+	// terminal or a socket
+	void service(Engine * engine);
+
 	void parameter_changed(int ctrl_id, int instance, Engine *engine);
 
   int get_current_binding_set() const;
@@ -97,10 +136,7 @@ class MidiBridge
 	void terminate_midi_thread();
 	void poke_midi_thread();
 
-	void incoming_midi (MIDI::Parser &p, MIDI::byte *msg, size_t len, MIDI::timestamp_t timestamp);
-
-	void queue_midi (MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, long framepos=-1, MIDI::timestamp_t timestamp=0);
-
+	void incoming_midi (MIDI::Parser &p, MIDI::ParsedEvent *events, size_t count);
 
 	static void * _midi_receiver (void * arg);
 	void midi_receiver ();
@@ -113,6 +149,10 @@ class MidiBridge
 	void terminate_clock_thread();
 	static void * _clock_thread_entry (void * arg);
 	void * clock_thread_entry();
+	void * write_at_clock_loop();
+	void write_queued_midi ();
+	void * scheduled_clock_loop();
+	void record_clock_jitter (double late);
 	void poke_clock_thread();
 
 	std::string _name;
@@ -120,7 +160,159 @@ class MidiBridge
 
   private:
 
-	void send_event (const MidiBindInfo & info, float val, long framepos=-1);
+	// a binding with its names resolved and its scaling worked out ahead of time
+	struct CompiledBinding
+	{
+		enum Flags {
+			OnlyNonZero = 1,  // note on and ccon, not used for a value of 0
+			OnlyZero    = 2,  // note off and ccoff, only used for a value of 0
+			Pitchbend   = 4   // takes the 14 bit value from both data bytes
+		};
+
+		enum Kind {
+			SetControl,
+			Command,
+			Note,     // down for values > 0, up for 0
+			SusNote   // down for values > 0, upforce for 0
+		};
+
+		int                 flags;
+		Kind                kind;
+		int8_t              instance;
+		MidiBindInfo::Style style;
+		Event::type_t       optype;
+		Event::control_t    control;
+		Event::command_t    command;
+		int                 data_min;
+		int                 data_max;
+		float               ratio_scale;  // 1 / (data_max - data_min), 0 if they are equal
+		float               lbound;
+		float               range;        // ubound - lbound
+		float               ubound;
+
+		// the only part of a table that changes once it is published,
+		// written by whichever thread has the table pinned
+		mutable float       toggle_val;
+	};
+
+	// every binding for [set][status byte - 0x80][data byte 1] is in
+	// bindings[first ... first + count).  pitchbend and channel pressure
+	// don't look at the first data byte and are all kept under 0.
+	// it holds no pointers into bindings(), so it stays good after they
+	// change, until it is reclaimed
+	struct BindingTable
+	{
+		enum { Sets = 2 };
+
+		uint16_t first[Sets][128][128];
+		uint16_t count[Sets][128][128];
+		std::vector<CompiledBinding> bindings;
+	};
+
+	// what a midi event turned into, kept for the trace and the osc mirror
+	struct MidiAction
+	{
+		enum Kind {
+			None,        // nothing was bound to it
+			SetControl,
+			Command,
+			Sync         // start, stop or clock tick, in control
+		};
+
+		Kind             kind;
+		int8_t           instance;
+		Event::type_t    optype;
+		Event::control_t control;
+		Event::command_t command;
+		float            value;
+	};
+
+	struct MidiTrace
+	{
+		MIDI::byte        status;
+		MIDI::byte        data1;
+		MIDI::byte        data2;
+		MIDI::timestamp_t timestamp;
+		MidiAction        action;
+	};
+
+	// a short midi message, on its way between the rt and non-rt threads
+	struct RawMidi
+	{
+		MIDI::byte data[3];
+		uint8_t    size;
+	};
+
+	// table is from pin_bindings()
+	void queue_midi (const BindingTable * table, MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, long framepos=-1, MIDI::timestamp_t timestamp=0);
+
+	void send_event (const CompiledBinding & binding, float val, long framepos, MidiAction & action);
+
+	// hands the action to the trace and forward rings, midi thread only
+	void post_action (const MidiAction & action, MIDI::byte chcmd, MIDI::byte param, MIDI::byte val, MIDI::timestamp_t timestamp);
+
+	void write_trace ();
+	void forward_actions ();
+
+	// one midi message a control surface gets feedback on.  bindings in
+	// different sets can share one, only the current set's write to it
+	struct FeedbackSlot
+	{
+		MIDI::byte status;
+		MIDI::byte data1;
+		int        sent;   // value last sent, -1 for none
+		int        value;  // latest value, -1 for none
+	};
+
+	// a binding turned around, to make a value of its control into midi
+	struct FeedbackBinding
+	{
+		Event::control_t    control;
+		int                 instance;
+		int                 set;
+		size_t              slot;
+		MidiBindInfo::Style style;
+		bool                pitchbend;
+		int                 data_min;
+		int                 data_max;
+		float               lbound;
+		float               ubound;
+	};
+
+	void update_feedback_bindings ();
+	void queue_feedback (const FeedbackBinding & binding, float value);
+	void refresh_feedback (Engine * engine);
+	void flush_feedback ();
+
+	// the threads that look up bindings, each pins the table in its own slot
+	enum BindingReader {
+		PortReader = 0,   // the midi thread, or the coremidi callback
+		ProcessReader,    // the process callback, jack midi and inject_midi
+		BindingReaders
+	};
+
+	// epoch based reclamation: a reader stores the epoch it started in before
+	// it takes the table, and 0 when it is done.  a table that was replaced
+	// in epoch E is deleted once no reader is still in an epoch before E
+	const BindingTable * pin_bindings (BindingReader reader);
+	void unpin_bindings (BindingReader reader);
+	void reclaim_bindings (bool all = false);
+
+	struct RetiredTable
+	{
+		BindingTable * table;
+		unsigned long  epoch;
+	};
+
+	// for get_input_stamp(), set by whichever thread is feeding midi in
+	double _input_device_delay;
+	double _input_received;
+
+	// swapped in whole by update_bindings(), never changed after
+	BindingTable * volatile _binding_table;
+	volatile unsigned long _binding_epoch;
+	volatile unsigned long _reader_epoch[BindingReaders];
+	std::vector<RetiredTable> _retired_tables;  // non-rt only
 
 
 	MidiBindings _midi_bindings;
@@ -138,6 +330,20 @@ class MidiBridge
 	PBD::NonBlockingLock _bindings_lock;
 
 	bool _use_osc;
+
+	// filled by the midi thread, drained by service()
+	RingBuffer<MidiTrace> * _trace_ring;
+	RingBuffer<MidiAction> * _forward_ring;
+	std::vector<MidiAction> _forward_pending;
+	RingBuffer<RawMidi> * _learn_ring;
+	RingBuffer<RawMidi> * _port_learn_ring;
+	RingBuffer<RawMidi> * _output_ring;
+	volatile bool _trace_midi;
+	volatile unsigned long _trace_dropped;
+	volatile unsigned long _forward_dropped;
+	unsigned long _trace_dropped_reported;
+	unsigned long _forward_dropped_reported;
+
 	volatile bool _done;
 	volatile bool _clockdone;
 
@@ -146,12 +352,32 @@ class MidiBridge
 	volatile MIDI::timestamp_t _beatstamp;
 	volatile bool _pending_start;
 	volatile bool _output_clock;
+	// frames from the start of the next cycle to the next clock tick,
+	// when the clock goes out through the driver
+	double _clock_next;
+	bool _clock_running;
+
+	// written by the clock thread only
+	volatile unsigned long _clock_ticks;
+	volatile double _jitter_sum;
+	volatile double _jitter_sumsq;
+	volatile double _jitter_max;
 
 	bool _learning;
 	bool _getnext;
 	MidiBindInfo _learninfo;
 	bool _ok;
 	bool _feedback_out;
+	volatile bool _feedback_refresh;
+
+	// non-rt thread only
+	std::vector<FeedbackSlot> _feedback_slots;
+	std::vector<FeedbackBinding> _feedback_bindings;
+	// control -> indexes into _feedback_bindings
+	std::map<int, std::vector<size_t> > _feedback_index;
+	size_t _feedback_next;
+	double _feedback_budget;   // bytes that can go out now
+	double _feedback_stamp;
 
 };
 
@@ -0,0 +1,151 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_midi_latency__
+#define __sooperlooper_midi_latency__
+
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+
+namespace SooperLooper {
+
+/*
+ * Histograms of how long midi input takes on each stage of its way
+ * from the port to the frame it is applied at.  Only the rt thread
+ * adds to them, so they need no lock, anyone can read them at any
+ * time and get numbers that are at worst one event behind.
+ */
+class MidiLatency
+{
+  public:
+	enum Stage {
+		Device = 0,   // the port's timestamp to the bridge reading it, coremidi only
+		Bridge,       // the bridge reading it to the engine's midi queue
+		Queue,        // waiting in the queue for a process cycle
+		Fragment,     // the start of that cycle to the frame it was applied at
+		Total,
+		Stages
+	};
+
+	// bucket 0 counts times under 1 usec, bucket n under 2^n usecs,
+	// and the last one everything longer
+	enum { Buckets = 24 };
+
+	struct Stats
+	{
+		unsigned long count;
+		double        mean;   // all in usecs
+		double        max;
+		double        p50;    // upper edge of the bucket, so within a factor of 2
+		double        p90;
+		double        p99;
+		unsigned long buckets[Buckets];
+	};
+
+	MidiLatency () { memset (_hist, 0, sizeof(_hist)); }
+
+	// the monotonic clock every stamp is taken on, in seconds
+	static double now () {
+		struct timespec ts;
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		return (double) ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+	static const char * stage_name (Stage stage) {
+		static const char * names[Stages] = { "device", "bridge", "queue", "fragment", "total" };
+		return names[stage];
+	}
+
+	// rt thread only
+	void add (Stage stage, double secs) {
+		Histogram & hist = _hist[stage];
+		double usecs = (secs > 0.0) ? secs * 1e6 : 0.0;
+		unsigned long whole = (unsigned long) usecs;
+		int n = 0;
+
+		while (whole && n < Buckets - 1) {
+			whole >>= 1;
+			++n;
+		}
+
+		hist.sum += usecs;
+		if (usecs > hist.max) {
+			hist.max = usecs;
+		}
+		++hist.buckets[n];
+	}
+
+	void get (Stage stage, Stats & stats) const {
+		const Histogram & hist = _hist[stage];
+
+		stats.count = 0;
+		for (int n = 0; n < Buckets; ++n) {
+			stats.buckets[n] = hist.buckets[n];
+			stats.count += stats.buckets[n];
+		}
+
+		stats.mean = stats.count ? hist.sum / stats.count : 0.0;
+		stats.max = hist.max;
+		stats.p50 = percentile (stats, 0.50);
+		stats.p90 = percentile (stats, 0.90);
+		stats.p99 = percentile (stats, 0.99);
+	}
+
+	void dump (FILE * out) const {
+		Stats stats;
+
+		for (int stage = 0; stage < Stages; ++stage) {
+			get ((Stage) stage, stats);
+			if (stats.count == 0) {
+				continue;
+			}
+			fprintf (out, "midi latency %-8s  n %-8lu  mean %9.1f  p50 < %9.0f  p90 < %9.0f  p99 < %9.0f  max %9.1f usecs\n",
+				 stage_name ((Stage) stage), stats.count, stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+		}
+	}
+
+  private:
+
+	static double percentile (const Stats & stats, double part) {
+		unsigned long want = (unsigned long) (stats.count * part);
+		unsigned long seen = 0;
+
+		for (int n = 0; n < Buckets; ++n) {
+			seen += stats.buckets[n];
+			if (seen > want) {
+				return (n == Buckets - 1) ? stats.max : (double) (1UL << n);
+			}
+		}
+		return stats.max;
+	}
+
+	struct Histogram
+	{
+		volatile double        sum;
+		volatile double        max;
+		volatile unsigned long buckets[Buckets];
+	};
+
+	Histogram _hist[Stages];
+};
+
+} // namespace SooperLooper
+
+#endif
@@ -0,0 +1,193 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "osc_tcp_link.hpp"
+
+using namespace SooperLooper;
+using namespace std;
+
+//#define DEBUG 1
+
+OscTcpLink::OscTcpLink (const string & host, const string & port)
+	: _host(host), _port(port), _fd(-1), _connected(false), _failed(false), _sent(0)
+{
+	if (!connect_socket()) {
+		fail();
+	}
+}
+
+OscTcpLink::~OscTcpLink ()
+{
+	if (_fd >= 0) {
+		::close (_fd);
+	}
+}
+
+bool
+OscTcpLink::connect_socket ()
+{
+	struct addrinfo hints;
+	struct addrinfo * res = 0;
+
+	memset (&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo (_host.c_str(), _port.c_str(), &hints, &res) != 0 || !res) {
+		cerr << "sooperlooper: cannot resolve osc tcp address " << _host << ":" << _port << endl;
+		return false;
+	}
+
+	_fd = ::socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (_fd < 0) {
+		freeaddrinfo (res);
+		return false;
+	}
+
+	int flag = 1;
+	setsockopt (_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	fcntl (_fd, F_SETFL, fcntl (_fd, F_GETFL) | O_NONBLOCK);
+
+	// finished in flush() once it becomes writable
+	if (::connect (_fd, res->ai_addr, res->ai_addrlen) == 0) {
+		_connected = true;
+	}
+	else if (errno != EINPROGRESS) {
+		cerr << "sooperlooper: cannot connect to osc tcp address " << _host << ":" << _port << ": " << strerror (errno) << endl;
+		freeaddrinfo (res);
+		return false;
+	}
+
+	freeaddrinfo (res);
+	return true;
+}
+
+void
+OscTcpLink::fail ()
+{
+	if (_fd >= 0) {
+		::close (_fd);
+		_fd = -1;
+	}
+	_failed = true;
+	_queue.clear();
+	_sent = 0;
+}
+
+bool
+OscTcpLink::send (const void * data, size_t len)
+{
+	if (_failed) {
+		return false;
+	}
+
+	if (queued() + len + 4 > MaxQueued) {
+#ifdef DEBUG
+		cerr << "osc tcp queue to " << _host << ":" << _port << " full" << endl;
+#endif
+		return false;
+	}
+
+	if (_sent > 0 && _sent == _queue.size()) {
+		_queue.clear();
+		_sent = 0;
+	}
+
+	// 32 bit big endian length, then the packet
+	uint32_t size = htonl ((uint32_t) len);
+	_queue.insert (_queue.end(), (const char *) &size, (const char *) &size + 4);
+	_queue.insert (_queue.end(), (const char *) data, (const char *) data + len);
+
+	return flush();
+}
+
+bool
+OscTcpLink::flush ()
+{
+	if (_failed) {
+		return false;
+	}
+
+	if (!_connected) {
+		struct pollfd pfd;
+		pfd.fd = _fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+
+		if (poll (&pfd, 1, 0) <= 0) {
+			// still connecting
+			return true;
+		}
+
+		int err = 0;
+		socklen_t errlen = sizeof(err);
+		if (getsockopt (_fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0) {
+			cerr << "sooperlooper: cannot connect to osc tcp address " << _host << ":" << _port << ": " << strerror (err) << endl;
+			fail();
+			return false;
+		}
+		_connected = true;
+	}
+
+	while (_sent < _queue.size()) {
+		ssize_t ret = ::send (_fd, &_queue[_sent], _queue.size() - _sent, MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			else if (errno == EINTR) {
+				continue;
+			}
+#ifdef DEBUG
+			cerr << "osc tcp send to " << _host << ":" << _port << " failed: " << strerror (errno) << endl;
+#endif
+			fail();
+			return false;
+		}
+
+		_sent += ret;
+	}
+
+	if (_sent == _queue.size()) {
+		_queue.clear();
+		_sent = 0;
+	}
+	else if (_sent > MaxQueued / 2) {
+		// don't let the sent part pile up at the front
+		_queue.erase (_queue.begin(), _queue.begin() + _sent);
+		_sent = 0;
+	}
+
+	return true;
+}
@@ -0,0 +1,74 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_osc_tcp_link__
+#define __sooperlooper_osc_tcp_link__
+
+#include <string>
+#include <vector>
+
+namespace SooperLooper {
+
+/*
+ * A persistent, non-blocking TCP connection to one OSC return address.
+ * Packets are framed with their length (as liblo does for TCP) and go
+ * through a bounded queue, so a client that doesn't keep up fills its
+ * own queue instead of blocking the caller.
+ */
+class OscTcpLink
+{
+  public:
+	// packets are refused once this much is waiting to go out
+	static const size_t MaxQueued = 256 * 1024;
+	// beyond this, the link is considered congested
+	static const size_t CongestedQueued = 32 * 1024;
+
+	OscTcpLink (const std::string & host, const std::string & port);
+	~OscTcpLink ();
+
+	// queues a packet and writes what the socket will take, returns
+	// false if the queue is full or the connection has failed
+	bool send (const void * data, size_t len);
+
+	// writes what the socket will take without waiting, returns false
+	// if the connection has failed
+	bool flush ();
+
+	bool is_failed () const { return _failed; }
+	bool is_congested () const { return queued() > CongestedQueued; }
+	size_t queued () const { return _queue.size() - _sent; }
+
+  private:
+
+	bool connect_socket ();
+	void fail ();
+
+	std::string       _host;
+	std::string       _port;
+	int               _fd;
+	bool              _connected;
+	bool              _failed;
+
+	std::vector<char> _queue;
+	size_t            _sent;
+};
+
+} // namespace SooperLooper
+
+#endif
@@ -0,0 +1,79 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_osc_update_template__
+#define __sooperlooper_osc_update_template__
+
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+namespace SooperLooper {
+
+/*
+ * A serialised "isf" update message (instance, control, value) for one
+ * control and return path.  Only the instance and value differ from one
+ * update to the next, so an update is a copy of this with those patched in.
+ */
+struct OscUpdateTemplate
+{
+	// msg was serialised for a path pathlen long, with any instance and value
+	void set (const char * msg, size_t len, size_t pathlen) {
+		data.assign (msg, msg + len);
+		// the padded path and ",isf" come first, the value is last
+		instance_offset = ((pathlen + 4) & ~3) + 8;
+		value_offset = len - 4;
+	}
+
+	// what it adds to a bundle, with the size prefix
+	size_t element_size () const { return data.size() + 4; }
+
+	// adds an update to bundle, starting the bundle if it is empty
+	void append_to (std::vector<char> & bundle, int instance, float val) const {
+		if (bundle.empty()) {
+			// "#bundle" and an immediate timetag
+			static const char header[16] = { '#', 'b', 'u', 'n', 'd', 'l', 'e', 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+			bundle.insert (bundle.end(), header, header + 16);
+		}
+
+		size_t pos = bundle.size();
+		bundle.resize (pos + element_size());
+
+		char * elem = &bundle[pos];
+		uint32_t word = htonl ((uint32_t) data.size());
+		memcpy (elem, &word, 4);
+		memcpy (elem + 4, &data[0], data.size());
+
+		word = htonl ((uint32_t) instance);
+		memcpy (elem + 4 + instance_offset, &word, 4);
+
+		memcpy (&word, &val, 4);
+		word = htonl (word);
+		memcpy (elem + 4 + value_offset, &word, 4);
+	}
+
+	std::vector<char> data;
+	size_t            instance_offset;
+	size_t            value_offset;
+};
+
+} // namespace SooperLooper
+
+#endif
@@ -64,6 +64,12 @@ using namespace SooperLooper;
 
 #define XFADE_SAMPLES 128
 
+// samples per bin at the bottom of the peak pyramid, as a shift
+#define PEAK_BIN_SHIFT 8
+
+// the background peak rescan covers this many times the samples of each run
+#define PEAK_SWEEP_RATIO 4
+
 // settle time for tap trigger (trigger if two changes
 // happen within at least X samples)
 //#define TRIG_SETTLE  4410
@@ -256,6 +262,176 @@ bool sl_has_loop (const LADSPA_Handle instance)
         return pLS->headLoopChunk != 0;
 }
 
+// each level of the peak pyramid is stored after the one below it
+static inline LADSPA_Data * peakLevel (SooperLooperI * pLS, unsigned int level)
+{
+	return pLS->pPeaks + 4 * (pLS->lPeakBins - (pLS->lPeakBins >> level));
+}
+
+// rescans the level 0 peak bins first to last (not wrapping) and rebuilds the levels above them
+static void updatePeakBins (SooperLooperI * pLS, unsigned long first, unsigned long last)
+{
+	LADSPA_Data * below = pLS->pPeaks;
+	LADSPA_Data * above;
+	const LADSPA_Data * buf;
+	LADSPA_Data lo, hi;
+	unsigned long bin, n;
+
+	for (bin = first; bin <= last; ++bin) {
+		buf = pLS->pSampleBuf + (bin << PEAK_BIN_SHIFT);
+		lo = hi = buf[0];
+		for (n = 1; n < (1UL << PEAK_BIN_SHIFT); ++n) {
+			if (buf[n] < lo) lo = buf[n];
+			else if (buf[n] > hi) hi = buf[n];
+		}
+		below[2*bin] = lo;
+		below[2*bin + 1] = hi;
+	}
+
+	for (unsigned int level = 1; level < pLS->lPeakLevels; ++level) {
+		above = peakLevel (pLS, level);
+		first >>= 1;
+		last >>= 1;
+		for (bin = first; bin <= last; ++bin) {
+			above[2*bin] = std::min (below[4*bin], below[4*bin + 2]);
+			above[2*bin + 1] = std::max (below[4*bin + 1], below[4*bin + 3]);
+		}
+		below = above;
+	}
+}
+
+// rescans the peaks for len samples of the sample buffer from bufpos, wrapping at its end
+static void updatePeaks (SooperLooperI * pLS, unsigned long bufpos, unsigned long len)
+{
+	if (!pLS->pPeaks || len == 0) return;
+
+	bufpos &= pLS->lBufferSizeMask;
+	if (len > pLS->lBufferSize) len = pLS->lBufferSize;
+
+	unsigned long first = bufpos >> PEAK_BIN_SHIFT;
+	unsigned long last = ((bufpos + len - 1) & pLS->lBufferSizeMask) >> PEAK_BIN_SHIFT;
+
+	if (bufpos + len <= pLS->lBufferSize) {
+		updatePeakBins (pLS, first, last);
+	}
+	else {
+		updatePeakBins (pLS, first, pLS->lPeakBins - 1);
+		updatePeakBins (pLS, 0, last);
+	}
+}
+
+// rescans the peaks for len samples of loop from loop position pos, wrapping at the loop end
+static void updateLoopPeaks (SooperLooperI * pLS, LoopChunk * loop, long pos, unsigned long len)
+{
+	if (!loop || loop->lLoopLength == 0) return;
+
+	if (len >= loop->lLoopLength) {
+		pos = 0;
+		len = loop->lLoopLength;
+	}
+
+	pos %= (long) loop->lLoopLength;
+	if (pos < 0) pos += loop->lLoopLength;
+
+	unsigned long tolen = loop->lLoopLength - pos;
+	if (len <= tolen) {
+		updatePeaks (pLS, loop->lLoopStart + pos, len);
+	}
+	else {
+		updatePeaks (pLS, loop->lLoopStart + pos, tolen);
+		updatePeaks (pLS, loop->lLoopStart, len - tolen);
+	}
+}
+
+// whether a run in state can change the samples of the head loop.  the
+// playing states only write while fading or with feedback during playback
+static inline bool peaksMayChange (SooperLooperI * pLS, int state, bool useFeedbackPlay, LADSPA_Data fFeedback)
+{
+	switch (state) {
+	case STATE_OFF:
+	case STATE_OFF_MUTE:
+	case STATE_PLAY:
+	case STATE_ONESHOT:
+	case STATE_SCRATCH:
+	case STATE_MUTE:
+	case STATE_PAUSED:
+	case STATE_TRIGGER_PLAY:
+		return pLS->fLoopFadeAtten != 0.0f || pLS->fFeedFadeAtten != 1.0f
+			|| (useFeedbackPlay && fFeedback != 1.0f);
+	default:
+		return true;
+	}
+}
+
+bool
+sl_get_loop_peaks (LADSPA_Handle instance, float * minmax, unsigned long points,
+		   unsigned long loop_offset, unsigned long frames, bool merge, bool exact)
+{
+	SooperLooperI * pLS = (SooperLooperI *)instance;
+
+	if (!pLS || !minmax || !pLS->pPeaks || points == 0) return false;
+
+	LoopChunk * loop = pLS->headLoopChunk;
+	if (!loop || loop->lLoopLength == 0) return false;
+
+	double span = frames / (double) points;
+
+	// use the coarsest level whose bins are no wider than a point,
+	// or the samples themselves when zoomed in past level 0 if asked to
+	bool raw = exact && span < (double) (1UL << PEAK_BIN_SHIFT);
+	unsigned int level = 0;
+	while (!raw && level + 1 < pLS->lPeakLevels && (double) (1UL << (PEAK_BIN_SHIFT + level + 1)) <= span) {
+		++level;
+	}
+
+	const LADSPA_Data * peaks = peakLevel (pLS, level);
+	unsigned int shift = PEAK_BIN_SHIFT + level;
+	unsigned long binmask = (pLS->lPeakBins >> level) - 1;
+
+	for (unsigned long n = 0; n < points; ++n) {
+		unsigned long from = loop_offset + (unsigned long) (n * span);
+		unsigned long to = loop_offset + (unsigned long) ((n + 1) * span);
+		LADSPA_Data lo = 0.0f, hi = 0.0f;
+
+		if (to <= from) to = from + 1;
+
+		if (from < loop->lLoopLength) {
+			if (to > loop->lLoopLength) to = loop->lLoopLength;
+
+			if (raw) {
+				lo = hi = pLS->pSampleBuf[(loop->lLoopStart + from) & pLS->lBufferSizeMask];
+				for (unsigned long pos = from + 1; pos < to; ++pos) {
+					LADSPA_Data val = pLS->pSampleBuf[(loop->lLoopStart + pos) & pLS->lBufferSizeMask];
+					if (val < lo) lo = val;
+					else if (val > hi) hi = val;
+				}
+			}
+			else {
+				unsigned long bin = (loop->lLoopStart + from) >> shift;
+				unsigned long lastbin = (loop->lLoopStart + to - 1) >> shift;
+
+				lo = peaks[2 * (bin & binmask)];
+				hi = peaks[2 * (bin & binmask) + 1];
+				for (++bin; bin <= lastbin; ++bin) {
+					lo = std::min (lo, peaks[2 * (bin & binmask)]);
+					hi = std::max (hi, peaks[2 * (bin & binmask) + 1]);
+				}
+			}
+		}
+
+		if (merge) {
+			minmax[2*n] = std::min (minmax[2*n], lo);
+			minmax[2*n + 1] = std::max (minmax[2*n + 1], hi);
+		}
+		else {
+			minmax[2*n] = lo;
+			minmax[2*n + 1] = hi;
+		}
+	}
+
+	return true;
+}
+
 static bool invalidateTails (SooperLooperI * pLS, unsigned long bufstart, unsigned long buflen, LoopChunk * currloop)
 {
 	LoopChunk * tailLoop = pLS->tailLoopChunk;
@@ -504,6 +680,7 @@ instantiateSooperLooper(const LADSPA_Descriptor * Descriptor,
    pLS->pSampleBuf = NULL;
    pLS->pLoopChunks = NULL;
    pLS->pInputBuf = NULL;
+   pLS->pPeaks = NULL;
    
    pLS->fSampleRate = (LADSPA_Data)SampleRate;
 
@@ -547,6 +724,16 @@ instantiateSooperLooper(const LADSPA_Descriptor * Descriptor,
 
    pLS->lastLoopChunk = pLS->pLoopChunks + pLS->lLoopChunkCount - 1;
 
+   // the peak pyramid needs a bit under 4 floats per level 0 bin, all levels included
+   pLS->lPeakBins = pLS->lBufferSize >> PEAK_BIN_SHIFT;
+   if (pLS->lPeakBins > 0) {
+	   pLS->pPeaks = (LADSPA_Data *) calloc(4 * pLS->lPeakBins, sizeof(LADSPA_Data));
+	   if (pLS->pPeaks == NULL) {
+		   goto cleanup;
+	   }
+	   for (pLS->lPeakLevels = 0; (pLS->lPeakBins >> pLS->lPeakLevels) > 0; ++pLS->lPeakLevels) {}
+   }
+
    // this is the input buffer to handle input latency.  32k max samples of input latency
    pLS->lInputBufSize = 32768;
    pLS->lInputBufMask = pLS->lInputBufSize - 1;
@@ -582,6 +769,9 @@ cleanup:
    if (pLS->pLoopChunks) {
 	   free (pLS->pLoopChunks);
    }
+   if (pLS->pPeaks) {
+	   free (pLS->pPeaks);
+   }
    return NULL;
    
 }
@@ -603,6 +793,10 @@ cleanupSooperLooper(LADSPA_Handle Instance) {
 	if (pLS->pSampleBuf) {
 		free (pLS->pSampleBuf);
 	}
+
+	if (pLS->pPeaks) {
+		free (pLS->pPeaks);
+	}
 	
 	//cerr << "******* cleanup SL instance" << endl;
 	
@@ -1750,6 +1944,8 @@ runSooperLooper(LADSPA_Handle Instance,
      // something is badly wrong!!!
      return;
   }
+
+  const int startState = pLS->state;
   
   pfInput = pLS->pfInput;
   pfOutput = pLS->pfOutput;
@@ -4801,6 +4997,40 @@ runSooperLooper(LADSPA_Handle Instance,
 	*pLS->pfStateOut = (LADSPA_Data) STATE_OFF;
 
   }
+
+  if (pLS->headLoopChunk && pLS->pPeaks) {
+     LoopChunk * head = pLS->headLoopChunk;
+     bool changing = peaksMayChange (pLS, pLS->state, useFeedbackPlay, fFeedback)
+	     || peaksMayChange (pLS, startState, useFeedbackPlay, fFeedback);
+
+     if (changing) {
+	// rescan the peaks around where this run could have written
+	long radius = (long) (SampleCount * std::max(1.0f, fabsf(pLS->fCurrRate * *pLS->pfRate)))
+		+ (long) *pLS->pfInputLatency + (long) *pLS->pfOutputLatency + 1;
+
+	updateLoopPeaks (pLS, head, (long) head->dCurrPos - radius, 2 * radius);
+     }
+
+     if (head != pLS->pPeakLoop || head->lLoopStart != pLS->lPeakLoopStart
+	 || head->lLoopLength != pLS->lPeakLoopLength || startState != pLS->state)
+     {
+	// bulk changes (fills after a record, undo, redo) can be anywhere in
+	// the loop, so go over all of it a slice per run.  a loop that is only
+	// playing needs no rescan at all
+	pLS->pPeakLoop = head;
+	pLS->lPeakLoopStart = head->lLoopStart;
+	pLS->lPeakLoopLength = head->lLoopLength;
+	pLS->lPeakSweepLeft = head->lLoopLength;
+     }
+
+     if (pLS->lPeakSweepLeft > 0 && head->lLoopLength > 0) {
+	unsigned long sweep = std::min (SampleCount * PEAK_SWEEP_RATIO, pLS->lPeakSweepLeft);
+	pLS->lPeakSweepPos %= head->lLoopLength;
+	updateLoopPeaks (pLS, head, (long) pLS->lPeakSweepPos, sweep);
+	pLS->lPeakSweepPos = (pLS->lPeakSweepPos + sweep) % head->lLoopLength;
+	pLS->lPeakSweepLeft -= sweep;
+     }
+  }
   
   
 }
@@ -193,6 +193,19 @@ typedef struct {
 	unsigned long lInputBufWritePos;
 	long lFramesUntilInput; // used for input latency compensation
 	long lFramesUntilFilled; // used to fill the gaps right after a record
+
+	// min/max peak pyramid over the sample buffer, indexed like pSampleBuf.
+	// level 0 has lPeakBins bins, each level above has half as many,
+	// the top level is a single bin.  stored as min,max pairs
+	LADSPA_Data * pPeaks;
+	unsigned long lPeakBins;
+	unsigned int lPeakLevels;
+	unsigned long lPeakSweepPos; // loop position of the background rescan
+	unsigned long lPeakSweepLeft; // how much of the loop it still has to cover
+	// the head loop as the peaks last saw it, a change restarts the rescan
+	LoopChunk * pPeakLoop;
+	unsigned long lPeakLoopStart;
+	unsigned long lPeakLoopLength;
 	
 	// the loopchunk pool
 	LoopChunk * pLoopChunks;
@@ -403,4 +416,13 @@ extern void sl_set_loop_index (LADSPA_Handle instance, unsigned int index, unsig
 
 extern bool sl_has_loop (const LADSPA_Handle instance);
 
+// fills points min,max pairs in minmax for the head loop from loop_offset for frames,
+// each pair covering frames/points samples.  if merge is true, the existing values
+// in minmax are widened instead of replaced.  returns false if there is no loop.
+// when a pair covers less than a level 0 bin, exact scans the samples themselves,
+// otherwise it is the bin the pair falls in.  RT-safe, and without exact the cost
+// depends only on points (with it, up to points * 256 samples are read).
+extern bool sl_get_loop_peaks (LADSPA_Handle instance, float * minmax, unsigned long points,
+			       unsigned long loop_offset, unsigned long frames, bool merge, bool exact);
+
 #endif
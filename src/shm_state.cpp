@@ -0,0 +1,255 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_state.hpp"
+
+using namespace SooperLooper;
+using namespace std;
+
+ShmState::ShmState (string name, nframes_t samplerate)
+	: _name(name), _seg(0), _cmd_ring(0), _peaks(0)
+{
+	if (_name.empty() || _name[0] != '/') {
+		_name = "/" + _name;
+	}
+	_cmd_name = _name + "-cmd";
+	_peaks_name = _name + "-peaks";
+
+	void * addr = create_segment (_name, sizeof(sl_shm_state_t), 0644);
+	if (!addr) {
+		return;
+	}
+
+	_seg = (sl_shm_state_t *) addr;
+
+	_seg->version = SL_SHM_VERSION;
+	_seg->size = sizeof(sl_shm_state_t);
+	_seg->max_loops = SL_SHM_MAX_LOOPS;
+	_seg->sample_rate = samplerate;
+	_seg->selected_loop = -1;
+
+	// magic last, clients check it to see the header is complete
+	__sync_synchronize();
+	_seg->magic = SL_SHM_MAGIC;
+
+	// commands can only come from the same user or group
+	addr = create_segment (_cmd_name, sizeof(sl_shm_cmd_ring_t), 0660);
+	if (!addr) {
+		munmap (_seg, sizeof(sl_shm_state_t));
+		shm_unlink (_name.c_str());
+		_seg = 0;
+		return;
+	}
+
+	_cmd_ring = (sl_shm_cmd_ring_t *) addr;
+
+	_cmd_ring->version = SL_SHM_CMD_VERSION;
+	_cmd_ring->size = sizeof(sl_shm_cmd_ring_t);
+	_cmd_ring->slots = SL_SHM_CMD_SLOTS;
+
+	for (uint32_t n = 0; n < SL_SHM_CMD_SLOTS; ++n) {
+		_cmd_ring->cmds[n].seq = n;
+	}
+
+	__sync_synchronize();
+	_cmd_ring->magic = SL_SHM_CMD_MAGIC;
+
+	// the overviews are optional, state and commands work without them
+	addr = create_segment (_peaks_name, sizeof(sl_shm_peaks_t), 0644);
+	if (!addr) {
+		return;
+	}
+
+	_peaks = (sl_shm_peaks_t *) addr;
+
+	_peaks->version = SL_SHM_PEAKS_VERSION;
+	_peaks->size = sizeof(sl_shm_peaks_t);
+	_peaks->max_loops = SL_SHM_MAX_LOOPS;
+	_peaks->points = SL_SHM_PEAK_POINTS;
+
+	__sync_synchronize();
+	_peaks->magic = SL_SHM_PEAKS_MAGIC;
+}
+
+ShmState::~ShmState ()
+{
+	if (_peaks) {
+		munmap (_peaks, sizeof(sl_shm_peaks_t));
+		shm_unlink (_peaks_name.c_str());
+		_peaks = 0;
+	}
+
+	if (_cmd_ring) {
+		munmap (_cmd_ring, sizeof(sl_shm_cmd_ring_t));
+		shm_unlink (_cmd_name.c_str());
+		_cmd_ring = 0;
+	}
+
+	if (_seg) {
+		munmap (_seg, sizeof(sl_shm_state_t));
+		shm_unlink (_name.c_str());
+		_seg = 0;
+	}
+}
+
+void *
+ShmState::create_segment (string name, size_t size, mode_t mode)
+{
+	int fd = shm_open (name.c_str(), O_CREAT | O_RDWR, mode);
+	if (fd < 0) {
+		cerr << "sooperlooper: cannot create shared memory segment " << name << ": " << strerror(errno) << endl;
+		return 0;
+	}
+
+	if (ftruncate (fd, size) < 0) {
+		cerr << "sooperlooper: cannot size shared memory segment " << name << ": " << strerror(errno) << endl;
+		close (fd);
+		shm_unlink (name.c_str());
+		return 0;
+	}
+
+	void * addr = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (addr == MAP_FAILED) {
+		cerr << "sooperlooper: cannot map shared memory segment " << name << ": " << strerror(errno) << endl;
+		shm_unlink (name.c_str());
+		return 0;
+	}
+
+	// the rt thread touches this every cycle, keep it from paging
+	mlock (addr, size);
+	memset (addr, 0, size);
+
+	return addr;
+}
+
+void
+ShmState::publish (const EngineStateSnapshot & snap, uint64_t frame_clock)
+{
+	// this is the rt thread
+	if (!_seg) return;
+
+	++_seg->seq;
+	__sync_synchronize();
+
+	unsigned int count = snap.loop_count < SL_SHM_MAX_LOOPS ? snap.loop_count : SL_SHM_MAX_LOOPS;
+
+	for (unsigned int n = 0; n < count; ++n) {
+		const float * ports = snap.loops[n].ports;
+		sl_shm_loop_t & loop = _seg->loops[n];
+
+		loop.state = ports[State];
+		loop.next_state = ports[NextState];
+		loop.waiting = ports[Waiting];
+		loop.position = ports[LoopPosition];
+		loop.length = ports[LoopLength];
+		loop.cycle_length = ports[CycleLength];
+		loop.free_time = ports[LoopFreeMemory];
+		loop.total_time = ports[LoopMemory];
+		loop.rate = ports[TrueRate];
+		loop.wet = ports[WetLevel];
+		loop.feedback = ports[Feedback];
+		loop.dry = snap.loops[n].dry;
+		loop.input_gain = snap.loops[n].input_gain;
+		loop.in_peak = snap.loops[n].in_peak;
+		loop.out_peak = snap.loops[n].out_peak;
+	}
+
+	_seg->loop_count = count;
+	if (_peaks) {
+		_peaks->loop_count = count;
+	}
+	_seg->frame = frame_clock;
+	_seg->selected_loop = snap.selected_loop;
+	_seg->tempo = snap.tempo;
+	_seg->sync_source = snap.sync_source;
+	_seg->eighth_per_cycle = snap.eighth_cycle;
+	_seg->in_peak = snap.in_peak;
+	_seg->out_peak = snap.out_peak;
+	_seg->wet = snap.wet;
+	_seg->dry = snap.dry;
+	_seg->input_gain = snap.input_gain;
+
+	__sync_synchronize();
+	++_seg->seq;
+}
+
+const sl_shm_cmd_t *
+ShmState::peek_command ()
+{
+	// this is the rt thread, the only consumer
+	if (!_cmd_ring) return 0;
+
+	uint32_t pos = _cmd_ring->head;
+	sl_shm_cmd_t * cmd = &_cmd_ring->cmds[pos & (SL_SHM_CMD_SLOTS - 1)];
+
+	if (cmd->seq != pos + 1) {
+		// empty, or the producer hasn't finished filling it in
+		return 0;
+	}
+
+	__sync_synchronize();
+	return cmd;
+}
+
+void
+ShmState::pop_command ()
+{
+	uint32_t pos = _cmd_ring->head;
+	sl_shm_cmd_t * cmd = &_cmd_ring->cmds[pos & (SL_SHM_CMD_SLOTS - 1)];
+
+	__sync_synchronize();
+	// hand the slot back to the producers for the next lap
+	cmd->seq = pos + SL_SHM_CMD_SLOTS;
+	_cmd_ring->head = pos + 1;
+}
+
+float *
+ShmState::begin_peaks (unsigned int index)
+{
+	// this is the rt thread
+	if (!_peaks || index >= SL_SHM_MAX_LOOPS) return 0;
+
+	++_peaks->loops[index].seq;
+	__sync_synchronize();
+
+	return _peaks->loops[index].minmax;
+}
+
+void
+ShmState::end_peaks (unsigned int index, unsigned int points, float length)
+{
+	sl_shm_peaks_loop_t & loop = _peaks->loops[index];
+
+	loop.points = points;
+	loop.length = length;
+
+	__sync_synchronize();
+	++loop.seq;
+}
@@ -0,0 +1,77 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_shm_state__
+#define __sooperlooper_shm_state__
+
+#include <string>
+#include <sys/types.h>
+
+#include "audio_driver.hpp"
+#include "state_snapshot.hpp"
+#include "sl_shm.h"
+
+namespace SooperLooper {
+
+/*
+ * Owns the POSIX shared memory segments described in sl_shm.h, copies
+ * the engine's per-cycle state snapshot into one, hands out the commands
+ * local clients push into another and keeps the loop waveform overviews
+ * in the third.
+ */
+class ShmState
+{
+  public:
+	ShmState (std::string name, nframes_t samplerate);
+	~ShmState ();
+
+	bool is_ok() const { return _seg != 0; }
+	std::string get_name() const { return _name; }
+
+	// called from the rt thread
+	void publish (const EngineStateSnapshot & snap, uint64_t frame_clock);
+
+	// called from the rt thread, the next pending command or 0 if there is none.
+	// it stays pending until pop_command() is called.
+	const sl_shm_cmd_t * peek_command ();
+	void pop_command ();
+
+	// called from the rt thread, the SL_SHM_PEAK_POINTS min,max pairs returned
+	// by begin_peaks are rewritten and then published by end_peaks.  begin_peaks
+	// returns 0 if there is no overview segment.
+	float * begin_peaks (unsigned int index);
+	void end_peaks (unsigned int index, unsigned int points, float length);
+
+  private:
+
+	void * create_segment (std::string name, size_t size, mode_t mode);
+
+	std::string      _name;
+	sl_shm_state_t * _seg;
+
+	std::string         _cmd_name;
+	sl_shm_cmd_ring_t * _cmd_ring;
+
+	std::string      _peaks_name;
+	sl_shm_peaks_t * _peaks;
+};
+
+} // namespace SooperLooper
+
+#endif
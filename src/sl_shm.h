@@ -0,0 +1,425 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+/*
+ * Layout of the shared memory state segment sooperlooper exports when
+ * started with --shm-name, and a few inline helpers for local clients
+ * (C or C++) that want to read it without going through OSC.
+ *
+ * The engine rewrites the segment once per audio cycle, guarded by a
+ * sequence counter that is odd while a write is in progress.  Readers
+ * never block the engine, they just retry a copy that was torn.
+ *
+ *   sl_shm_state_t * seg = sl_shm_open ("/sooperlooper");
+ *   sl_shm_state_t   state;
+ *   if (seg && sl_shm_read (seg, &state) == 0) {
+ *       printf ("loop 0 pos %f\n", state.loops[0].position);
+ *   }
+ *   sl_shm_close (seg);
+ *
+ * A second segment, named like the first with "-cmd" appended, holds
+ * a ring of commands that any number of local processes can push to.
+ * The engine drains it at the start of every audio cycle.
+ *
+ *   sl_shm_cmd_ring_t * ring = sl_shm_cmd_open ("/sooperlooper-cmd");
+ *   sl_shm_cmd_push (ring, SL_SHM_CMD_HIT, 0, 5, 0.0f, 0);    // record (Event::RECORD) on loop 0, asap
+ *   sl_shm_cmd_close (ring);
+ *
+ * A third, named with "-peaks" appended, holds a min/max waveform overview
+ * of each loop.  The engine refreshes one loop's overview per audio cycle.
+ * Each point is at least one 256 sample peak bin wide, so a loop shorter
+ * than 512 bins repeats a bin over neighbouring points.
+ *
+ *   sl_shm_peaks_t * peaks = sl_shm_peaks_open ("/sooperlooper-peaks");
+ *   sl_shm_peaks_loop_t overview;
+ *   if (peaks && sl_shm_peaks_read_loop (peaks, 0, &overview) == 0) {
+ *       draw (overview.minmax, overview.points);
+ *   }
+ *   sl_shm_peaks_close (peaks);
+ */
+
+#ifndef __sooperlooper_sl_shm_h__
+#define __sooperlooper_sl_shm_h__
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SL_SHM_MAGIC      0x534c5348  /* "SLSH" */
+#define SL_SHM_VERSION    1
+#define SL_SHM_MAX_LOOPS  64
+
+typedef struct {
+	float state;        /* same values as the OSC "state" control */
+	float next_state;
+	float waiting;
+	float position;     /* seconds */
+	float length;       /* seconds */
+	float cycle_length; /* seconds */
+	float free_time;    /* seconds */
+	float total_time;   /* seconds */
+	float rate;
+	float in_peak;
+	float out_peak;
+	float wet;
+	float dry;
+	float input_gain;
+	float feedback;
+} sl_shm_loop_t;
+
+typedef struct {
+	/* fixed at creation */
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;          /* sizeof(sl_shm_state_t) */
+	uint32_t max_loops;
+
+	/* odd while the engine is writing */
+	volatile uint32_t seq;
+
+	uint32_t sample_rate;
+	uint64_t frame;         /* running frame count of the last write */
+
+	uint32_t loop_count;
+	int32_t  selected_loop;
+	float    tempo;
+	float    sync_source;
+	float    eighth_per_cycle;
+	float    in_peak;
+	float    out_peak;
+	float    wet;
+	float    dry;
+	float    input_gain;
+
+	sl_shm_loop_t loops[SL_SHM_MAX_LOOPS];
+} sl_shm_state_t;
+
+
+/* maps the named segment read-only, returns 0 if it doesn't exist or doesn't match this header */
+static inline sl_shm_state_t * sl_shm_open (const char * name)
+{
+	void * addr;
+	int fd = shm_open (name, O_RDONLY, 0);
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	addr = mmap (0, sizeof(sl_shm_state_t), PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (addr == MAP_FAILED) {
+		return 0;
+	}
+
+	if (((sl_shm_state_t *) addr)->magic != SL_SHM_MAGIC
+	    || ((sl_shm_state_t *) addr)->version != SL_SHM_VERSION
+	    || ((sl_shm_state_t *) addr)->size != sizeof(sl_shm_state_t))
+	{
+		munmap (addr, sizeof(sl_shm_state_t));
+		return 0;
+	}
+
+	return (sl_shm_state_t *) addr;
+}
+
+static inline void sl_shm_close (sl_shm_state_t * seg)
+{
+	if (seg) {
+		munmap ((void *) seg, sizeof(sl_shm_state_t));
+	}
+}
+
+/* copies a consistent snapshot into dest, returns -1 if the engine kept it busy for too long */
+static inline int sl_shm_read (const sl_shm_state_t * seg, sl_shm_state_t * dest)
+{
+	int tries;
+	uint32_t seq1, seq2;
+
+	for (tries = 0; tries < 1000; ++tries) {
+		seq1 = seg->seq;
+		__sync_synchronize();
+		if (seq1 & 1) {
+			continue;
+		}
+
+		memcpy (dest, (const void *) seg, sizeof(sl_shm_state_t));
+
+		__sync_synchronize();
+		seq2 = seg->seq;
+		if (seq1 == seq2) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* as above, but copies only one loop's values */
+static inline int sl_shm_read_loop (const sl_shm_state_t * seg, unsigned int index, sl_shm_loop_t * dest)
+{
+	int tries;
+	uint32_t seq1, seq2;
+
+	if (index >= SL_SHM_MAX_LOOPS) {
+		return -1;
+	}
+
+	for (tries = 0; tries < 1000; ++tries) {
+		seq1 = seg->seq;
+		__sync_synchronize();
+		if (seq1 & 1) {
+			continue;
+		}
+
+		if (index >= seg->loop_count) {
+			__sync_synchronize();
+			if (seg->seq == seq1) {
+				return -1;
+			}
+			continue;
+		}
+
+		memcpy (dest, (const void *) &seg->loops[index], sizeof(sl_shm_loop_t));
+
+		__sync_synchronize();
+		seq2 = seg->seq;
+		if (seq1 == seq2) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/* command ring */
+
+#define SL_SHM_CMD_MAGIC    0x534c4343  /* "SLCC" */
+#define SL_SHM_CMD_VERSION  1
+#define SL_SHM_CMD_SLOTS    256         /* must be a power of two */
+
+/* record types, same values as SooperLooper::Event::type_t */
+#define SL_SHM_CMD_DOWN            0
+#define SL_SHM_CMD_UP              1
+#define SL_SHM_CMD_UPFORCE         2
+#define SL_SHM_CMD_HIT             3
+#define SL_SHM_CMD_CONTROL         4
+#define SL_SHM_CMD_GLOBAL_CONTROL  6
+
+typedef struct {
+	volatile uint32_t seq;  /* owned by the push/pop protocol */
+	int32_t  type;          /* SL_SHM_CMD_* */
+	int32_t  instance;      /* loop index, -1 all, -3 selected, -2 global */
+	int32_t  id;            /* SooperLooper::Event::command_t or control_t value */
+	float    value;         /* control value, ignored for commands */
+	uint32_t reserved;
+	uint64_t frame;         /* engine frame (see sl_shm_state_t.frame) to apply at, 0 for asap */
+} sl_shm_cmd_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;          /* sizeof(sl_shm_cmd_ring_t) */
+	uint32_t slots;
+
+	volatile uint32_t tail; /* next slot a producer claims */
+	uint32_t pad1[15];
+	volatile uint32_t head; /* next slot the engine reads */
+	uint32_t pad2[15];
+
+	sl_shm_cmd_t cmds[SL_SHM_CMD_SLOTS];
+} sl_shm_cmd_ring_t;
+
+
+static inline sl_shm_cmd_ring_t * sl_shm_cmd_open (const char * name)
+{
+	void * addr;
+	int fd = shm_open (name, O_RDWR, 0);
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	addr = mmap (0, sizeof(sl_shm_cmd_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (addr == MAP_FAILED) {
+		return 0;
+	}
+
+	if (((sl_shm_cmd_ring_t *) addr)->magic != SL_SHM_CMD_MAGIC
+	    || ((sl_shm_cmd_ring_t *) addr)->version != SL_SHM_CMD_VERSION
+	    || ((sl_shm_cmd_ring_t *) addr)->size != sizeof(sl_shm_cmd_ring_t))
+	{
+		munmap (addr, sizeof(sl_shm_cmd_ring_t));
+		return 0;
+	}
+
+	return (sl_shm_cmd_ring_t *) addr;
+}
+
+static inline void sl_shm_cmd_close (sl_shm_cmd_ring_t * ring)
+{
+	if (ring) {
+		munmap ((void *) ring, sizeof(sl_shm_cmd_ring_t));
+	}
+}
+
+/* safe to call from any number of processes and threads, returns -1 if the ring is full */
+static inline int sl_shm_cmd_push (sl_shm_cmd_ring_t * ring, int type, int instance, int id, float value, uint64_t frame)
+{
+	sl_shm_cmd_t * cmd;
+	uint32_t pos = ring->tail;
+	int32_t  dif;
+
+	for (;;) {
+		cmd = &ring->cmds[pos & (SL_SHM_CMD_SLOTS - 1)];
+		dif = (int32_t) (cmd->seq - pos);
+
+		if (dif == 0) {
+			if (__sync_bool_compare_and_swap (&ring->tail, pos, pos + 1)) {
+				break;
+			}
+			pos = ring->tail;
+		}
+		else if (dif < 0) {
+			/* engine hasn't caught up */
+			return -1;
+		}
+		else {
+			pos = ring->tail;
+		}
+	}
+
+	cmd->type = type;
+	cmd->instance = instance;
+	cmd->id = id;
+	cmd->value = value;
+	cmd->frame = frame;
+
+	__sync_synchronize();
+	cmd->seq = pos + 1;
+
+	return 0;
+}
+
+
+/* waveform overviews */
+
+#define SL_SHM_PEAKS_MAGIC    0x534c504b  /* "SLPK" */
+#define SL_SHM_PEAKS_VERSION  1
+#define SL_SHM_PEAK_POINTS    512
+
+typedef struct {
+	volatile uint32_t seq;  /* odd while the engine is writing this loop */
+	uint32_t points;        /* pairs in use, 0 if there is no loop */
+	float    length;        /* seconds from the loop start the points cover */
+	uint32_t reserved;
+	float    minmax[SL_SHM_PEAK_POINTS * 2];  /* min,max pairs, all channels combined */
+} sl_shm_peaks_loop_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;          /* sizeof(sl_shm_peaks_t) */
+	uint32_t max_loops;
+
+	uint32_t points;        /* SL_SHM_PEAK_POINTS */
+	volatile uint32_t loop_count;
+
+	sl_shm_peaks_loop_t loops[SL_SHM_MAX_LOOPS];
+} sl_shm_peaks_t;
+
+
+static inline sl_shm_peaks_t * sl_shm_peaks_open (const char * name)
+{
+	void * addr;
+	int fd = shm_open (name, O_RDONLY, 0);
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	addr = mmap (0, sizeof(sl_shm_peaks_t), PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (addr == MAP_FAILED) {
+		return 0;
+	}
+
+	if (((sl_shm_peaks_t *) addr)->magic != SL_SHM_PEAKS_MAGIC
+	    || ((sl_shm_peaks_t *) addr)->version != SL_SHM_PEAKS_VERSION
+	    || ((sl_shm_peaks_t *) addr)->size != sizeof(sl_shm_peaks_t))
+	{
+		munmap (addr, sizeof(sl_shm_peaks_t));
+		return 0;
+	}
+
+	return (sl_shm_peaks_t *) addr;
+}
+
+static inline void sl_shm_peaks_close (sl_shm_peaks_t * seg)
+{
+	if (seg) {
+		munmap ((void *) seg, sizeof(sl_shm_peaks_t));
+	}
+}
+
+/* copies a consistent overview of one loop into dest, returns -1 if there is no
+   such loop or the engine kept it busy for too long */
+static inline int sl_shm_peaks_read_loop (const sl_shm_peaks_t * seg, unsigned int index, sl_shm_peaks_loop_t * dest)
+{
+	int tries;
+	uint32_t seq1, seq2;
+
+	if (index >= SL_SHM_MAX_LOOPS || index >= seg->loop_count) {
+		return -1;
+	}
+
+	for (tries = 0; tries < 1000; ++tries) {
+		seq1 = seg->loops[index].seq;
+		__sync_synchronize();
+		if (seq1 & 1) {
+			continue;
+		}
+
+		memcpy (dest, (const void *) &seg->loops[index], sizeof(sl_shm_peaks_loop_t));
+
+		__sync_synchronize();
+		seq2 = seg->loops[index].seq;
+		if (seq1 == seq2) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
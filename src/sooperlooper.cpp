@@ -62,7 +62,7 @@ Transmitter  error (Transmitter::Error);
 #define DEFAULT_LOOP_TIME 40.0f
 
 
-char *optstring = "c:l:j:p:m:t:U:S:D:L:qVh";
+char *optstring = "c:l:j:p:m:t:U:S:D:L:H:TMJqVh";
 
 struct option long_options[] = {
 	{ "help", 0, 0, 'h' },
@@ -77,6 +77,10 @@ struct option long_options[] = {
 	{ "jack-server-name", 1, 0, 'S' },
 	{ "load-midi-binding", 1, 0, 'm' },
 	{ "ping-url", 1, 0, 'U' },
+	{ "shm-name", 1, 0, 'H' },
+	{ "osc-tcp", 0, 0, 'T' },
+	{ "trace-midi", 0, 0, 'M' },
+	{ "jack-midi", 0, 0, 'J' },
 	{ "version", 0, 0, 'V' },
 	{ 0, 0, 0, 0 }
 };
@@ -86,7 +90,7 @@ struct OptionInfo
 {
 	OptionInfo() :
 		loop_count(1), channels(2), quiet(false), jack_name(""),
-		oscport(DEFAULT_OSC_PORT), loopsecs(DEFAULT_LOOP_TIME), discrete_io(true),
+		oscport(DEFAULT_OSC_PORT), osctcp(false), tracemidi(false), jackmidi(false), loopsecs(DEFAULT_LOOP_TIME), discrete_io(true),
 		show_usage(0), show_version(0), pingurl() {} 
 		
 	int loop_count;
@@ -95,6 +99,9 @@ struct OptionInfo
 	string jack_name;
 	string jack_server_name;
 	int oscport;
+	bool osctcp;
+	bool tracemidi;
+	bool jackmidi;
 	string bindfile;
 	float loopsecs;
 	bool  discrete_io;
@@ -103,6 +110,7 @@ struct OptionInfo
 	int show_version;
 	string pingurl;
 	string loadsession;
+	string shmname;
 };
 
 
@@ -120,9 +128,13 @@ static void usage(char *argv0)
 	fprintf(stderr, "  -L <pathname> , --load-session=<pathname> load initial session from pathname\n");
 	fprintf(stderr, "  -D <yes/no>, --discrete-io=[yes]  initial loops should have discrete input and output ports (default yes)\n");
 	fprintf(stderr, "  -p <num> , --osc-port=<num>  udp port number for OSC server (default is %d)\n", DEFAULT_OSC_PORT);
+	fprintf(stderr, "  -T , --osc-tcp               also accept OSC over TCP on the same port number\n");
 	fprintf(stderr, "  -j <str> , --jack-name=<str> jack client name, default is sooperlooper\n");
 	fprintf(stderr, "  -S <str> , --jack-server-name=<str> specify jack server name\n");
 	fprintf(stderr, "  -m <str> , --load-midi-binding=<str> loads midi binding from file or preset\n");
+	fprintf(stderr, "  -H <str> , --shm-name=<str>  export loop state to the named POSIX shared memory segment\n");
+	fprintf(stderr, "  -M , --trace-midi            log incoming midi and the bindings it matches to stderr\n");
+	fprintf(stderr, "  -J , --jack-midi             use JACK midi ports instead of the system midi ports\n");
 	fprintf(stderr, "  -q , --quiet                 do not output status to stderr\n");
 	fprintf(stderr, "  -h , --help                  this usage output\n");
 	fprintf(stderr, "  -V , --version               show version only\n");
@@ -183,6 +195,18 @@ static void parse_options (int argc, char **argv, OptionInfo & option_info)
 		case 'L':
 			option_info.loadsession = optarg;
 			break;
+		case 'H':
+			option_info.shmname = optarg;
+			break;
+		case 'T':
+			option_info.osctcp = true;
+			break;
+		case 'M':
+			option_info.tracemidi = true;
+			break;
+		case 'J':
+			option_info.jackmidi = true;
+			break;
 		default:
 			fprintf (stderr, "argument error: %d\n", c);
 			option_info.show_usage++;
@@ -320,12 +344,17 @@ int main(int argc, char** argv)
 
 	engine->set_default_loop_secs (option_info.loopsecs);
 	engine->set_default_channels (option_info.channels);
+	engine->set_osc_tcp (option_info.osctcp);
 	
 	if (!engine->initialize(driver, 2, option_info.oscport, option_info.pingurl)) {
 		cerr << "cannot initialize sooperlooper\n";
 		exit (1);
 	}
 
+	if (!option_info.shmname.empty() && !engine->set_shm_name (option_info.shmname)) {
+		cerr << "cannot export state to shared memory, continuing without it\n";
+	}
+
 	if (!option_info.quiet) {
 
 		cerr << "OSC server URI (network) is: " << engine->get_osc_url() << endl;
@@ -360,19 +389,30 @@ int main(int argc, char** argv)
 
 	MidiBridge * midibridge = 0;
 
+	if (option_info.jackmidi) {
+		// midi is read and written by the process callback, along with the audio
+		if (driver->create_midi_ports ("midi_in", "midi_out")) {
+			midibridge = new MidiBridge(driver->get_name());
+		}
+	}
 #if WITH_ALSA
-	// start up alsamidi bridge
-	MIDI::PortRequest portreq (driver->get_name(), "sooperlooper", "duplex", "alsa/sequencer");
-	midibridge = new MidiBridge(driver->get_name(), portreq);
-
+	else {
+		// start up alsamidi bridge
+		MIDI::PortRequest portreq (driver->get_name(), "sooperlooper", "duplex", "alsa/sequencer");
+		midibridge = new MidiBridge(driver->get_name(), portreq);
+	}
 #elif WITH_COREMIDI
-	MIDI::PortRequest portreq (driver->get_name(), driver->get_name(),  "duplex", "coremidi");
-	midibridge = new MidiBridge(driver->get_name(), portreq);
+	else {
+		MIDI::PortRequest portreq (driver->get_name(), driver->get_name(),  "duplex", "coremidi");
+		midibridge = new MidiBridge(driver->get_name(), portreq);
+	}
 #endif
 
 	if (midibridge && midibridge->is_ok()) {
+		midibridge->set_trace_midi (option_info.tracemidi);
 		engine->set_midi_bridge(midibridge);
 		if (!option_info.bindfile.empty()) {
+			PBD::LockMonitor lm (midibridge->bindings_lock(), __LINE__, __FILE__);
 			engine->load_midi_bindings(option_info.bindfile, false, cmdmap);
 			//midibridge->bindings().load_bindings (option_info.bindfile);
 		}
@@ -383,6 +423,7 @@ int main(int argc, char** argv)
 	engine->mainloop();
 
 	if (midibridge) {
+		engine->get_midi_latency().dump (stderr);
 		delete midibridge;
 	}
 
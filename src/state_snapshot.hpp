@@ -0,0 +1,131 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_state_snapshot__
+#define __sooperlooper_state_snapshot__
+
+#include <stdint.h>
+
+#include "plugin.hpp"
+
+namespace SooperLooper {
+
+class Looper;
+
+/*
+ * Double buffered seqlock.  A single writer (the rt thread) fills the
+ * buffer that readers are not looking at and then publishes it, it
+ * never waits.  Readers copy what they need out of the last published
+ * buffer and retry only if the writer got all the way around to
+ * overwriting that same buffer while they were reading.
+ *
+ * Write n goes into buffer n&1, the sequence is 2n-1 while it is in
+ * progress and 2n when it is done.
+ */
+template <class T>
+class SeqLockBuffer
+{
+  public:
+	SeqLockBuffer() : _seq(0) {}
+
+	// writer side, rt thread only
+
+	T & begin_write () {
+		++_seq;
+		__sync_synchronize();
+		return _bufs[((_seq + 1) >> 1) & 1];
+	}
+
+	void end_write () {
+		__sync_synchronize();
+		++_seq;
+	}
+
+	// reader side, any thread
+
+	// returns a token to pass to read_valid(), and the buffer to read from
+	uint32_t read_begin (const T * & buf) const {
+		uint32_t seq = _seq;
+		__sync_synchronize();
+		buf = &_bufs[(seq >> 1) & 1];
+		return seq;
+	}
+
+	// true if what was read since read_begin() is consistent
+	bool read_valid (uint32_t token) const {
+		__sync_synchronize();
+		uint32_t seq = _seq;
+		// the buffer we read is reused by the write after next
+		uint32_t limit = (token | 1) + 2;
+		return (seq - token) < (limit - token);
+	}
+
+	void read (T & dest) const {
+		const T * buf;
+		uint32_t token;
+		do {
+			token = read_begin (buf);
+			dest = *buf;
+		} while (!read_valid (token));
+	}
+
+  private:
+	volatile uint32_t _seq;
+	T                 _bufs[2];
+};
+
+
+// beyond this many loops the non-rt side reads the loops directly
+#define SNAPSHOT_MAX_LOOPS 64
+
+/*
+ * Values owned by the rt thread, copied once per process cycle so the
+ * non-rt threads can read a consistent set without touching the loops.
+ */
+struct LoopStateSnapshot
+{
+	const Looper * looper;
+	float          ports[LASTPORT];
+	float          dry;
+	float          input_gain;
+	float          in_peak;
+	float          out_peak;
+};
+
+struct EngineStateSnapshot
+{
+	EngineStateSnapshot() : loop_count(0) {}
+
+	unsigned int       loop_count;
+	LoopStateSnapshot  loops[SNAPSHOT_MAX_LOOPS];
+
+	float              tempo;
+	float              sync_source;
+	float              eighth_cycle;
+	float              dry;
+	float              wet;
+	float              input_gain;
+	float              in_peak;
+	float              out_peak;
+	int                selected_loop;
+};
+
+} // namespace SooperLooper
+
+#endif
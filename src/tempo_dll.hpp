@@ -0,0 +1,131 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+#ifndef __sooperlooper_tempo_dll__
+#define __sooperlooper_tempo_dll__
+
+#include <cmath>
+#include <algorithm>
+
+// how far off its prediction a tick can be and still count towards lock, as a part of a period
+#define TEMPO_DLL_LOCK_ERROR 0.05
+
+namespace SooperLooper {
+
+/*
+ * Second order delay-locked loop following a stream of periodic ticks,
+ * such as midi clock.  Each tick's arrival time goes in, a filtered time
+ * for that tick and a filtered period come out, so jitter in the arrival
+ * times doesn't show up in either.  The bandwidth (in Hz) trades jitter
+ * rejection against how quickly a tempo change is followed.
+ *
+ * Times are in frames.  It does no allocation, it is meant to be used
+ * from the rt thread.
+ */
+class TempoDll
+{
+  public:
+	// ticks in a row within TEMPO_DLL_LOCK_ERROR of the prediction before it counts as locked
+	static const int LockTicks = 24;
+
+	TempoDll (double bandwidth = 1.0) : _bandwidth(bandwidth) { reset(); }
+
+	void reset () {
+		_ticks = 0;
+		_in_lock = 0;
+		_locked = false;
+		_period = 0.0;
+		_filtered = 0.0;
+		_predicted = 0.0;
+	}
+
+	void set_bandwidth (double hz) { _bandwidth = hz; }
+	double get_bandwidth () const { return _bandwidth; }
+
+	// returns the filtered time of this tick
+	double tick (double time, double samplerate) {
+		if (_ticks == 0) {
+			_filtered = time;
+			++_ticks;
+			return time;
+		}
+
+		if (_ticks == 1 || _period <= 0.0) {
+			// two ticks give a first period to start from
+			start (time, time - _filtered);
+			return time;
+		}
+
+		double err = time - _predicted;
+
+		if (fabs (err) > _period * 0.5) {
+			// ticks went missing or the tempo jumped, start over from here
+			start (time, std::max (1.0, time - _filtered));
+			return time;
+		}
+
+		double omega = 2.0 * M_PI * _bandwidth * _period / samplerate;
+		double b = M_SQRT2 * omega;
+		double c = omega * omega;
+
+		_filtered = _predicted;
+		_predicted += b * err + _period;
+		_period += c * err;
+		++_ticks;
+
+		if (fabs (err) < _period * TEMPO_DLL_LOCK_ERROR) {
+			if (_in_lock < LockTicks) {
+				++_in_lock;
+			}
+		}
+		else {
+			_in_lock = 0;
+		}
+		_locked = (_in_lock >= LockTicks);
+
+		return _filtered;
+	}
+
+	bool is_locked () const { return _locked; }
+	bool has_period () const { return _ticks > 1 && _period > 0.0; }
+	double get_period () const { return _period; }
+
+  private:
+	void start (double time, double period) {
+		_period = period;
+		_filtered = time;
+		_predicted = time + period;
+		_ticks = 2;
+		_in_lock = 0;
+		_locked = false;
+	}
+
+	double _bandwidth;
+	int    _ticks;
+	int    _in_lock;
+	bool   _locked;
+
+	double _period;     // filtered time between ticks
+	double _filtered;   // filtered time of the last tick
+	double _predicted;  // when the next tick is expected
+};
+
+} // namespace SooperLooper
+
+#endif
@@ -0,0 +1,302 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+/*
+ * Standalone check of the loop peak pyramid: after updates that wrap at
+ * the loop end or at the end of the sample buffer, every level has to
+ * match the samples it covers, and sl_get_loop_peaks() has to read the
+ * bins (or samples) that a point covers, for a loop that wraps the buffer.
+ */
+
+// the update functions are static
+#include "../plugin.cc"
+
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++failures; \
+		} \
+	} while (0)
+
+// 16 level 0 bins, 5 levels
+static const unsigned long BufferSize = 16UL << PEAK_BIN_SHIFT;
+
+// the same samples every run
+static unsigned int seed = 1;
+
+static LADSPA_Data
+random_sample ()
+{
+	seed = seed * 1103515245 + 12345;
+	return (LADSPA_Data) ((seed >> 8) & 0xffff) / 32767.5f - 1.0f;
+}
+
+struct TestLooper
+{
+	SooperLooperI ls;
+	LoopChunk     loop;
+
+	TestLooper (unsigned long start, unsigned long length) {
+		memset (&ls, 0, sizeof(ls));
+		memset (&loop, 0, sizeof(loop));
+
+		ls.lBufferSize = BufferSize;
+		ls.lBufferSizeMask = BufferSize - 1;
+		ls.pSampleBuf = (LADSPA_Data *) calloc (BufferSize, sizeof(LADSPA_Data));
+		ls.lPeakBins = BufferSize >> PEAK_BIN_SHIFT;
+		ls.pPeaks = (LADSPA_Data *) calloc (4 * ls.lPeakBins, sizeof(LADSPA_Data));
+		for (ls.lPeakLevels = 0; (ls.lPeakBins >> ls.lPeakLevels) > 0; ++ls.lPeakLevels) {}
+
+		loop.lLoopStart = start;
+		loop.lLoopLength = length;
+		loop.valid = 1;
+		ls.headLoopChunk = &loop;
+
+		for (unsigned long n = 0; n < BufferSize; ++n) {
+			ls.pSampleBuf[n] = random_sample () * 0.5f;
+		}
+		updatePeaks (&ls, 0, BufferSize);
+	}
+
+	~TestLooper () {
+		free (ls.pSampleBuf);
+		free (ls.pPeaks);
+	}
+
+	LADSPA_Data & at_loop (unsigned long pos) {
+		return ls.pSampleBuf[(loop.lLoopStart + pos) & ls.lBufferSizeMask];
+	}
+
+	// min and max of the samples of bin at level
+	void bin_peaks (unsigned int level, unsigned long bin, LADSPA_Data & lo, LADSPA_Data & hi) {
+		unsigned int shift = PEAK_BIN_SHIFT + level;
+		unsigned long first = (bin << shift) & ls.lBufferSizeMask;
+
+		lo = hi = ls.pSampleBuf[first];
+		for (unsigned long n = 1; n < (1UL << shift); ++n) {
+			lo = std::min (lo, ls.pSampleBuf[first + n]);
+			hi = std::max (hi, ls.pSampleBuf[first + n]);
+		}
+	}
+
+	// whether every bin of every level matches its samples
+	bool pyramid_matches () {
+		for (unsigned int level = 0; level < ls.lPeakLevels; ++level) {
+			const LADSPA_Data * peaks = peakLevel (&ls, level);
+			for (unsigned long bin = 0; bin < (ls.lPeakBins >> level); ++bin) {
+				LADSPA_Data lo, hi;
+				bin_peaks (level, bin, lo, hi);
+				if (peaks[2*bin] != lo || peaks[2*bin + 1] != hi) {
+					fprintf (stderr, "level %u bin %lu is %g %g, samples %g %g\n", level, bin, peaks[2*bin], peaks[2*bin + 1], lo, hi);
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+};
+
+static void
+test_full_rebuild ()
+{
+	TestLooper looper (0, BufferSize);
+
+	CHECK (looper.ls.lPeakLevels == 5);
+	CHECK (looper.pyramid_matches ());
+}
+
+static void
+test_buffer_wrap ()
+{
+	// the loop runs over the end of the sample buffer
+	unsigned long start = BufferSize - 300;
+	TestLooper looper (start, 1000);
+
+	// louder than anything there, on both sides of the buffer end
+	looper.at_loop (290) = 0.9f;
+	looper.at_loop (310) = -0.9f;
+	updateLoopPeaks (&looper.ls, &looper.loop, 280, 40);
+	CHECK (looper.pyramid_matches ());
+
+	// the same through updatePeaks directly
+	looper.ls.pSampleBuf[BufferSize - 1] = -0.95f;
+	looper.ls.pSampleBuf[0] = 0.95f;
+	updatePeaks (&looper.ls, BufferSize - 1, 2);
+	CHECK (looper.pyramid_matches ());
+
+	// a position past the end of the buffer wraps too
+	looper.ls.pSampleBuf[5] = 0.97f;
+	updatePeaks (&looper.ls, BufferSize + 5, 1);
+	CHECK (looper.pyramid_matches ());
+}
+
+static void
+test_loop_wrap ()
+{
+	unsigned long start = 1000;
+	TestLooper looper (start, 2000);
+
+	// a run over the loop end carries on from the loop start
+	looper.at_loop (1990) = 0.9f;
+	looper.at_loop (20) = -0.9f;
+	updateLoopPeaks (&looper.ls, &looper.loop, 1950, 100);
+	CHECK (looper.pyramid_matches ());
+
+	// negative and out of range positions land inside the loop
+	looper.at_loop (1999) = -0.96f;
+	updateLoopPeaks (&looper.ls, &looper.loop, -1, 1);
+	CHECK (looper.pyramid_matches ());
+
+	looper.at_loop (3) = 0.96f;
+	updateLoopPeaks (&looper.ls, &looper.loop, 4003, 1);
+	CHECK (looper.pyramid_matches ());
+
+	// more than the loop is the whole loop
+	looper.at_loop (1000) = -0.98f;
+	looper.at_loop (1500) = 0.98f;
+	updateLoopPeaks (&looper.ls, &looper.loop, 1700, 5000);
+	CHECK (looper.pyramid_matches ());
+}
+
+// what a point from..to of the loop should read at a level, going by the samples
+static void
+expected_peaks (TestLooper & looper, bool raw, unsigned int level, unsigned long from, unsigned long to,
+		LADSPA_Data & lo, LADSPA_Data & hi)
+{
+	if (raw) {
+		lo = hi = looper.at_loop (from);
+		for (unsigned long pos = from + 1; pos < to; ++pos) {
+			lo = std::min (lo, looper.at_loop (pos));
+			hi = std::max (hi, looper.at_loop (pos));
+		}
+		return;
+	}
+
+	unsigned int shift = PEAK_BIN_SHIFT + level;
+	unsigned long bins = looper.ls.lPeakBins >> level;
+	unsigned long first = (looper.loop.lLoopStart + from) >> shift;
+	unsigned long last = (looper.loop.lLoopStart + to - 1) >> shift;
+	LADSPA_Data binlo, binhi;
+
+	looper.bin_peaks (level, first % bins, lo, hi);
+	for (unsigned long bin = first + 1; bin <= last; ++bin) {
+		looper.bin_peaks (level, bin % bins, binlo, binhi);
+		lo = std::min (lo, binlo);
+		hi = std::max (hi, binhi);
+	}
+}
+
+// reads points over all of the loop and checks each against the samples
+static bool
+peaks_match (TestLooper & looper, unsigned long points, bool exact, unsigned int level)
+{
+	std::vector<float> minmax (2 * points);
+	unsigned long length = looper.loop.lLoopLength;
+	double span = length / (double) points;
+	bool raw = exact && span < (double) (1UL << PEAK_BIN_SHIFT);
+
+	if (!sl_get_loop_peaks (&looper.ls, &minmax[0], points, 0, length, false, exact)) {
+		return false;
+	}
+
+	for (unsigned long n = 0; n < points; ++n) {
+		unsigned long from = (unsigned long) (n * span);
+		unsigned long to = std::max (from + 1, (unsigned long) ((n + 1) * span));
+		LADSPA_Data lo, hi;
+
+		expected_peaks (looper, raw, level, from, std::min (to, length), lo, hi);
+		if (minmax[2*n] != lo || minmax[2*n + 1] != hi) {
+			fprintf (stderr, "point %lu of %lu is %g %g, expected %g %g\n", n, points, minmax[2*n], minmax[2*n + 1], lo, hi);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+test_get_peaks ()
+{
+	// starts mid bin and runs over the end of the sample buffer
+	unsigned long start = BufferSize - 1000;
+	TestLooper looper (start, 3000);
+
+	// zoomed in past level 0, the samples themselves only if exact
+	CHECK (peaks_match (looper, 750, true, 0));
+	CHECK (peaks_match (looper, 750, false, 0));
+
+	// a point per 300 samples is level 0, per 600 level 1, per 1500 level 2
+	CHECK (peaks_match (looper, 10, true, 0));
+	CHECK (peaks_match (looper, 5, false, 1));
+	CHECK (peaks_match (looper, 2, false, 2));
+
+	// one point for the whole loop, the wrapped bins included
+	CHECK (peaks_match (looper, 1, false, 3));
+
+	// no loop, no peaks
+	float minmax[2];
+	looper.loop.lLoopLength = 0;
+	CHECK (!sl_get_loop_peaks (&looper.ls, minmax, 1, 0, 100, false, false));
+}
+
+static void
+test_get_peaks_merge_and_past_end ()
+{
+	TestLooper looper (BufferSize - 500, 1000);
+	std::vector<float> minmax (8);
+	LADSPA_Data lo, hi;
+
+	// the second half of the points is past the loop end and reads as silence
+	CHECK (sl_get_loop_peaks (&looper.ls, &minmax[0], 4, 0, 2000, false, true));
+	expected_peaks (looper, false, 0, 0, 500, lo, hi);
+	CHECK (minmax[0] == lo && minmax[1] == hi);
+	CHECK (minmax[4] == 0.0f && minmax[5] == 0.0f);
+	CHECK (minmax[6] == 0.0f && minmax[7] == 0.0f);
+
+	// merging only widens what is there
+	for (int n = 0; n < 4; ++n) {
+		minmax[2*n] = -2.0f;
+		minmax[2*n + 1] = 0.01f;
+	}
+	CHECK (sl_get_loop_peaks (&looper.ls, &minmax[0], 4, 0, 2000, true, true));
+	CHECK (minmax[0] == -2.0f && minmax[1] == std::max (0.01f, hi));
+	CHECK (minmax[4] == -2.0f && minmax[5] == 0.01f);
+}
+
+int
+main (int argc, char ** argv)
+{
+	test_full_rebuild ();
+	test_buffer_wrap ();
+	test_loop_wrap ();
+	test_get_peaks ();
+	test_get_peaks_merge_and_past_end ();
+
+	if (failures) {
+		fprintf (stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+
+	fprintf (stderr, "all passed\n");
+	return 0;
+}
@@ -0,0 +1,295 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+/*
+ * Standalone check of the bulk midi decoder, Parser::parse(): the bytes
+ * of a read go in, and the channel, system common and realtime messages
+ * in them have to come out whole and in order, with the state between
+ * reads (running status, a message split over two reads, being inside a
+ * sysex) carried over.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <fcntl.h>
+
+#include <pbd/transmitter.h>
+
+Transmitter error (Transmitter::Error);
+Transmitter info (Transmitter::Info);
+Transmitter warning (Transmitter::Warning);
+Transmitter fatal (Transmitter::Fatal);
+
+#include <midi++/parser.h>
+#include <midi++/nullmidi.h>
+#include <midi++/port_request.h>
+
+using namespace MIDI;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++failures; \
+		} \
+	} while (0)
+
+#define CHECK_EVENT(ev, st, d1, d2) \
+	CHECK ((ev).status == (st) && (ev).data1 == (d1) && (ev).data2 == (d2))
+
+static const size_t MaxEvents = 16;
+
+// the parser only needs a port to belong to
+static Port *
+null_port ()
+{
+	static Port * port = 0;
+
+	if (!port) {
+		PortRequest req;
+		req.devname = "null";
+		req.tagname = "null";
+		req.mode = O_WRONLY;
+		port = new Null_MidiPort (req);
+	}
+	return port;
+}
+
+// parses all of len, which has to fit in MaxEvents
+static size_t
+parse_all (Parser & parser, const byte * buf, size_t len, ParsedEvent * events, timestamp_t ts = 1.0)
+{
+	size_t used = 0;
+	size_t n = parser.parse (buf, len, ts, events, MaxEvents, used);
+
+	CHECK (used == len);
+	return n;
+}
+
+static void
+test_channel_messages ()
+{
+	Parser parser (*null_port());
+	ParsedEvent ev[MaxEvents];
+	// note on, note off, a controller, a program change, pitch bend
+	const byte buf[] = { 0x90, 0x40, 0x7f, 0x81, 0x40, 0x00, 0xb2, 0x07, 0x64, 0xc3, 0x05, 0xe4, 0x00, 0x40 };
+
+	CHECK (parse_all (parser, buf, sizeof(buf), ev, 2.5) == 5);
+	CHECK_EVENT (ev[0], 0x90, 0x40, 0x7f);
+	CHECK_EVENT (ev[1], 0x81, 0x40, 0x00);
+	CHECK_EVENT (ev[2], 0xb2, 0x07, 0x64);
+	CHECK_EVENT (ev[3], 0xc3, 0x05, 0x00);
+	CHECK_EVENT (ev[4], 0xe4, 0x00, 0x40);
+	CHECK (ev[0].timestamp == 2.5 && ev[4].timestamp == 2.5);
+
+	CHECK (parser.message_counts()[0x90] == 1);
+	CHECK (parser.message_counts()[0xb0] == 1);
+}
+
+static void
+test_running_status ()
+{
+	Parser parser (*null_port());
+	ParsedEvent ev[MaxEvents];
+	const byte notes[] = { 0x90, 0x40, 0x7f, 0x41, 0x7f, 0x40, 0x00 };
+	const byte programs[] = { 0xc0, 0x01, 0x02, 0x03 };
+
+	CHECK (parse_all (parser, notes, sizeof(notes), ev) == 3);
+	CHECK_EVENT (ev[0], 0x90, 0x40, 0x7f);
+	CHECK_EVENT (ev[1], 0x90, 0x41, 0x7f);
+	CHECK_EVENT (ev[2], 0x90, 0x40, 0x00);
+
+	// one data byte messages run too
+	CHECK (parse_all (parser, programs, sizeof(programs), ev) == 3);
+	CHECK_EVENT (ev[0], 0xc0, 0x01, 0x00);
+	CHECK_EVENT (ev[1], 0xc0, 0x02, 0x00);
+	CHECK_EVENT (ev[2], 0xc0, 0x03, 0x00);
+}
+
+static void
+test_split_across_reads ()
+{
+	Parser parser (*null_port());
+	ParsedEvent ev[MaxEvents];
+	const byte first[] = { 0xb0, 0x07 };
+	const byte second[] = { 0x64, 0x0a };
+	const byte third[] = { 0x20 };
+
+	// the message finishes in the next read, with that read's time
+	CHECK (parse_all (parser, first, sizeof(first), ev, 1.0) == 0);
+	CHECK (parse_all (parser, second, sizeof(second), ev, 2.0) == 1);
+	CHECK_EVENT (ev[0], 0xb0, 0x07, 0x64);
+	CHECK (ev[0].timestamp == 2.0);
+
+	// and running status carries on over the read after that
+	CHECK (parse_all (parser, third, sizeof(third), ev, 3.0) == 1);
+	CHECK_EVENT (ev[0], 0xb0, 0x0a, 0x20);
+}
+
+static void
+test_realtime_inside_message ()
+{
+	Parser parser (*null_port());
+	ParsedEvent ev[MaxEvents];
+	// clock ticks and active sense in the middle of note ons
+	const byte buf[] = { 0x90, 0xf8, 0x40, 0xfe, 0x7f, 0x41, 0xfa, 0x7f, 0xfc };
+
+	CHECK (parse_all (parser, buf, sizeof(buf), ev) == 5);
+	CHECK_EVENT (ev[0], 0xf8, 0x00, 0x00);
+	CHECK_EVENT (ev[1], 0x90, 0x40, 0x7f);
+	CHECK_EVENT (ev[2], 0xfa, 0x00, 0x00);
+	CHECK_EVENT (ev[3], 0x90, 0x41, 0x7f);
+	CHECK_EVENT (ev[4], 0xfc, 0x00, 0x00);
+
+	// active sense is counted but not passed on
+	CHECK (parser.message_counts()[0xfe] == 1);
+	CHECK (parser.message_counts()[0xf8] == 1);
+}
+
+static void
+test_sysex_skipped ()
+{
+	Parser parser (*null_port());
+	ParsedEvent ev[MaxEvents];
+	// running status is cancelled by the sysex, and a tick inside it still counts
+	const byte buf[] = { 0x90, 0x40, 0x7f, 0xf0, 0x7e, 0x7f, 0xf8, 0x06, 0x01, 0xf7, 0x41, 0x7f, 0x92, 0x30, 0x10 };
+	// a sysex spread over reads is skipped until it ends
+	const byte start[] = { 0xf0, 0x43, 0x10 };
+	const byte middle[] = { 0x4c, 0x00, 0x00 };
+	const byte end[] = { 0x7e, 0x00, 0xf7, 0x80, 0x30, 0x00 };
+
+	CHECK (parse_all (parser, buf, sizeof(buf), ev) == 3);
+	CHECK_EVENT (ev[0], 0x90, 0x40, 0x7f);
+	CHECK_EVENT (ev[1], 0xf8, 0x00, 0x00);
+	CHECK_EVENT (ev[2], 0x92, 0x30, 0x10);
+
+	CHECK (parse_all (parser, start, sizeof(start), ev) == 0);
+	CHECK (parse_all (parser, middle, sizeof(middle), ev) == 0);
+	CHECK (parse_all (parser, end, sizeof(end), ev) == 1);
+	CHECK_EVENT (ev[0], 0x80, 0x30, 0x00);
+}
+
+static void
+test_system_common ()
+{
+	Parser parser (*null_port());
+	ParsedEvent ev[MaxEvents];
+	// song select cancels the running note on, so the data after it is dropped
+	const byte select[] = { 0x90, 0x40, 0x7f, 0xf3, 0x05, 0x41, 0x7f };
+	// song position has two data bytes, tune request none
+	const byte position[] = { 0xf2, 0x10, 0x02, 0x11, 0xf6, 0x12, 0xb0, 0x01, 0x02 };
+
+	CHECK (parse_all (parser, select, sizeof(select), ev) == 2);
+	CHECK_EVENT (ev[0], 0x90, 0x40, 0x7f);
+	CHECK_EVENT (ev[1], 0xf3, 0x05, 0x00);
+
+	CHECK (parse_all (parser, position, sizeof(position), ev) == 3);
+	CHECK_EVENT (ev[0], 0xf2, 0x10, 0x02);
+	CHECK_EVENT (ev[1], 0xf6, 0x00, 0x00);
+	CHECK_EVENT (ev[2], 0xb0, 0x01, 0x02);
+}
+
+static void
+test_events_full ()
+{
+	Parser parser (*null_port());
+	ParsedEvent ev[MaxEvents];
+	const byte buf[] = { 0x90, 0x40, 0x7f, 0x41, 0x7f, 0xf8, 0x42, 0x7f };
+	size_t used = 0;
+	size_t n;
+
+	// it stops right after the event that filled the array
+	n = parser.parse (buf, sizeof(buf), 1.0, ev, 1, used);
+	CHECK (n == 1 && used == 3);
+	CHECK_EVENT (ev[0], 0x90, 0x40, 0x7f);
+
+	n = parser.parse (buf + 3, sizeof(buf) - 3, 1.0, ev, 2, used);
+	CHECK (n == 2 && used == 3);
+	CHECK_EVENT (ev[0], 0x90, 0x41, 0x7f);
+	CHECK_EVENT (ev[1], 0xf8, 0x00, 0x00);
+
+	// and picks up where it left off
+	n = parser.parse (buf + 6, sizeof(buf) - 6, 1.0, ev, 2, used);
+	CHECK (n == 1 && used == 2);
+	CHECK_EVENT (ev[0], 0x90, 0x42, 0x7f);
+}
+
+static std::vector<ParsedEvent> bulk_events;
+static int bulk_calls = 0;
+
+static void
+bulk_received (Parser & parser, ParsedEvent * events, size_t count)
+{
+	++bulk_calls;
+	bulk_events.insert (bulk_events.end(), events, events + count);
+}
+
+static void
+test_feed_bulk ()
+{
+	Parser parser (*null_port());
+	std::vector<byte> buf;
+
+	// more events than feed() decodes at a time
+	for (int n = 0; n < 100; ++n) {
+		buf.push_back (0xf8);
+		buf.push_back (0x90);
+		buf.push_back ((byte) n);
+		buf.push_back (0x7f);
+	}
+
+	parser.set_bulk (true);
+	parser.bulk.connect (sigc::ptr_fun (&bulk_received));
+	parser.feed (&buf[0], buf.size(), 4.0);
+
+	CHECK (bulk_calls > 1);
+	CHECK (bulk_events.size() == 200);
+
+	bool inorder = (bulk_events.size() == 200);
+	for (size_t n = 0; inorder && n < 100; ++n) {
+		inorder = bulk_events[2*n].status == 0xf8 && bulk_events[2*n + 1].status == 0x90
+			&& bulk_events[2*n + 1].data1 == n && bulk_events[2*n + 1].timestamp == 4.0;
+	}
+	CHECK (inorder);
+}
+
+int
+main (int argc, char ** argv)
+{
+	test_channel_messages ();
+	test_running_status ();
+	test_split_across_reads ();
+	test_realtime_inside_message ();
+	test_sysex_skipped ();
+	test_system_common ();
+	test_events_full ();
+	test_feed_bulk ();
+
+	if (failures) {
+		fprintf (stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+
+	fprintf (stderr, "all passed\n");
+	return 0;
+}
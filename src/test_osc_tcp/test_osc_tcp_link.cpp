@@ -0,0 +1,253 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+/*
+ * Loopback test of OscTcpLink: a client that doesn't read makes the
+ * link congested without blocking the sender, everything queued arrives
+ * intact and in order once it reads, and a client that goes away makes
+ * the link fail.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../osc_tcp_link.hpp"
+
+using namespace SooperLooper;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++failures; \
+		} \
+	} while (0)
+
+static const size_t PacketSize = 1000;
+
+static void
+fill_packet (char * buf, uint32_t seq)
+{
+	for (size_t n = 0; n < PacketSize; ++n) {
+		buf[n] = (char) (seq + n);
+	}
+}
+
+static int
+listen_loopback (char * portstr, size_t portlen)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	// keep the kernel buffers small, so the link's own queue takes the backlog
+	int size = 4096;
+	setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (fd < 0 || bind (fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen (fd, 1) < 0
+	    || getsockname (fd, (struct sockaddr *) &addr, &addrlen) < 0)
+	{
+		perror ("loopback listen");
+		exit (1);
+	}
+
+	snprintf (portstr, portlen, "%d", ntohs (addr.sin_port));
+	return fd;
+}
+
+static int
+accept_client (int listenfd)
+{
+	struct pollfd pfd;
+	pfd.fd = listenfd;
+	pfd.events = POLLIN;
+
+	if (poll (&pfd, 1, 2000) <= 0) {
+		fprintf (stderr, "no connection from the link\n");
+		exit (1);
+	}
+
+	return accept (listenfd, 0, 0);
+}
+
+static bool
+read_all (int fd, char * buf, size_t len, OscTcpLink & link)
+{
+	size_t got = 0;
+
+	while (got < len) {
+		ssize_t ret = recv (fd, buf + got, len - got, MSG_DONTWAIT);
+
+		if (ret > 0) {
+			got += ret;
+		}
+		else if (ret == 0) {
+			return false;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			// the link only writes when asked to
+			if (!link.flush()) {
+				return false;
+			}
+			usleep (1000);
+		}
+		else if (errno != EINTR) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+test_congestion_and_drain ()
+{
+	char port[16];
+	int listenfd = listen_loopback (port, sizeof(port));
+	OscTcpLink link ("127.0.0.1", port);
+	int fd = accept_client (listenfd);
+	char packet[PacketSize];
+	uint32_t sent = 0;
+
+	CHECK (!link.is_failed());
+
+	// the client reads nothing, so this has to stop short of blocking
+	while (!link.is_congested() && sent < 10000) {
+		fill_packet (packet, sent);
+		CHECK (link.send (packet, sizeof(packet)));
+		++sent;
+	}
+
+	CHECK (link.is_congested());
+	CHECK (link.queued() <= OscTcpLink::MaxQueued);
+	fprintf (stderr, "congested after %u packets, %lu bytes queued\n", sent, (unsigned long) link.queued());
+
+	// a full queue refuses packets instead of growing
+	uint32_t refused = 0;
+	while (sent < 10000) {
+		fill_packet (packet, sent);
+		if (!link.send (packet, sizeof(packet))) {
+			refused = sent;
+			break;
+		}
+		++sent;
+	}
+	fprintf (stderr, "refused at %u, %lu queued\n", refused, (unsigned long) link.queued());
+	CHECK (refused > 0);
+	CHECK (!link.is_failed());
+
+	// everything accepted comes out framed and in order
+	for (uint32_t seq = 0; seq < sent; ++seq) {
+		uint32_t size;
+		char expect[PacketSize];
+
+		if (!read_all (fd, (char *) &size, 4, link) || !read_all (fd, packet, PacketSize, link)) {
+			CHECK (!"short read");
+			break;
+		}
+
+		fill_packet (expect, seq);
+		CHECK (ntohl (size) == PacketSize);
+		CHECK (memcmp (packet, expect, PacketSize) == 0);
+	}
+
+	CHECK (link.flush());
+	CHECK (link.queued() == 0);
+	CHECK (!link.is_congested());
+
+	close (fd);
+	close (listenfd);
+}
+
+static void
+test_client_gone ()
+{
+	char port[16];
+	int listenfd = listen_loopback (port, sizeof(port));
+	OscTcpLink link ("127.0.0.1", port);
+	int fd = accept_client (listenfd);
+	char packet[PacketSize];
+	int tries;
+
+	fill_packet (packet, 0);
+	CHECK (link.send (packet, sizeof(packet)));
+
+	close (fd);
+	close (listenfd);
+
+	// the reset shows up on one of the next writes
+	for (tries = 0; tries < 100 && link.send (packet, sizeof(packet)); ++tries) {
+		usleep (1000);
+	}
+
+	CHECK (link.is_failed());
+	CHECK (!link.send (packet, sizeof(packet)));
+}
+
+static void
+test_nobody_listening ()
+{
+	char port[16];
+	int listenfd = listen_loopback (port, sizeof(port));
+	close (listenfd);
+
+	OscTcpLink link ("127.0.0.1", port);
+	char packet[PacketSize];
+	int tries;
+
+	fill_packet (packet, 0);
+	for (tries = 0; tries < 100 && link.send (packet, sizeof(packet)); ++tries) {
+		usleep (1000);
+	}
+
+	CHECK (link.is_failed());
+}
+
+int
+main (int argc, char ** argv)
+{
+	test_congestion_and_drain ();
+	test_client_gone ();
+	test_nobody_listening ();
+
+	if (failures) {
+		fprintf (stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+
+	fprintf (stderr, "all passed\n");
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+** Copyright (C) 2004 Jesse Chappell <jesse@essej.net>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+*/
+
+/*
+ * Standalone check of TempoDll: midi clock ticks with arrival jitter go
+ * in, and the filtered period and tick times that come out have to be
+ * steadier than what went in, follow tempo changes, and start over when
+ * ticks go missing.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include "../tempo_dll.hpp"
+
+using namespace SooperLooper;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++failures; \
+		} \
+	} while (0)
+
+static const double Rate = 48000.0;
+
+// the period of midi clock ticks at a tempo, 24 to the quarter note
+static double
+tick_period (double bpm)
+{
+	return Rate * 60.0 / (24.0 * bpm);
+}
+
+// the same jitter every run
+static unsigned int seed = 1;
+
+static double
+jitter (double range)
+{
+	seed = seed * 1103515245 + 12345;
+	double unit = (double) ((seed >> 8) & 0xffff) / 65535.0;
+	return (unit * 2.0 - 1.0) * range;
+}
+
+static void
+test_first_ticks ()
+{
+	TempoDll dll;
+
+	CHECK (!dll.has_period());
+	CHECK (dll.tick (500.0, Rate) == 500.0);
+	CHECK (!dll.has_period());
+	CHECK (dll.tick (1500.0, Rate) == 1500.0);
+	CHECK (dll.has_period());
+	CHECK (dll.get_period() == 1000.0);
+	CHECK (!dll.is_locked());
+
+	dll.reset ();
+	CHECK (!dll.has_period());
+	CHECK (!dll.is_locked());
+}
+
+// 120 bpm with +-20 frames of arrival jitter for 10 minutes
+static void
+test_steady_with_jitter ()
+{
+	TempoDll dll (1.0);
+	double period = tick_period (120.0);
+	int ticks = (int) (600.0 * Rate / period);
+	int settle = (int) (10.0 * Rate / period);
+	int locked_at = -1;
+	bool lost_lock = false;
+	double last = -1.0;
+	bool monotonic = true;
+	double max_period_err = 0.0;
+	double period_err = 0.0;
+	double jitter_in = 0.0;
+	double jitter_out = 0.0;
+	int count = 0;
+
+	seed = 1;
+
+	for (int n = 0; n < ticks; ++n) {
+		double ideal = 1000.0 + n * period;
+		double arrival = ideal + jitter (20.0);
+		double filtered = dll.tick (arrival, Rate);
+
+		if (filtered <= last) {
+			monotonic = false;
+		}
+		last = filtered;
+
+		if (dll.is_locked()) {
+			if (locked_at < 0) {
+				locked_at = n;
+			}
+		}
+		else if (locked_at >= 0) {
+			lost_lock = true;
+		}
+
+		if (n >= settle) {
+			double err = dll.get_period() - period;
+			max_period_err = std::max (max_period_err, fabs (err));
+			period_err += err * err;
+			jitter_in += (arrival - ideal) * (arrival - ideal);
+			jitter_out += (filtered - ideal) * (filtered - ideal);
+			++count;
+		}
+	}
+
+	CHECK (locked_at >= 0 && locked_at < 2 * TempoDll::LockTicks);
+	CHECK (!lost_lock);
+	CHECK (monotonic);
+	// rms within 0.1% of the real tempo, and never more than 0.2% off
+	CHECK (sqrt (period_err / count) < period * 0.001);
+	CHECK (max_period_err < period * 0.002);
+	// and the tick times have under half the rms jitter of the arrival times
+	CHECK (sqrt (jitter_out / count) < sqrt (jitter_in / count) * 0.5);
+}
+
+static void
+test_tempo_change ()
+{
+	TempoDll dll (1.0);
+	double time = 0.0;
+	double period = tick_period (120.0);
+	int ticks = (int) (10.0 * Rate / period);
+
+	seed = 2;
+
+	for (int n = 0; n < ticks; ++n) {
+		dll.tick (time + jitter (10.0), Rate);
+		time += period;
+	}
+	CHECK (fabs (dll.get_period() - period) < period * 0.001);
+
+	// a small change is followed without starting over
+	period = tick_period (126.0);
+	ticks = (int) (10.0 * Rate / period);
+
+	for (int n = 0; n < ticks; ++n) {
+		dll.tick (time + jitter (10.0), Rate);
+		time += period;
+	}
+	CHECK (fabs (dll.get_period() - period) < period * 0.001);
+	CHECK (dll.is_locked());
+}
+
+static void
+test_missing_ticks ()
+{
+	TempoDll dll (1.0);
+	double time = 0.0;
+	double period = tick_period (120.0);
+
+	for (int n = 0; n < 200; ++n) {
+		dll.tick (time, Rate);
+		time += period;
+	}
+	CHECK (dll.is_locked());
+
+	// three ticks go missing, it starts over from the next one
+	time += 3.0 * period;
+	CHECK (dll.tick (time, Rate) == time);
+	CHECK (!dll.is_locked());
+	CHECK (dll.has_period());
+	time += period;
+
+	for (int n = 0; n < 200; ++n) {
+		dll.tick (time, Rate);
+		time += period;
+	}
+	CHECK (dll.is_locked());
+	CHECK (fabs (dll.get_period() - period) < period * 0.001);
+}
+
+static void
+test_no_lock_with_heavy_jitter ()
+{
+	TempoDll dll (1.0);
+	double period = tick_period (120.0);
+	bool locked = false;
+
+	seed = 3;
+
+	// a fifth of a period either way is far past the lock window
+	for (int n = 0; n < 2000; ++n) {
+		dll.tick (n * period + jitter (period * 0.2), Rate);
+		locked = locked || dll.is_locked();
+	}
+	CHECK (!locked);
+	CHECK (dll.has_period());
+}
+
+int
+main (int argc, char ** argv)
+{
+	test_first_ticks ();
+	test_steady_with_jitter ();
+	test_tempo_change ();
+	test_missing_ticks ();
+	test_no_lock_with_heavy_jitter ();
+
+	if (failures) {
+		fprintf (stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+
+	fprintf (stderr, "all passed\n");
+	return 0;
+}